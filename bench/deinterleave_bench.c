@@ -0,0 +1,94 @@
+// Microbenchmark for the map msb/lsb deinterleave kernels
+//
+// Usage: deinterleave_bench [iterations]
+// Splits 16 bit RGBA maps of several sizes with every kernel the CPU
+// supports and compares throughput with the scalar loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "deinterleave.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const struct
+{
+	const char* name;
+	int width, height;
+} sizes[] =
+{
+	{ "720p",  1280,  720 },
+	{ "1080p", 1920, 1080 },
+	{ "4K",    3840, 2160 },
+};
+
+static const char* kernels[] = { "scalar", "sse2", "ssse3", "neon" };
+
+int main(int argc, char** argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 10;
+	int s, k, i;
+
+	printf("%-6s %-7s %10s %9s\n", "map", "kernel", "MB/s", "speedup");
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	{
+		// one 8 bit plane has 4 bytes per pixel, the PNG data twice that
+		size_t n = (size_t)sizes[s].width * sizes[s].height * 4;
+		uint8_t* src = malloc(2 * n);
+		uint8_t* even = malloc(n);
+		uint8_t* odd = malloc(n);
+		uint8_t* ref = malloc(2 * n);
+		if (src == NULL || even == NULL || odd == NULL || ref == NULL)
+		{
+			printf("error: out of memory\n");
+			return 1;
+		}
+		for (i = 0; i < 2 * n; i++)
+			src[i] = (uint8_t)rand();
+
+		double scalar_rate = 0;
+		for (k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++)
+		{
+			if (deinterleave_select_kernel(kernels[k]) != 0)
+				continue;
+
+			// warm up and check against the scalar result
+			deinterleave(src, even, odd, n);
+			if (k == 0)
+			{
+				memcpy(ref, even, n);
+				memcpy(ref + n, odd, n);
+			}
+			else if (memcmp(ref, even, n) != 0 || memcmp(ref + n, odd, n) != 0)
+			{
+				printf("error: %s kernel output differs from scalar\n", kernels[k]);
+				return 1;
+			}
+
+			double start = now();
+			for (i = 0; i < iterations; i++)
+				deinterleave(src, even, odd, n);
+			double rate = 2.0 * n * iterations / (now() - start) / 1e6;
+
+			if (k == 0)
+				scalar_rate = rate;
+			printf("%-6s %-7s %10.0f %8.2fx\n", sizes[s].name, kernels[k],
+				rate, rate / scalar_rate);
+		}
+
+		free(src);
+		free(even);
+		free(odd);
+		free(ref);
+	}
+
+	return 0;
+}
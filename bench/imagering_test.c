@@ -0,0 +1,252 @@
+// Test of the egl_render image ring against a mock decoder
+//
+// Usage: imagering_test
+// Drives the ring through IMAGE_RING_OPS_T the way egl_render and the
+// render loop do, and checks which buffers the decoder gets back and when.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "imagering.h"
+
+// the mock decoder: the buffers it has been handed, in order
+typedef struct
+{
+	void* buffers[64];
+	int count;
+	bool refuse;
+} DECODER_T;
+
+static int failures;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { printf("error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static int mock_fill(void* context, void* buffer)
+{
+	DECODER_T* decoder = context;
+
+	if (decoder->refuse)
+		return -1;
+	decoder->buffers[decoder->count++] = buffer;
+	return 0;
+}
+
+static char buffers[IMAGE_RING_SIZE];
+
+static void setup(IMAGE_RING_T* ring, DECODER_T* decoder, bool keep_all)
+{
+	IMAGE_RING_OPS_T ops = { mock_fill, decoder };
+	int i;
+
+	memset(decoder, 0, sizeof(*decoder));
+	image_ring_init(ring, IMAGE_RING_SIZE, &ops, keep_all);
+	for (i = 0; i < IMAGE_RING_SIZE; i++)
+	{
+		ring->slots[i].texture = i + 1;
+		ring->slots[i].buffer = &buffers[i];
+	}
+}
+
+// the texture of the slot that holds buffer
+#define TEXTURE(b) ((GLuint)((char*)(b) - buffers) + 1)
+
+static void test_start(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+	int i;
+
+	setup(&ring, &decoder, false);
+	CHECK(image_ring_start(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+	for (i = 0; i < IMAGE_RING_SIZE; i++)
+		CHECK(ring.slots[i].state == IMAGE_DECODING);
+
+	// nothing decoded yet: the first texture, and nothing to retire
+	CHECK(image_ring_acquire(&ring) == 1);
+	CHECK(ring.shown == -1);
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+
+	// a buffer the decoder doesn't have
+	CHECK(image_ring_filled(&ring, &buffers[0] + IMAGE_RING_SIZE) < 0);
+	image_ring_destroy(&ring);
+
+	setup(&ring, &decoder, false);
+	decoder.refuse = true;
+	CHECK(image_ring_start(&ring) < 0);
+	image_ring_destroy(&ring);
+}
+
+// without keep_all a newer frame sends the one waiting straight back
+static void test_latest(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+
+	setup(&ring, &decoder, false);
+	image_ring_start(&ring);
+	CHECK(image_ring_filled(&ring, decoder.buffers[0]) == 0);
+	CHECK(image_ring_filled(&ring, decoder.buffers[1]) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE + 1);
+	CHECK(decoder.buffers[IMAGE_RING_SIZE] == decoder.buffers[0]);
+	CHECK(ring.ready_count == 1);
+	CHECK(image_ring_acquire(&ring) == TEXTURE(decoder.buffers[1]));
+
+	// a buffer that was sent back can't be filled twice
+	CHECK(image_ring_filled(&ring, decoder.buffers[1]) < 0);
+	image_ring_destroy(&ring);
+}
+
+// with keep_all every frame is shown, in order
+static void test_keep_all(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+	int i;
+
+	setup(&ring, &decoder, true);
+	image_ring_start(&ring);
+	for (i = 0; i < 3; i++)
+		CHECK(image_ring_filled(&ring, decoder.buffers[i]) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+	CHECK(ring.ready_count == 3);
+
+	for (i = 0; i < 3; i++)
+	{
+		CHECK(image_ring_acquire(&ring) == TEXTURE(decoder.buffers[i]));
+		CHECK(image_ring_release(&ring) == 0);
+	}
+	// each frame's image went back once the next one was drawn and finished
+	CHECK(decoder.count == IMAGE_RING_SIZE + 2);
+	CHECK(decoder.buffers[IMAGE_RING_SIZE] == decoder.buffers[0]);
+	CHECK(decoder.buffers[IMAGE_RING_SIZE + 1] == decoder.buffers[1]);
+	image_ring_destroy(&ring);
+}
+
+// a retired image stays out of the decoder's hands while a frame that
+// reads it is still on the GPU
+static void test_retire(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+	void* first;
+
+	setup(&ring, &decoder, false);
+	image_ring_start(&ring);
+	first = decoder.buffers[0];
+	image_ring_filled(&ring, first);
+
+	// frames 1 and 2 both draw from the first image, and are in flight
+	CHECK(image_ring_acquire(&ring) == TEXTURE(first));
+	CHECK(image_ring_acquire(&ring) == TEXTURE(first));
+
+	// frame 3 replaces it
+	image_ring_filled(&ring, decoder.buffers[1]);
+	CHECK(image_ring_acquire(&ring) == TEXTURE(decoder.buffers[1]));
+	CHECK(ring.slots[TEXTURE(first) - 1].state == IMAGE_RETIRED);
+
+	// frame 1 finished, but frame 2 still reads the image
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+	CHECK(ring.slots[TEXTURE(first) - 1].state == IMAGE_RETIRED);
+
+	// frame 2 finished: the image goes back to the decoder
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE + 1);
+	CHECK(decoder.buffers[IMAGE_RING_SIZE] == first);
+	CHECK(ring.slots[TEXTURE(first) - 1].state == IMAGE_DECODING);
+
+	// the image shown now isn't released with frame 3
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE + 1);
+	image_ring_destroy(&ring);
+}
+
+// after stop the decoder gets nothing more, and the images come to rest
+static void test_stop(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+	void* first;
+	int i;
+
+	setup(&ring, &decoder, false);
+	image_ring_start(&ring);
+	first = decoder.buffers[0];
+	image_ring_filled(&ring, first);
+	image_ring_acquire(&ring);
+	image_ring_filled(&ring, decoder.buffers[1]);
+	image_ring_acquire(&ring);
+
+	image_ring_stop(&ring);
+	for (i = 2; i < IMAGE_RING_SIZE; i++)
+		CHECK(image_ring_filled(&ring, decoder.buffers[i]) == 0);
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(image_ring_release(&ring) == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+	CHECK(ring.ready_count == 0);
+	for (i = 0; i < IMAGE_RING_SIZE; i++)
+	{
+		if (&buffers[i] == decoder.buffers[1])
+			CHECK(ring.slots[i].state == IMAGE_SHOWN);
+		else
+			CHECK(ring.slots[i].state == IMAGE_IDLE);
+	}
+
+	// started again, the decoder gets every idle image back
+	CHECK(image_ring_start(&ring) == 0);
+	CHECK(decoder.count == 2 * IMAGE_RING_SIZE - 1);
+	image_ring_destroy(&ring);
+}
+
+// in batch mode frames that queue up while the renderer is busy are each
+// drawn in turn, also when the movie ends before it gets to them
+static void test_drain(void)
+{
+	IMAGE_RING_T ring;
+	DECODER_T decoder;
+	int i;
+
+	setup(&ring, &decoder, true);
+	image_ring_start(&ring);
+	CHECK(image_ring_filled(&ring, decoder.buffers[0]) == 0);
+	CHECK(image_ring_acquire(&ring) == TEXTURE(decoder.buffers[0]));
+	for (i = 1; i < IMAGE_RING_SIZE; i++)
+		CHECK(image_ring_filled(&ring, decoder.buffers[i]) == 0);
+	image_ring_stop(&ring);
+	CHECK(image_ring_release(&ring) == 0);
+
+	// the last frames are still ready after the end, oldest first
+	CHECK(ring.ready_count == IMAGE_RING_SIZE - 1);
+	for (i = 1; i < IMAGE_RING_SIZE; i++)
+	{
+		CHECK(image_ring_acquire(&ring) == TEXTURE(decoder.buffers[i]));
+		CHECK(image_ring_release(&ring) == 0);
+	}
+	CHECK(ring.ready_count == 0);
+	CHECK(decoder.count == IMAGE_RING_SIZE);
+	for (i = 0; i < IMAGE_RING_SIZE - 1; i++)
+		CHECK(ring.slots[TEXTURE(decoder.buffers[i]) - 1].state == IMAGE_IDLE);
+	CHECK(ring.slots[TEXTURE(decoder.buffers[i]) - 1].state == IMAGE_SHOWN);
+	image_ring_destroy(&ring);
+}
+
+int main(void)
+{
+	test_start();
+	test_latest();
+	test_keep_all();
+	test_retire();
+	test_stop();
+	test_drain();
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("image ring: all checks passed\n");
+	return 0;
+}
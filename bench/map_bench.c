@@ -0,0 +1,898 @@
+// Benchmark suite for the whole mapping pipeline on synthetic maps
+//
+// Usage: map_bench [-n iterations] [-o results.json] [-s sizes]
+// Generates identity, affine, radial warp, random scatter and sparse alpha
+// maps at 720p, 1080p and 4K (or the comma separated -s list) and times
+// every stage on its own: PNG map decode, cached map load, texture upload,
+// the GL and CPU remap, and buffer swap. The CPU remap has to match the
+// split map shader pixel for pixel, or the run fails. Upload and GL remap
+// are timed for the split and the packed map format, and for the
+// interpolated mesh with the packed format where the fit fails. A second
+// table compares drawing the map at a reduced render scale and scaling it
+// up with the player's GPU pass against drawing it at full size: the time
+// of both passes and the PSNR of the result, with a smooth test pattern as
+// the source, as noise can't be scaled at all. With the display scaler the
+// upscale pass is free and the quality the scaler's own, which can't be
+// read back. Results are printed as tables and written as JSON for tracking
+// regressions between releases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "png.h"
+
+#include "GLES2/gl2.h"
+#include "EGL/egl.h"
+
+#include "deinterleave.h"
+#include "map.h"
+#include "mesh.h"
+#include "platform.h"
+#include "remap.h"
+#include "shader.h"
+#include "workers.h"
+
+// every map samples a source frame of this size
+#define SRC_WIDTH 1920
+#define SRC_HEIGHT 1080
+
+typedef enum
+{
+	MAP_IDENTITY,
+	MAP_AFFINE,
+	MAP_RADIAL,
+	MAP_SCATTER,
+	MAP_SPARSE,
+	MAP_TYPES
+} MAP_TYPE_T;
+
+static const char* map_names[MAP_TYPES] = { "identity", "affine", "radial", "scatter", "sparse" };
+
+static const struct
+{
+	const char* name;
+	int width, height;
+} sizes[] =
+{
+	{ "720p",  1280,  720 },
+	{ "1080p", 1920, 1080 },
+	{ "4K",    3840, 2160 },
+};
+#define SIZES (sizeof(sizes)/sizeof(sizes[0]))
+
+enum
+{
+	STAGE_DECODE,    // map_load of a PNG without a cache, writes the cache
+	STAGE_LOAD,      // map_load from the cache
+	STAGE_UPLOAD,    // msb and lsb texture upload
+	STAGE_GL_REMAP,  // one full screen draw with the UV mapping shader
+	STAGE_PACKED_UPLOAD,   // map_pack and the packed texture upload
+	STAGE_PACKED_GL_REMAP, // the same draw with the packed map
+	STAGE_MESH,      // fitting the mesh within MESH_ERROR
+	STAGE_MESH_GL_REMAP,   // the same draw with the mesh, packed map elsewhere
+	STAGE_CPU_REMAP, // remap_frame_parallel on every core
+	STAGE_SWAP,      // eglSwapBuffers
+	STAGES
+};
+
+static const char* stage_names[STAGES] =
+	{ "decode_ms", "load_ms", "upload_ms", "gl_remap_ms", "packed_upload_ms",
+	  "packed_gl_remap_ms", "mesh_ms", "mesh_gl_remap_ms", "cpu_remap_ms", "swap_ms" };
+
+// error bound of the mesh in source pixels, the player's default
+#define MESH_ERROR 0.125f
+
+// render scales compared, full size first
+static const float scales[] = { 1.0f, 0.75f, 0.5f };
+#define SCALES (sizeof(scales)/sizeof(scales[0]))
+
+// no difference at all
+#define PSNR_IDENTICAL 99.0
+
+typedef struct
+{
+	double remap_ms;          // the map drawn at the reduced size
+	double upscale_ms;        // the pass scaling it up to full size
+	double psnr;              // of the result against full size, in dB
+} SCALE_RESULT_T;
+
+typedef struct
+{
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+	GLuint program[3];      // by SHADER_MAP_T, 0 if unsupported
+	GLuint mesh_program;
+	GLuint texture[5];      // split planes, source, packed uv and alpha
+	GLuint vertex_buffer;
+	GLuint fbo, fbo_texture;
+	GLuint upscale_program;
+	GLuint scale_fbo, scale_texture;  // the draw at a reduced scale, on unit 5
+	GLuint pattern_texture;   // source for the render scales
+	WORKERS_T* workers;
+	uint32_t* src;
+	char dir[64];
+} BENCH_T;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double median(double* values, int n)
+{
+	qsort(values, n, sizeof(double), compare_double);
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// cheap per pixel hash for the scatter map
+static uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// Source coordinates (0..1, the same orientation as the output) and alpha
+// for output pixel x, y of a map
+static void synth_uv(MAP_TYPE_T type, int x, int y, int width, int height,
+	double* u, double* v, double* a)
+{
+	double nx = 2.0 * (x + 0.5) / width - 1.0;
+	double ny = 2.0 * (y + 0.5) / height - 1.0;
+	double k;
+
+	*a = 1.0;
+	switch (type)
+	{
+	case MAP_IDENTITY:
+		*u = 0.5 + 0.5 * nx;
+		*v = 0.5 + 0.5 * ny;
+		break;
+	case MAP_AFFINE:
+		// rotated by 10 degrees and zoomed in by 10%
+		*u = 0.5 + 0.45 * (nx * cos(0.1745) - ny * sin(0.1745));
+		*v = 0.5 + 0.45 * (nx * sin(0.1745) + ny * cos(0.1745));
+		break;
+	case MAP_RADIAL:
+		k = 1.0 + 0.15 * (nx*nx + ny*ny);
+		*u = 0.5 + 0.5 * nx / k;
+		*v = 0.5 + 0.5 * ny / k;
+		break;
+	case MAP_SCATTER:
+		// every pixel reads an unrelated texel: the worst case for the
+		// source texture cache
+		*u = (hash(y * width + x) & 0xffff) / 65535.0;
+		*v = (hash(y * width + x + 0x9e3779b9) & 0xffff) / 65535.0;
+		break;
+	case MAP_SPARSE:
+		// radial warp inside a ring of discs, transparent everywhere else
+		k = 1.0 + 0.15 * (nx*nx + ny*ny);
+		*u = 0.5 + 0.5 * nx / k;
+		*v = 0.5 + 0.5 * ny / k;
+		double angle = atan2(ny, nx) * 8 / (2 * M_PI);
+		double r = sqrt(nx*nx + ny*ny);
+		*a = fabs(angle - floor(angle + 0.5)) < 0.15 && r > 0.5 && r < 0.8 ? 1.0 : 0.0;
+		break;
+	default:
+		*u = *v = 0;
+		break;
+	}
+
+	if (*u < 0) *u = 0;
+	if (*u > 1) *u = 1;
+	if (*v < 0) *v = 0;
+	if (*v > 1) *v = 1;
+}
+
+// Write a synthetic map as a 16 bit RGBA PNG, the format load_map reads
+static int write_map(const char* filename, MAP_TYPE_T type, int width, int height)
+{
+	FILE* fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	png_byte* row = malloc((size_t)width * 8);
+	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info_ptr = png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL;
+	if (row == NULL || info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+	{
+		printf("error: could not write %s.\n", filename);
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		free(row);
+		fclose(fp);
+		return -1;
+	}
+
+	png_init_io(png_ptr, fp);
+	png_set_compression_level(png_ptr, 1);
+	png_set_IHDR(png_ptr, info_ptr, width, height, 16, PNG_COLOR_TYPE_RGB_ALPHA,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+
+	int x, y, c;
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			double u, v, a;
+			synth_uv(type, x, y, width, height, &u, &v, &a);
+
+			// a texture channel reads back as (msb * 256 + lsb) / 65280
+			int value[4] = { (int)(u * 65280 + 0.5), (int)(v * 65280 + 0.5), 0, (int)(a * 65535) };
+			for (c = 0; c < 4; c++)
+			{
+				row[x * 8 + c * 2] = value[c] >> 8;
+				row[x * 8 + c * 2 + 1] = value[c] & 0xff;
+			}
+		}
+		png_write_row(png_ptr, row);
+	}
+	png_write_end(png_ptr, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	free(row);
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int skip_band(void* arg, const MAP_BAND_T* band)
+{
+	return 0;
+}
+
+static int init_gl(BENCH_T* bench)
+{
+	static const GLfloat vertex_data[] = {
+		-1.0,-1.0, 1.0, 1.0,
+		 1.0,-1.0, 1.0, 1.0,
+		 1.0, 1.0, 1.0, 1.0,
+		-1.0, 1.0, 1.0, 1.0
+	};
+	const EGLint attribute_list[] =
+	{
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_SURFACE_TYPE, platform_surface_type(),
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	static const EGLint context_attributes[] =
+	{
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint num_config;
+	uint32_t width = 0, height = 0;
+	int i;
+
+	platform_init();
+	bench->display = platform_get_display();
+	if (bench->display == EGL_NO_DISPLAY || !eglInitialize(bench->display, NULL, NULL) ||
+		!eglChooseConfig(bench->display, attribute_list, &config, 1, &num_config) || num_config < 1 ||
+		!eglBindAPI(EGL_OPENGL_ES_API))
+	{
+		printf("error: could not set up EGL.\n");
+		return -1;
+	}
+
+	bench->context = eglCreateContext(bench->display, config, EGL_NO_CONTEXT, context_attributes);
+	bench->surface = platform_create_surface(bench->display, config, &width, &height, 1);
+	if (bench->context == EGL_NO_CONTEXT || bench->surface == EGL_NO_SURFACE ||
+		!eglMakeCurrent(bench->display, bench->surface, bench->surface, bench->context))
+	{
+		printf("error: could not create an EGL context and surface.\n");
+		return -1;
+	}
+
+	// the split planes are on units 0 and 1, the packed map on 3 and 4
+	for (i = 0; i < 3; i++)
+	{
+		if (i != SHADER_MAP_SPLIT && !shader_packed_supported())
+			continue;
+		GLuint program = shader_uvmap_program(i, false);
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "mapMsb"), 0);
+		glUniform1i(glGetUniformLocation(program, "mapLsb"), 1);
+		glUniform1i(glGetUniformLocation(program, "source"), 2);
+		glUniform1i(glGetUniformLocation(program, "map"), 3);
+		glUniform1i(glGetUniformLocation(program, "mapAlpha"), 4);
+		bench->program[i] = program;
+	}
+	if (shader_packed_supported())
+	{
+		bench->mesh_program = shader_mesh_program(false);
+		glUseProgram(bench->mesh_program);
+		glUniform1i(glGetUniformLocation(bench->mesh_program, "source"), 2);
+	}
+
+	bench->upscale_program = shader_upscale_program(false);
+	glUseProgram(bench->upscale_program);
+	glUniform1i(glGetUniformLocation(bench->upscale_program, "source"), 5);
+
+	glGenBuffers(1, &bench->vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, bench->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data), vertex_data, GL_STATIC_DRAW);
+
+	glGenTextures(5, bench->texture);
+	glGenTextures(1, &bench->fbo_texture);
+	glGenFramebuffers(1, &bench->fbo);
+	glGenTextures(1, &bench->scale_texture);
+	glGenFramebuffers(1, &bench->scale_fbo);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, bench->texture[2]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SRC_WIDTH, SRC_HEIGHT, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, bench->src);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// gradients, a diagonal wave and a checkerboard of 32 pixel squares
+	uint32_t* pattern = malloc((size_t)SRC_WIDTH * SRC_HEIGHT * 4);
+	if (pattern == NULL)
+	{
+		printf("error: out of memory\n");
+		return -1;
+	}
+	int x, y;
+	for (y = 0; y < SRC_HEIGHT; y++)
+	{
+		for (x = 0; x < SRC_WIDTH; x++)
+		{
+			uint8_t* p = (uint8_t*)&pattern[y * SRC_WIDTH + x];
+			p[0] = x * 255 / SRC_WIDTH;
+			p[1] = (uint8_t)(128 + 127 * sin(0.02 * (x + y)));
+			p[2] = (x / 32 + y / 32) & 1 ? 200 : 55;
+			p[3] = 255;
+		}
+	}
+	glGenTextures(1, &bench->pattern_texture);
+	glBindTexture(GL_TEXTURE_2D, bench->pattern_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SRC_WIDTH, SRC_HEIGHT, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, pattern);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, bench->texture[2]);
+	free(pattern);
+
+	return glGetError() == GL_NO_ERROR ? 0 : -1;
+}
+
+// Pack and upload a map the way the player does; returns the shader format
+static SHADER_MAP_T upload_packed_map(BENCH_T* bench, const MAP_T* map,
+	uint8_t* packed, uint8_t* alpha)
+{
+	bool graded = map_pack(map->msb, map->lsb, (size_t)map->width * map->height, packed, alpha);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, bench->texture[3]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, map->width, map->height, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, packed);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if (graded)
+	{
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, bench->texture[4]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, map->width, map->height, 0,
+			GL_ALPHA, GL_UNSIGNED_BYTE, alpha);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	glFinish();
+
+	return graded ? SHADER_MAP_PACKED : SHADER_MAP_PACKED_BINARY;
+}
+
+// Median time in ms of iterations full screen draws with a program
+static double time_draw(BENCH_T* bench, GLuint program, double* samples, int iterations)
+{
+	GLuint attrib_vertex = glGetAttribLocation(program, "vertex");
+	int i;
+
+	glUseProgram(program);
+	glVertexAttribPointer(attrib_vertex, 4, GL_FLOAT, 0, 16, 0);
+	glEnableVertexAttribArray(attrib_vertex);
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		glFinish();
+		samples[i] = now() - start;
+	}
+	return median(samples, iterations) * 1e3;
+}
+
+// Median time in ms of drawing the mesh, then the per pixel quads with the
+// packed map program, from the bound vertex buffer
+static double time_mesh_draw(BENCH_T* bench, GLuint program, int mesh_count, int pixel_count,
+	double* samples, int iterations)
+{
+	GLuint attrib_mesh = glGetAttribLocation(bench->mesh_program, "vertex");
+	GLuint attrib_vertex = glGetAttribLocation(program, "vertex");
+	int i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		glUseProgram(bench->mesh_program);
+		glVertexAttribPointer(attrib_mesh, 4, GL_FLOAT, 0, 16, 0);
+		glEnableVertexAttribArray(attrib_mesh);
+		glDrawArrays(GL_TRIANGLES, 0, mesh_count);
+		glUseProgram(program);
+		glVertexAttribPointer(attrib_vertex, 4, GL_FLOAT, 0, 16,
+			(void*)(mesh_count * 4 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(attrib_vertex);
+		glDrawArrays(GL_TRIANGLES, 0, pixel_count);
+		glFinish();
+		samples[i] = now() - start;
+	}
+	return median(samples, iterations) * 1e3;
+}
+
+// Fit the mesh to a map and upload it into a new vertex buffer
+static int build_mesh(const MAP_T* map, GLuint buffer, int* mesh_count, int* pixel_count)
+{
+	MAP_BAND_T band = { map->width, map->height, map->stride, 0, map->height, 0, map->msb, map->lsb };
+	MESH_MAP_T mesh;
+	float* vertices;
+
+	if (mesh_init(&mesh, map->width, map->height) < 0)
+		return -1;
+	mesh_add_band(&mesh, &band);
+	int result = mesh_vertices(&mesh, SRC_WIDTH, SRC_HEIGHT, MESH_ERROR,
+		&vertices, mesh_count, pixel_count);
+	mesh_free(&mesh);
+	if (result < 0)
+		return -1;
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, (*mesh_count + *pixel_count) * 4 * sizeof(GLfloat),
+		vertices, GL_STATIC_DRAW);
+	free(vertices);
+	return 0;
+}
+
+// PSNR of the colour of the pixels visible in either of two RGBA frames
+static double psnr(const uint8_t* a, const uint8_t* b, size_t pixels)
+{
+	double sum = 0;
+	size_t i, count = 0;
+	int c;
+
+	for (i = 0; i < pixels; i++, a += 4, b += 4)
+	{
+		if (a[3] == 0 && b[3] == 0)
+			continue;
+		for (c = 0; c < 3; c++)
+			sum += (double)(a[c] - b[c]) * (a[c] - b[c]);
+		count += 3;
+	}
+	if (sum == 0)
+		return PSNR_IDENTICAL;
+	return 10 * log10(255.0 * 255.0 * count / sum);
+}
+
+// Draw the map with program at every render scale into the scale
+// framebuffer, and scale it up into the bound full size one the way the
+// player does; the full size draw is the reference
+static int time_scales(BENCH_T* bench, GLuint program, int width, int height,
+	double* samples, int iterations, SCALE_RESULT_T* results)
+{
+	size_t pixels = (size_t)width * height;
+	uint8_t* reference = malloc(pixels * 4);
+	uint8_t* scaled = malloc(pixels * 4);
+	int i;
+
+	if (reference == NULL || scaled == NULL)
+	{
+		printf("error: out of memory\n");
+		free(reference);
+		free(scaled);
+		return -1;
+	}
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, bench->pattern_texture);
+	for (i = 0; i < SCALES; i++)
+	{
+		int scaled_width = ((int)(width * scales[i] + 0.5f) + 1) & ~1;
+		int scaled_height = ((int)(height * scales[i] + 0.5f) + 1) & ~1;
+
+		if (i == 0)
+		{
+			results[i].remap_ms = time_draw(bench, program, samples, iterations);
+			results[i].upscale_ms = 0;
+			results[i].psnr = PSNR_IDENTICAL;
+			glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, reference);
+			continue;
+		}
+
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, bench->scale_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, scaled_width, scaled_height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindFramebuffer(GL_FRAMEBUFFER, bench->scale_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+			bench->scale_texture, 0);
+		glViewport(0, 0, scaled_width, scaled_height);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("error: scale framebuffer is incomplete.\n");
+			free(reference);
+			free(scaled);
+			return -1;
+		}
+		results[i].remap_ms = time_draw(bench, program, samples, iterations);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, bench->fbo);
+		glViewport(0, 0, width, height);
+		results[i].upscale_ms = time_draw(bench, bench->upscale_program, samples, iterations);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, scaled);
+		results[i].psnr = psnr(reference, scaled, pixels);
+	}
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, bench->texture[2]);
+
+	free(reference);
+	free(scaled);
+	return 0;
+}
+
+static void upload_map(BENCH_T* bench, const MAP_T* map)
+{
+	const uint8_t* planes[2] = { map->msb, map->lsb };
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, bench->texture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, map->width, map->height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, planes[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	glFinish();
+}
+
+// Time every stage for one map; times[stage] gets the median in ms, and
+// scale_results the render scales with the map format the player would use
+static int run_map(BENCH_T* bench, MAP_TYPE_T type, int width, int height,
+	int iterations, double* times, SCALE_RESULT_T* scale_results)
+{
+	char png[128], uvm[136];
+	double* samples = malloc(iterations * sizeof(double));
+	uint32_t* dst = malloc((size_t)width * height * 4);
+	uint32_t* gl_frame = malloc((size_t)width * height * 4);
+	MAP_T map;
+	int i;
+
+	if (samples == NULL || dst == NULL || gl_frame == NULL)
+	{
+		printf("error: out of memory\n");
+		return -1;
+	}
+
+	snprintf(png, sizeof(png), "%s/%s_%dx%d.png", bench->dir, map_names[type], width, height);
+	snprintf(uvm, sizeof(uvm), "%s.uvm", png);
+	if (write_map(png, type, width, height) < 0)
+		return -1;
+
+	for (i = 0; i < iterations; i++)
+	{
+		unlink(uvm);
+		double start = now();
+		if (map_load(png, skip_band, NULL, false) < 0)
+			return -1;
+		samples[i] = now() - start;
+	}
+	times[STAGE_DECODE] = median(samples, iterations) * 1e3;
+
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		if (map_load(png, skip_band, NULL, false) < 0)
+			return -1;
+		samples[i] = now() - start;
+	}
+	times[STAGE_LOAD] = median(samples, iterations) * 1e3;
+
+	if (map_open(png, &map, false) < 0)
+		return -1;
+
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		upload_map(bench, &map);
+		samples[i] = now() - start;
+	}
+	times[STAGE_UPLOAD] = median(samples, iterations) * 1e3;
+
+	// draw into a framebuffer of the map's size, whatever the display is;
+	// bound on a unit none of the programs sample, not over the lsb plane
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, bench->fbo_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindFramebuffer(GL_FRAMEBUFFER, bench->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bench->fbo_texture, 0);
+	glViewport(0, 0, width, height);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("error: benchmark framebuffer is incomplete.\n");
+		return -1;
+	}
+	times[STAGE_GL_REMAP] = time_draw(bench, bench->program[SHADER_MAP_SPLIT], samples, iterations);
+	GLuint program = bench->program[SHADER_MAP_SPLIT];
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, gl_frame);
+
+	times[STAGE_PACKED_UPLOAD] = times[STAGE_PACKED_GL_REMAP] = 0;
+	times[STAGE_MESH] = times[STAGE_MESH_GL_REMAP] = 0;
+	if (bench->program[SHADER_MAP_PACKED] != 0)
+	{
+		uint8_t* packed = malloc((size_t)map.width * map.height * 5);
+		if (packed == NULL)
+		{
+			printf("error: out of memory\n");
+			return -1;
+		}
+
+		SHADER_MAP_T format = SHADER_MAP_PACKED;
+		for (i = 0; i < iterations; i++)
+		{
+			double start = now();
+			format = upload_packed_map(bench, &map, packed, packed + (size_t)map.width * map.height * 4);
+			samples[i] = now() - start;
+		}
+		times[STAGE_PACKED_UPLOAD] = median(samples, iterations) * 1e3;
+		times[STAGE_PACKED_GL_REMAP] = time_draw(bench, bench->program[format], samples, iterations);
+		program = bench->program[format];
+		free(packed);
+
+		GLuint mesh_buffer;
+		int mesh_count = 0, pixel_count = 0;
+		glGenBuffers(1, &mesh_buffer);
+		for (i = 0; i < iterations; i++)
+		{
+			double start = now();
+			if (build_mesh(&map, mesh_buffer, &mesh_count, &pixel_count) < 0)
+			{
+				printf("error: out of memory\n");
+				return -1;
+			}
+			glFinish();
+			samples[i] = now() - start;
+		}
+		times[STAGE_MESH] = median(samples, iterations) * 1e3;
+		times[STAGE_MESH_GL_REMAP] = time_mesh_draw(bench, bench->program[format],
+			mesh_count, pixel_count, samples, iterations);
+		glBindBuffer(GL_ARRAY_BUFFER, bench->vertex_buffer);
+		glDeleteBuffers(1, &mesh_buffer);
+	}
+	if (time_scales(bench, program, width, height, samples, iterations, scale_results) < 0)
+		return -1;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	REMAP_T remap;
+	if (remap_init(&remap, map.msb, map.lsb, map.width, map.height, map.stride,
+			SRC_WIDTH, SRC_HEIGHT, width, height) < 0)
+		return -1;
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		remap_frame_parallel(&remap, bench->workers, bench->src, dst);
+		samples[i] = now() - start;
+	}
+	times[STAGE_CPU_REMAP] = median(samples, iterations) * 1e3;
+
+	// the CPU remap is the reference for the split map shader
+	remap_frame(&remap, bench->src, dst);
+	remap_free(&remap);
+	if (memcmp(gl_frame, dst, (size_t)width * height * 4) != 0)
+	{
+		size_t differ = 0;
+		for (i = 0; i < width * height; i++)
+			differ += gl_frame[i] != dst[i];
+		printf("error: the CPU remap differs from the GL remap in %zu of %d pixels\n",
+			differ, width * height);
+		return -1;
+	}
+
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now();
+		eglSwapBuffers(bench->display, bench->surface);
+		samples[i] = now() - start;
+	}
+	times[STAGE_SWAP] = median(samples, iterations) * 1e3;
+
+	map_close(&map);
+	unlink(uvm);
+	unlink(png);
+	free(samples);
+	free(dst);
+	free(gl_frame);
+
+	return glGetError() == GL_NO_ERROR ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+	const char* json_filename = "bench_results.json";
+	const char* size_list = NULL;
+	int iterations = 10;
+	double times[SIZES][MAP_TYPES][STAGES];
+	SCALE_RESULT_T scale_results[SIZES][MAP_TYPES][SCALES];
+	bool run[SIZES];
+	BENCH_T bench;
+	int s, t, i, r;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			json_filename = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			size_list = argv[++i];
+		else
+		{
+			printf("Usage: %s [-n iterations] [-o results.json] [-s 720p,1080p,4K]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1)
+		iterations = 1;
+	deinterleave_select_kernel(NULL);
+	remap_select_kernel(NULL);
+
+	memset(&bench, 0, sizeof(bench));
+	strcpy(bench.dir, "/tmp/uvmapper-bench-XXXXXX");
+	if (mkdtemp(bench.dir) == NULL)
+	{
+		perror(bench.dir);
+		return 1;
+	}
+
+	// the same noise frame is the source for both remap paths
+	bench.src = malloc((size_t)SRC_WIDTH * SRC_HEIGHT * 4);
+	if (bench.src == NULL)
+	{
+		printf("error: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < SRC_WIDTH * SRC_HEIGHT; i++)
+		bench.src[i] = hash(i);
+
+	bench.workers = workers_create(0);
+	if (bench.workers == NULL || init_gl(&bench) < 0)
+		return 1;
+
+	printf("%-9s %-6s", "map", "size");
+	for (i = 0; i < STAGES; i++)
+		printf(" %18s", stage_names[i]);
+	printf("\n");
+
+	for (s = 0; s < SIZES; s++)
+	{
+		run[s] = size_list == NULL || strstr(size_list, sizes[s].name) != NULL;
+		if (!run[s])
+			continue;
+
+		for (t = 0; t < MAP_TYPES; t++)
+		{
+			if (run_map(&bench, t, sizes[s].width, sizes[s].height, iterations, times[s][t],
+					scale_results[s][t]) < 0)
+			{
+				printf("error: %s %s failed\n", map_names[t], sizes[s].name);
+				return 1;
+			}
+
+			printf("%-9s %-6s", map_names[t], sizes[s].name);
+			for (i = 0; i < STAGES; i++)
+				printf(" %18.3f", times[s][t][i]);
+			printf("\n");
+		}
+	}
+	rmdir(bench.dir);
+
+	printf("\n%-9s %-6s %6s %18s %18s %18s %10s\n", "map", "size", "scale",
+		"remap_ms", "upscale_ms", "total_ms", "psnr_db");
+	for (s = 0; s < SIZES; s++)
+	{
+		for (t = 0; run[s] && t < MAP_TYPES; t++)
+		{
+			for (r = 0; r < SCALES; r++)
+			{
+				SCALE_RESULT_T* result = &scale_results[s][t][r];
+				printf("%-9s %-6s %6.2f %18.3f %18.3f %18.3f %10.1f\n", map_names[t], sizes[s].name,
+					scales[r], result->remap_ms, result->upscale_ms,
+					result->remap_ms + result->upscale_ms, result->psnr);
+			}
+		}
+	}
+
+	FILE* json = fopen(json_filename, "w");
+	if (json == NULL)
+	{
+		perror(json_filename);
+		return 1;
+	}
+	fprintf(json, "{\n");
+	fprintf(json, "  \"iterations\": %d,\n", iterations);
+	fprintf(json, "  \"source\": [%d, %d],\n", SRC_WIDTH, SRC_HEIGHT);
+	fprintf(json, "  \"gl_renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+	fprintf(json, "  \"cpu_kernel\": \"%s\",\n", remap_kernel_name());
+	fprintf(json, "  \"cpu_workers\": %d,\n", workers_count(bench.workers));
+	fprintf(json, "  \"results\": [");
+	bool first = true;
+	for (s = 0; s < SIZES; s++)
+	{
+		for (t = 0; run[s] && t < MAP_TYPES; t++)
+		{
+			fprintf(json, "%s\n    { \"map\": \"%s\", \"size\": \"%s\", \"width\": %d, \"height\": %d",
+				first ? "" : ",", map_names[t], sizes[s].name, sizes[s].width, sizes[s].height);
+			for (i = 0; i < STAGES; i++)
+				fprintf(json, ", \"%s\": %.3f", stage_names[i], times[s][t][i]);
+			fprintf(json, " }");
+			first = false;
+		}
+	}
+	fprintf(json, "\n  ],\n");
+	fprintf(json, "  \"render_scale\": [");
+	first = true;
+	for (s = 0; s < SIZES; s++)
+	{
+		for (t = 0; run[s] && t < MAP_TYPES; t++)
+		{
+			for (r = 0; r < SCALES; r++)
+			{
+				SCALE_RESULT_T* result = &scale_results[s][t][r];
+				fprintf(json, "%s\n    { \"map\": \"%s\", \"size\": \"%s\", \"scale\": %.2f, "
+					"\"remap_ms\": %.3f, \"upscale_ms\": %.3f, \"psnr_db\": %.1f }",
+					first ? "" : ",", map_names[t], sizes[s].name, scales[r],
+					result->remap_ms, result->upscale_ms, result->psnr);
+				first = false;
+			}
+		}
+	}
+	fprintf(json, "\n  ]\n}\n");
+	if (fclose(json) != 0)
+	{
+		perror(json_filename);
+		return 1;
+	}
+	printf("Results written to %s\n", json_filename);
+
+	workers_destroy(bench.workers);
+	return 0;
+}
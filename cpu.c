@@ -0,0 +1,44 @@
+// Runtime CPU feature detection for the SIMD kernels
+
+#include "cpu.h"
+
+#if defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static int features = -1;
+
+static int detect_features(void)
+{
+	int result = 0;
+
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		result |= CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		result |= CPU_SSSE3;
+	if (__builtin_cpu_supports("sse4.1"))
+		result |= CPU_SSE41;
+	if (__builtin_cpu_supports("avx2"))
+		result |= CPU_AVX2;
+#elif defined(__aarch64__)
+	// NEON is mandatory on ARMv8
+	result |= CPU_NEON;
+#elif defined(__arm__) && defined(__ARM_NEON) && defined(__linux__)
+	// the kernels are only built when the compiler targets NEON, but the
+	// Pi 1 (ARMv6) has none so check the kernel's hwcaps as well
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+		result |= CPU_NEON;
+#endif
+
+	return result;
+}
+
+int cpu_features(void)
+{
+	if (features < 0)
+		features = detect_features();
+	return features;
+}
@@ -0,0 +1,15 @@
+// Runtime CPU feature detection for the SIMD kernels
+
+#ifndef CPU_H
+#define CPU_H
+
+#define CPU_SSE2   (1 << 0)
+#define CPU_SSSE3  (1 << 1)
+#define CPU_SSE41  (1 << 2)
+#define CPU_AVX2   (1 << 3)
+#define CPU_NEON   (1 << 4)
+
+// Returns a mask of CPU_* flags supported by both the compiler and the CPU
+int cpu_features(void);
+
+#endif
@@ -0,0 +1,136 @@
+// Byte deinterleave kernels for splitting 16 bit map samples
+
+#include <string.h>
+
+#include "deinterleave.h"
+#include "cpu.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define DEINTERLEAVE_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define DEINTERLEAVE_NEON
+#endif
+
+typedef void (*DEINTERLEAVE_FN)(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n);
+
+static void deinterleave_scalar(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		even[i] = src[2*i];
+		odd[i] = src[2*i+1];
+	}
+}
+
+#ifdef DEINTERLEAVE_X86
+__attribute__((target("sse2")))
+static void deinterleave_sse2(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n)
+{
+	const __m128i low = _mm_set1_epi16(0x00ff);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + 2*i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + 2*i + 16));
+
+		// the even byte is the low half of every 16 bit lane
+		__m128i e = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+		__m128i o = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+
+		_mm_storeu_si128((__m128i*)(even + i), e);
+		_mm_storeu_si128((__m128i*)(odd + i), o);
+	}
+	deinterleave_scalar(src + 2*i, even + i, odd + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void deinterleave_ssse3(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n)
+{
+	// gather the even bytes in the low 8 bytes and the odd bytes in the high 8
+	const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+		1, 3, 5, 7, 9, 11, 13, 15);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*i)), split);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*i + 16)), split);
+
+		_mm_storeu_si128((__m128i*)(even + i), _mm_unpacklo_epi64(a, b));
+		_mm_storeu_si128((__m128i*)(odd + i), _mm_unpackhi_epi64(a, b));
+	}
+	deinterleave_scalar(src + 2*i, even + i, odd + i, n - i);
+}
+#endif
+
+#ifdef DEINTERLEAVE_NEON
+static void deinterleave_neon(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		uint8x16x2_t pairs = vld2q_u8(src + 2*i);
+		vst1q_u8(even + i, pairs.val[0]);
+		vst1q_u8(odd + i, pairs.val[1]);
+	}
+	deinterleave_scalar(src + 2*i, even + i, odd + i, n - i);
+}
+#endif
+
+typedef struct
+{
+	const char* name;
+	int features;
+	DEINTERLEAVE_FN fn;
+} DEINTERLEAVE_KERNEL_T;
+
+// in order of preference
+static const DEINTERLEAVE_KERNEL_T kernels[] =
+{
+#ifdef DEINTERLEAVE_X86
+	{ "ssse3",  CPU_SSSE3, deinterleave_ssse3 },
+	{ "sse2",   CPU_SSE2,  deinterleave_sse2 },
+#endif
+#ifdef DEINTERLEAVE_NEON
+	{ "neon",   CPU_NEON,  deinterleave_neon },
+#endif
+	{ "scalar", 0,         deinterleave_scalar },
+};
+
+#define KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+// scalar until one is selected
+static const DEINTERLEAVE_KERNEL_T* kernel = &kernels[KERNELS - 1];
+
+int deinterleave_select_kernel(const char* name)
+{
+	int i;
+	for (i = 0; i < KERNELS; i++)
+	{
+		if ((cpu_features() & kernels[i].features) != kernels[i].features)
+			continue;
+		if (name == NULL || strcmp(name, kernels[i].name) == 0)
+		{
+			kernel = &kernels[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char* deinterleave_kernel_name(void)
+{
+	return kernel->name;
+}
+
+void deinterleave(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n)
+{
+	kernel->fn(src, even, odd, n);
+}
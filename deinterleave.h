@@ -0,0 +1,20 @@
+// Byte deinterleave kernels for splitting 16 bit map samples
+
+#ifndef DEINTERLEAVE_H
+#define DEINTERLEAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Split n byte pairs: even[i] = src[2*i], odd[i] = src[2*i+1]. For the big
+// endian 16 bit samples of a PNG these are the msb and lsb planes.
+void deinterleave(const uint8_t* src, uint8_t* even, uint8_t* odd, size_t n);
+
+// Kernel selection: NULL picks the fastest kernel the CPU supports. Until a
+// kernel is selected the scalar one is used. Select before any thread
+// deinterleaves, since the choice isn't synchronised. Valid names are
+// "scalar", "sse2", "ssse3" and "neon".
+int deinterleave_select_kernel(const char* name);
+const char* deinterleave_kernel_name(void);
+
+#endif
@@ -0,0 +1,914 @@
+// H.264 video from MP4 (ISO BMFF, QuickTime) and Matroska (MKV, WebM)
+// files, for the OpenMAX decoder: the file is mapped into memory, indexed
+// once, and read back as Annex-B access units with their presentation times
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "demux.h"
+
+// Matroska element IDs, with their length markers
+#define MKV_EBML            0x1A45DFA3
+#define MKV_SEGMENT         0x18538067
+#define MKV_INFO            0x1549A966
+#define MKV_TIMECODE_SCALE  0x2AD7B1
+#define MKV_TRACKS          0x1654AE6B
+#define MKV_TRACK_ENTRY     0xAE
+#define MKV_TRACK_NUMBER    0xD7
+#define MKV_TRACK_TYPE      0x83
+#define MKV_CODEC_ID        0x86
+#define MKV_CODEC_PRIVATE   0x63A2
+#define MKV_DEFAULT_DURATION 0x23E383
+#define MKV_CLUSTER         0x1F43B675
+#define MKV_TIMECODE        0xE7
+#define MKV_SIMPLE_BLOCK    0xA3
+#define MKV_BLOCK_GROUP     0xA0
+#define MKV_BLOCK           0xA1
+#define MKV_REFERENCE_BLOCK 0xFB
+
+#define MKV_TRACK_VIDEO     1
+#define MKV_CODEC_AVC       "V_MPEG4/ISO/AVC"
+
+// most of the first GOP kept in memory for looping
+#define DEMUX_GOP_MAX (4 << 20)
+
+// bytes of a QuickTime visual sample entry before its child boxes
+#define MP4_VISUAL_ENTRY_SIZE 78
+
+struct DEMUX_T
+{
+	const uint8_t* data;      // the mapped file
+	size_t size;
+
+	int length_size;          // bytes of the NAL unit length prefixes
+	uint8_t* config;          // SPS and PPS as Annex-B
+	size_t config_size;
+
+	DEMUX_SAMPLE_T* samples;  // in decode order, from the first keyframe
+	int sample_count, sample_alloc;
+	int64_t duration, frame_duration;
+	double fps;               // as the container gives it, 0 if it doesn't
+
+	// a copy of the first GOP, gop_count samples at gop_offset[] in gop
+	uint8_t* gop;
+	size_t* gop_offset;
+	int gop_count;
+
+	// read position: sample next, at byte in, in the middle of a NAL unit
+	// with nal_left bytes and code_left bytes of its start code to go
+	int next;
+	size_t in;
+	size_t nal_left;
+	int code_left;
+
+	size_t readahead, advised;
+
+	// demux_probe: only the decoder configuration is read
+	bool probe;
+};
+
+static uint16_t be16(const uint8_t* p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static uint32_t be32(const uint8_t* p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t be64(const uint8_t* p)
+{
+	return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static bool add_sample(DEMUX_T* demux, size_t offset, uint32_t size, int64_t pts, bool keyframe)
+{
+	if (demux->sample_count == demux->sample_alloc)
+	{
+		int alloc = demux->sample_alloc ? demux->sample_alloc * 2 : 1024;
+		DEMUX_SAMPLE_T* samples = realloc(demux->samples, alloc * sizeof(DEMUX_SAMPLE_T));
+		if (samples == NULL)
+			return false;
+		demux->samples = samples;
+		demux->sample_alloc = alloc;
+	}
+
+	DEMUX_SAMPLE_T* sample = &demux->samples[demux->sample_count++];
+	sample->offset = offset;
+	sample->size = size;
+	sample->pts = pts;
+	sample->keyframe = keyframe;
+	return true;
+}
+
+// Turn an AVCDecoderConfigurationRecord into Annex-B SPS and PPS
+static int parse_avcc(DEMUX_T* demux, const uint8_t* avcc, size_t size)
+{
+	size_t pos = 5;
+	int list;
+
+	if (size < 7 || avcc[0] != 1)
+		return -1;
+	demux->length_size = (avcc[4] & 3) + 1;
+	if (demux->length_size == 3)
+		return -1;
+
+	// the SPS list and then the PPS list, each with a count and 16 bit sizes
+	demux->config = malloc(size * 2);
+	if (demux->config == NULL)
+		return -1;
+	for (list = 0; list < 2; list++)
+	{
+		if (pos >= size)
+			return -1;
+		int count = list == 0 ? avcc[pos] & 0x1f : avcc[pos];
+		pos++;
+		while (count-- > 0)
+		{
+			if (pos + 2 > size || pos + 2 + be16(avcc + pos) > size)
+				return -1;
+			size_t length = be16(avcc + pos);
+			memcpy(demux->config + demux->config_size, "\0\0\0\1", 4);
+			memcpy(demux->config + demux->config_size + 4, avcc + pos + 2, length);
+			demux->config_size += 4 + length;
+			pos += 2 + length;
+		}
+	}
+	return demux->config_size > 0 ? 0 : -1;
+}
+
+static void pts_range(const DEMUX_T* demux, int64_t* first_pts, int64_t* last_pts)
+{
+	int i;
+
+	*first_pts = INT64_MAX;
+	*last_pts = INT64_MIN;
+	for (i = 0; i < demux->sample_count; i++)
+	{
+		if (demux->samples[i].pts < *first_pts)
+			*first_pts = demux->samples[i].pts;
+		if (demux->samples[i].pts > *last_pts)
+			*last_pts = demux->samples[i].pts;
+	}
+}
+
+// Start at the keyframe at or before start microseconds (the first one by
+// default) with timestamp 0, and keep the GOP it starts in memory, so
+// looping back to it needs no I/O. The movie lasts until the first keyframe
+// at or after end, or until one frame after its last frame.
+static int finish_index(DEMUX_T* demux, int64_t start, int64_t end)
+{
+	int64_t first_pts, last_pts, end_pts = INT64_MIN;
+	size_t gop_size = 0;
+	int first, last, i;
+
+	for (first = 0; first < demux->sample_count && !demux->samples[first].keyframe; first++)
+		;
+	if (first == demux->sample_count)
+	{
+		printf("error: the movie has no keyframe.\n");
+		return -1;
+	}
+
+	// the range is in the time of the movie as it would play from its start
+	pts_range(demux, &first_pts, &last_pts);
+	for (i = first + 1; start > 0 && i < demux->sample_count; i++)
+	{
+		if (demux->samples[i].keyframe && demux->samples[i].pts - first_pts <= start)
+			first = i;
+	}
+	for (last = first + 1; end > 0 && last < demux->sample_count; last++)
+	{
+		if (demux->samples[last].keyframe && demux->samples[last].pts - first_pts >= end)
+		{
+			end_pts = demux->samples[last].pts;
+			demux->sample_count = last;
+			break;
+		}
+	}
+
+	demux->sample_count -= first;
+	memmove(demux->samples, demux->samples + first, demux->sample_count * sizeof(DEMUX_SAMPLE_T));
+
+	pts_range(demux, &first_pts, &last_pts);
+	for (i = 0; i < demux->sample_count; i++)
+		demux->samples[i].pts -= first_pts;
+
+	// without a frame duration in the file, the last frame lasts as long as
+	// the average one
+	demux->duration = last_pts - first_pts;
+	if (end_pts > first_pts)
+		demux->duration = end_pts - first_pts;
+	else if (demux->frame_duration > 0)
+		demux->duration += demux->frame_duration;
+	else if (demux->sample_count > 1)
+		demux->duration += demux->duration / (demux->sample_count - 1);
+
+	for (i = 0; i < demux->sample_count && (i == 0 || !demux->samples[i].keyframe); i++)
+	{
+		if (gop_size + demux->samples[i].size > DEMUX_GOP_MAX)
+			break;
+		gop_size += demux->samples[i].size;
+	}
+	demux->gop_count = i;
+	demux->gop = malloc(gop_size > 0 ? gop_size : 1);
+	demux->gop_offset = malloc((demux->gop_count + 1) * sizeof(size_t));
+	if (demux->gop == NULL || demux->gop_offset == NULL)
+		return -1;
+	for (i = 0, gop_size = 0; i < demux->gop_count; i++)
+	{
+		memcpy(demux->gop + gop_size, demux->data + demux->samples[i].offset, demux->samples[i].size);
+		demux->gop_offset[i] = gop_size;
+		gop_size += demux->samples[i].size;
+	}
+	return 0;
+}
+
+// ---- MP4 ----
+
+// The payload of the next box in data[0..size) from *pos, which moves on
+// past it; NULL after the last one or at a broken box
+static const uint8_t* next_box(const uint8_t* data, size_t size, size_t* pos,
+	const uint8_t** type, size_t* payload_size)
+{
+	size_t i = *pos;
+
+	if (i + 8 > size)
+		return NULL;
+	uint64_t box_size = be32(data + i);
+	size_t header = 8;
+	if (box_size == 1)
+	{
+		if (i + 16 > size)
+			return NULL;
+		box_size = be64(data + i + 8);
+		header = 16;
+	}
+	else if (box_size == 0)
+		box_size = size - i;
+	if (box_size < header || box_size > size - i)
+		return NULL;
+
+	*type = data + i + 4;
+	*payload_size = box_size - header;
+	*pos = i + box_size;
+	return data + i + header;
+}
+
+static const uint8_t* find_box(const uint8_t* data, size_t size, const char* type, size_t* payload_size)
+{
+	const uint8_t* box;
+	const uint8_t* box_type;
+	size_t pos = 0;
+
+	if (data == NULL)
+		return NULL;
+	while ((box = next_box(data, size, &pos, &box_type, payload_size)) != NULL)
+	{
+		if (memcmp(box_type, type, 4) == 0)
+			return box;
+	}
+	return NULL;
+}
+
+// A full box (version and flags) with a 32 bit entry count, and room for
+// count entries of entry_size bytes after header bytes; NULL otherwise
+static const uint8_t* table_box(const uint8_t* stbl, size_t stbl_size, const char* type,
+	size_t header, size_t entry_size, uint32_t* count)
+{
+	size_t size;
+	const uint8_t* box = find_box(stbl, stbl_size, type, &size);
+
+	*count = 0;
+	if (box == NULL || size < header)
+		return NULL;
+	*count = be32(box + header - 4);
+	if (entry_size > 0 && *count > (size - header) / entry_size)
+	{
+		*count = 0;
+		return NULL;
+	}
+	return box;
+}
+
+// Index the samples of an H.264 track's sample table
+static int mp4_samples(DEMUX_T* demux, const uint8_t* stbl, size_t stbl_size, uint32_t timescale)
+{
+	uint32_t sizes, chunks, stsc_count, stts_count, ctts_count = 0, stss_count = 0;
+	bool co64 = false;
+	int i;
+
+	const uint8_t* stsz = table_box(stbl, stbl_size, "stsz", 12, 0, &sizes);
+	const uint8_t* stco = table_box(stbl, stbl_size, "stco", 8, 4, &chunks);
+	if (stco == NULL)
+	{
+		stco = table_box(stbl, stbl_size, "co64", 8, 8, &chunks);
+		co64 = true;
+	}
+	const uint8_t* stsc = table_box(stbl, stbl_size, "stsc", 8, 12, &stsc_count);
+	const uint8_t* stts = table_box(stbl, stbl_size, "stts", 8, 8, &stts_count);
+	const uint8_t* ctts = table_box(stbl, stbl_size, "ctts", 8, 8, &ctts_count);
+	const uint8_t* stss = table_box(stbl, stbl_size, "stss", 8, 4, &stss_count);
+	if (stsz == NULL || stco == NULL || stsc == NULL || stts == NULL || stsc_count == 0)
+		return -1;
+
+	uint32_t fixed_size = be32(stsz + 4);
+	if (fixed_size == 0 && table_box(stbl, stbl_size, "stsz", 12, 4, &sizes) == NULL)
+		return -1;
+
+	// where every sample is: chunks of samples_per_chunk consecutive samples
+	uint32_t sample = 0, entry = 0;
+	for (i = 0; i < chunks && sample < sizes; i++)
+	{
+		while (entry + 1 < stsc_count && be32(stsc + 8 + (entry + 1) * 12) <= i + 1)
+			entry++;
+		uint32_t per_chunk = be32(stsc + 8 + entry * 12 + 4);
+		uint64_t offset = co64 ? be64(stco + 8 + i * 8) : be32(stco + 8 + i * 4);
+
+		for (; per_chunk > 0 && sample < sizes; per_chunk--, sample++)
+		{
+			uint32_t size = fixed_size ? fixed_size : be32(stsz + 12 + sample * 4);
+			// a file cut short keeps the frames it still has
+			if (offset > demux->size || size > demux->size - offset)
+				break;
+			if (!add_sample(demux, offset, size, 0, stss == NULL))
+				return -1;
+			offset += size;
+		}
+		if (per_chunk > 0 && sample < sizes)
+			break;
+	}
+
+	// decode times from the durations, presentation times from the offsets
+	uint64_t dts = 0, delta = 0;
+	uint32_t stts_entry = 0, stts_left = stts_count ? be32(stts + 8) : 0;
+	uint32_t ctts_entry = 0, ctts_left = ctts_count ? be32(ctts + 8) : 0;
+	for (i = 0; i < demux->sample_count; i++)
+	{
+		int64_t offset = 0;
+
+		while (ctts_left == 0 && ++ctts_entry < ctts_count)
+			ctts_left = be32(ctts + 8 + ctts_entry * 8);
+		if (ctts_left > 0)
+		{
+			offset = (int32_t)be32(ctts + 8 + ctts_entry * 8 + 4);
+			ctts_left--;
+		}
+		demux->samples[i].pts = ((int64_t)dts + offset) * 1000000 / timescale;
+
+		while (stts_left == 0 && ++stts_entry < stts_count)
+			stts_left = be32(stts + 8 + stts_entry * 8);
+		if (stts_left > 0)
+		{
+			delta = be32(stts + 8 + stts_entry * 8 + 4);
+			dts += delta;
+			stts_left--;
+		}
+	}
+	demux->frame_duration = delta * 1000000 / timescale;
+
+	// sync samples are numbered from 1
+	for (i = 0; stss != NULL && i < stss_count; i++)
+	{
+		uint32_t number = be32(stss + 8 + i * 4);
+		if (number >= 1 && number <= demux->sample_count)
+			demux->samples[number - 1].keyframe = true;
+	}
+
+	return 0;
+}
+
+static int mp4_open(DEMUX_T* demux)
+{
+	const uint8_t* trak;
+	const uint8_t* type;
+	size_t moov_size, trak_size, size, pos = 0;
+	const uint8_t* moov = find_box(demux->data, demux->size, "moov", &moov_size);
+
+	if (moov == NULL)
+	{
+		printf("error: the movie has no moov box.\n");
+		return -1;
+	}
+
+	while ((trak = next_box(moov, moov_size, &pos, &type, &trak_size)) != NULL)
+	{
+		size_t mdia_size, minf_size, stbl_size, stsd_size, entry_size, avcc_size, entry_pos = 8;
+		const uint8_t* entry_type;
+
+		if (memcmp(type, "trak", 4) != 0)
+			continue;
+		const uint8_t* mdia = find_box(trak, trak_size, "mdia", &mdia_size);
+		const uint8_t* hdlr = find_box(mdia, mdia_size, "hdlr", &size);
+		if (hdlr == NULL || size < 12 || memcmp(hdlr + 8, "vide", 4) != 0)
+			continue;
+
+		const uint8_t* mdhd = find_box(mdia, mdia_size, "mdhd", &size);
+		if (mdhd == NULL || size < (mdhd[0] == 1 ? 24 : 16))
+			continue;
+		uint32_t timescale = be32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+
+		const uint8_t* minf = find_box(mdia, mdia_size, "minf", &minf_size);
+		const uint8_t* stbl = find_box(minf, minf_size, "stbl", &stbl_size);
+		const uint8_t* stsd = find_box(stbl, stbl_size, "stsd", &stsd_size);
+		if (stsd == NULL || timescale == 0)
+			continue;
+
+		const uint8_t* entry = next_box(stsd, stsd_size, &entry_pos, &entry_type, &entry_size);
+		if (entry == NULL ||
+			(memcmp(entry_type, "avc1", 4) != 0 && memcmp(entry_type, "avc3", 4) != 0))
+		{
+			printf("error: the video in the movie isn't H.264.\n");
+			return -1;
+		}
+		const uint8_t* avcc = entry_size < MP4_VISUAL_ENTRY_SIZE ? NULL :
+			find_box(entry + MP4_VISUAL_ENTRY_SIZE, entry_size - MP4_VISUAL_ENTRY_SIZE, "avcC", &avcc_size);
+		if (avcc == NULL || parse_avcc(demux, avcc, avcc_size) < 0)
+		{
+			printf("error: the H.264 decoder configuration in the movie is missing or broken.\n");
+			return -1;
+		}
+
+		// the first sample duration is the nominal frame rate
+		uint32_t stts_count;
+		const uint8_t* stts = table_box(stbl, stbl_size, "stts", 8, 8, &stts_count);
+		if (stts != NULL && stts_count > 0 && be32(stts + 12) > 0)
+			demux->fps = (double)timescale / be32(stts + 12);
+		if (demux->probe)
+			return 0;
+
+		if (mp4_samples(demux, stbl, stbl_size, timescale) < 0 || demux->sample_count == 0)
+		{
+			printf("error: the movie has no frames, or its sample table is broken (fragmented MP4 isn't supported).\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	printf("error: the movie has no video track.\n");
+	return -1;
+}
+
+// ---- Matroska ----
+
+// EBML variable length integer; IDs keep their length marker
+static bool read_vint(const uint8_t* data, size_t size, size_t* pos, bool marker, uint64_t* value,
+	bool* unknown)
+{
+	int length = 1, i;
+
+	if (*pos >= size || data[*pos] == 0)
+		return false;
+	while (!(data[*pos] & (0x80 >> (length - 1))))
+		length++;
+	if (*pos + length > size)
+		return false;
+
+	uint64_t v = marker ? data[*pos] : data[*pos] & (0xff >> length);
+	bool ones = v == (0xffu >> length);
+	for (i = 1; i < length; i++)
+	{
+		ones = ones && data[*pos + i] == 0xff;
+		v = v << 8 | data[*pos + i];
+	}
+	if (unknown != NULL)
+		*unknown = ones;
+
+	*pos += length;
+	*value = v;
+	return true;
+}
+
+// The next element in data[0..size) from *pos, which moves on past it. An
+// element of unknown size (streamed files) reaches to the end of size.
+static const uint8_t* next_element(const uint8_t* data, size_t size, size_t* pos, uint32_t* id,
+	size_t* payload_size, bool* unknown)
+{
+	uint64_t value, length;
+
+	if (!read_vint(data, size, pos, true, &value, NULL) || value > 0xffffffff ||
+		!read_vint(data, size, pos, false, &length, unknown))
+		return NULL;
+	if (*unknown)
+		length = size - *pos;
+	if (length > size - *pos)
+		return NULL;
+
+	*id = value;
+	*payload_size = length;
+	*pos += length;
+	return data + *pos - length;
+}
+
+static uint64_t ebml_uint(const uint8_t* data, size_t size)
+{
+	uint64_t value = 0;
+	while (size-- > 0)
+		value = value << 8 | *data++;
+	return value;
+}
+
+typedef struct
+{
+	uint64_t track;           // the H.264 track, 0 until it was found
+	uint64_t timecode_scale;  // nanoseconds per timecode
+	uint64_t default_duration;
+} MKV_STATE_T;
+
+static int mkv_track(DEMUX_T* demux, MKV_STATE_T* mkv, const uint8_t* data, size_t size)
+{
+	const uint8_t* element;
+	const uint8_t* codec = NULL;
+	const uint8_t* private_data = NULL;
+	size_t length, codec_size = 0, private_size = 0, pos = 0;
+	uint64_t number = 0, type = 0, default_duration = 0;
+	uint32_t id;
+	bool unknown;
+
+	while ((element = next_element(data, size, &pos, &id, &length, &unknown)) != NULL)
+	{
+		if (id == MKV_TRACK_NUMBER)
+			number = ebml_uint(element, length);
+		else if (id == MKV_TRACK_TYPE)
+			type = ebml_uint(element, length);
+		else if (id == MKV_DEFAULT_DURATION)
+			default_duration = ebml_uint(element, length);
+		else if (id == MKV_CODEC_ID)
+		{
+			codec = element;
+			codec_size = length;
+		}
+		else if (id == MKV_CODEC_PRIVATE)
+		{
+			private_data = element;
+			private_size = length;
+		}
+	}
+
+	if (type != MKV_TRACK_VIDEO || mkv->track != 0)
+		return 0;
+	if (codec == NULL || codec_size < strlen(MKV_CODEC_AVC) ||
+		memcmp(codec, MKV_CODEC_AVC, strlen(MKV_CODEC_AVC)) != 0 ||
+		(codec_size > strlen(MKV_CODEC_AVC) && codec[strlen(MKV_CODEC_AVC)] != 0))
+	{
+		printf("error: the video in the movie isn't H.264.\n");
+		return -1;
+	}
+	if (private_data == NULL || parse_avcc(demux, private_data, private_size) < 0)
+	{
+		printf("error: the H.264 decoder configuration in the movie is missing or broken.\n");
+		return -1;
+	}
+
+	mkv->track = number;
+	mkv->default_duration = default_duration;
+	return 0;
+}
+
+// A Block or SimpleBlock at data[0..size), where data is offset bytes into the file
+static int mkv_block(DEMUX_T* demux, MKV_STATE_T* mkv, const uint8_t* data, size_t size,
+	uint64_t cluster_timecode, bool simple, bool referenced)
+{
+	uint64_t track;
+	size_t pos = 0;
+
+	if (!read_vint(data, size, &pos, false, &track, NULL) || pos + 3 > size || track != mkv->track)
+		return 0;
+
+	int16_t timecode = be16(data + pos);
+	uint8_t flags = data[pos + 2];
+	pos += 3;
+
+	// laced blocks hold several frames; video is never laced in practice
+	if (flags & 0x06)
+		return 0;
+
+	int64_t pts = ((int64_t)cluster_timecode + timecode) * (int64_t)mkv->timecode_scale / 1000;
+	bool keyframe = simple ? (flags & 0x80) != 0 : !referenced;
+	return add_sample(demux, data + pos - demux->data, size - pos, pts, keyframe) ? 0 : -1;
+}
+
+// The blocks of a cluster; *end is where it ends, which for a cluster of
+// unknown size is where the next one starts
+static int mkv_cluster(DEMUX_T* demux, MKV_STATE_T* mkv, const uint8_t* data, size_t size, size_t* end)
+{
+	const uint8_t* element;
+	uint64_t timecode = 0;
+	size_t length, pos = 0, start = 0;
+	uint32_t id;
+	bool unknown;
+
+	while ((element = next_element(data, size, &pos, &id, &length, &unknown)) != NULL)
+	{
+		if (id == MKV_CLUSTER)
+		{
+			*end = start;
+			return 0;
+		}
+		if (id == MKV_TIMECODE)
+			timecode = ebml_uint(element, length);
+		else if (id == MKV_SIMPLE_BLOCK)
+		{
+			if (mkv_block(demux, mkv, element, length, timecode, true, false) < 0)
+				return -1;
+		}
+		else if (id == MKV_BLOCK_GROUP)
+		{
+			const uint8_t* child;
+			const uint8_t* block = NULL;
+			size_t child_length, block_length = 0, child_pos = 0;
+			uint32_t child_id;
+			bool referenced = false, child_unknown;
+
+			while ((child = next_element(element, length, &child_pos, &child_id, &child_length, &child_unknown)) != NULL)
+			{
+				if (child_id == MKV_BLOCK)
+				{
+					block = child;
+					block_length = child_length;
+				}
+				else if (child_id == MKV_REFERENCE_BLOCK)
+					referenced = true;
+			}
+			if (block != NULL && mkv_block(demux, mkv, block, block_length, timecode, false, referenced) < 0)
+				return -1;
+		}
+		start = pos;
+	}
+	*end = size;
+	return 0;
+}
+
+static int mkv_open(DEMUX_T* demux)
+{
+	MKV_STATE_T mkv = { 0, 1000000, 0 };
+	const uint8_t* element;
+	const uint8_t* segment = NULL;
+	size_t length, segment_size = 0, pos = 0;
+	uint32_t id;
+	bool unknown;
+
+	while ((element = next_element(demux->data, demux->size, &pos, &id, &length, &unknown)) != NULL)
+	{
+		if (id == MKV_SEGMENT)
+		{
+			segment = element;
+			segment_size = length;
+			break;
+		}
+	}
+	if (segment == NULL)
+	{
+		printf("error: the movie has no Matroska segment.\n");
+		return -1;
+	}
+
+	pos = 0;
+	while ((element = next_element(segment, segment_size, &pos, &id, &length, &unknown)) != NULL)
+	{
+		if (id == MKV_INFO)
+		{
+			const uint8_t* child;
+			size_t child_length, child_pos = 0;
+			uint32_t child_id;
+			bool child_unknown;
+
+			while ((child = next_element(element, length, &child_pos, &child_id, &child_length, &child_unknown)) != NULL)
+			{
+				if (child_id == MKV_TIMECODE_SCALE && ebml_uint(child, child_length) > 0)
+					mkv.timecode_scale = ebml_uint(child, child_length);
+			}
+		}
+		else if (id == MKV_TRACKS)
+		{
+			const uint8_t* child;
+			size_t child_length, child_pos = 0;
+			uint32_t child_id;
+			bool child_unknown;
+
+			while ((child = next_element(element, length, &child_pos, &child_id, &child_length, &child_unknown)) != NULL)
+			{
+				if (child_id == MKV_TRACK_ENTRY && mkv_track(demux, &mkv, child, child_length) < 0)
+					return -1;
+			}
+		}
+		else if (id == MKV_CLUSTER && demux->probe)
+			break;
+		else if (id == MKV_CLUSTER)
+		{
+			size_t end;
+			if (mkv_cluster(demux, &mkv, element, length, &end) < 0)
+				return -1;
+			if (unknown)
+				pos = element - segment + end;
+		}
+		else if (unknown)
+			break;
+	}
+
+	if (mkv.track == 0)
+	{
+		printf("error: the movie has no video track.\n");
+		return -1;
+	}
+	if (demux->sample_count == 0 && !demux->probe)
+	{
+		printf("error: the movie has no frames.\n");
+		return -1;
+	}
+	demux->frame_duration = mkv.default_duration / 1000;
+	if (mkv.default_duration > 0)
+		demux->fps = 1e9 / mkv.default_duration;
+	return 0;
+}
+
+// Map a container file and read its decoder configuration, and unless
+// probe is set its index
+static int map_container(const char* filename, size_t readahead, int64_t start, int64_t end,
+	bool probe, DEMUX_T** result)
+{
+	struct stat st;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+	*result = NULL;
+	if (fd < 0)
+		return -1;
+
+	// only look at the file signature first: raw H.264 isn't mapped
+	uint8_t head[8];
+	bool mp4 = false, mkv = false;
+	if (fstat(fd, &st) == 0 && pread(fd, head, sizeof(head), 0) == sizeof(head))
+	{
+		mp4 = memcmp(head + 4, "ftyp", 4) == 0 || memcmp(head + 4, "moov", 4) == 0 ||
+			memcmp(head + 4, "mdat", 4) == 0 || memcmp(head + 4, "wide", 4) == 0 ||
+			memcmp(head + 4, "free", 4) == 0 || memcmp(head + 4, "skip", 4) == 0;
+		mkv = be32(head) == MKV_EBML;
+	}
+	if (!mp4 && !mkv)
+	{
+		close(fd);
+		return 0;
+	}
+
+	DEMUX_T* demux = calloc(1, sizeof(DEMUX_T));
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (demux == NULL || data == MAP_FAILED)
+	{
+		printf("error: could not map %s into memory.\n", filename);
+		if (data != MAP_FAILED)
+			munmap(data, st.st_size);
+		free(demux);
+		return -1;
+	}
+	demux->data = data;
+	demux->size = st.st_size;
+	demux->readahead = readahead;
+	demux->probe = probe;
+	if (!probe)
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	if ((mp4 ? mp4_open(demux) : mkv_open(demux)) < 0 ||
+		(!probe && finish_index(demux, start, end) < 0))
+	{
+		printf("error: could not read %s.\n", filename);
+		demux_close(demux);
+		return -1;
+	}
+
+	*result = demux;
+	return 0;
+}
+
+int demux_open(const char* filename, size_t readahead, int64_t start, int64_t end,
+	DEMUX_T** demux)
+{
+	return map_container(filename, readahead, start, end, false, demux);
+}
+
+int demux_probe(const char* filename, DEMUX_T** demux)
+{
+	return map_container(filename, 0, 0, 0, true, demux);
+}
+
+void demux_close(DEMUX_T* demux)
+{
+	if (demux == NULL)
+		return;
+
+	munmap((void*)demux->data, demux->size);
+	free(demux->config);
+	free(demux->samples);
+	free(demux->gop);
+	free(demux->gop_offset);
+	free(demux);
+}
+
+const uint8_t* demux_config(const DEMUX_T* demux, size_t* size)
+{
+	*size = demux->config_size;
+	return demux->config;
+}
+
+int64_t demux_duration(const DEMUX_T* demux)
+{
+	return demux->duration;
+}
+
+int demux_frames(const DEMUX_T* demux)
+{
+	return demux->sample_count;
+}
+
+double demux_frame_rate(const DEMUX_T* demux)
+{
+	return demux->fps;
+}
+
+// Ask the kernel to read the file ahead of a sample, a window at a time
+static void read_ahead(DEMUX_T* demux, const DEMUX_SAMPLE_T* sample)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (demux->readahead == 0 || sample->offset + sample->size + demux->readahead / 2 < demux->advised)
+		return;
+
+	size_t start = sample->offset & ~(page - 1);
+	size_t length = demux->readahead;
+	if (length > demux->size - start)
+		length = demux->size - start;
+	madvise((void*)(demux->data + start), length, MADV_WILLNEED);
+	demux->advised = start + length;
+}
+
+size_t demux_read(DEMUX_T* demux, uint8_t* dest, size_t size,
+	const DEMUX_SAMPLE_T** sample, bool* end)
+{
+	while (demux->next < demux->sample_count)
+	{
+		const DEMUX_SAMPLE_T* current = &demux->samples[demux->next];
+		const uint8_t* data = demux->next < demux->gop_count ?
+			demux->gop + demux->gop_offset[demux->next] : demux->data + current->offset;
+		size_t n = 0;
+
+		// the first GOP comes from memory: read on past it meanwhile
+		if (demux->in == 0)
+			read_ahead(demux, demux->next < demux->gop_count && demux->gop_count < demux->sample_count ?
+				&demux->samples[demux->gop_count] : current);
+
+		// the length prefix of every NAL unit becomes a 4 byte start code
+		while (n < size)
+		{
+			if (demux->nal_left == 0 && demux->code_left == 0)
+			{
+				int i;
+
+				if (demux->in + demux->length_size > current->size)
+					break;
+				for (i = 0; i < demux->length_size; i++)
+					demux->nal_left = demux->nal_left << 8 | data[demux->in++];
+				if (demux->nal_left > current->size - demux->in)
+					demux->nal_left = current->size - demux->in;
+				demux->code_left = 4;
+			}
+
+			while (demux->code_left > 0 && n < size)
+				dest[n++] = --demux->code_left == 0 ? 1 : 0;
+
+			size_t copy = demux->nal_left < size - n ? demux->nal_left : size - n;
+			memcpy(dest + n, data + demux->in, copy);
+			n += copy;
+			demux->in += copy;
+			demux->nal_left -= copy;
+		}
+
+		*sample = current;
+		*end = demux->nal_left == 0 && demux->code_left == 0 &&
+			demux->in + demux->length_size > current->size;
+		if (*end)
+		{
+			demux->next++;
+			demux->in = 0;
+		}
+		// an empty frame is skipped
+		if (n > 0 || !*end)
+			return n;
+	}
+
+	return 0;
+}
+
+void demux_rewind(DEMUX_T* demux)
+{
+	demux->next = 0;
+	demux->in = 0;
+	demux->nal_left = 0;
+	demux->code_left = 0;
+	demux->advised = 0;
+}
@@ -0,0 +1,64 @@
+// H.264 video from MP4 (ISO BMFF, QuickTime) and Matroska (MKV, WebM)
+// files, for the OpenMAX decoder: the file is mapped into memory, indexed
+// once, and read back as Annex-B access units with their presentation times
+
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+	size_t offset;            // in the file
+	uint32_t size;
+	int64_t pts;              // microseconds from the first frame shown
+	bool keyframe;
+} DEMUX_SAMPLE_T;
+
+typedef struct DEMUX_T DEMUX_T;
+
+// Open a container file and read ahead up to readahead bytes of it. The
+// movie starts at the last keyframe at or before start microseconds into
+// it, and ends before the first keyframe at or after end (0 for the whole
+// movie). The GOP it starts with is kept in memory, so looping back to it
+// needs no I/O.
+// *demux is left NULL for a file that is neither MP4 nor Matroska (a raw
+// H.264 stream). Returns -1 if the file can't be opened, or is a container
+// without H.264 video.
+int demux_open(const char* filename, size_t readahead, int64_t start, int64_t end,
+	DEMUX_T** demux);
+void demux_close(DEMUX_T* demux);
+
+// Open a container only as far as its decoder configuration, for
+// demux_config and demux_frame_rate: the samples aren't indexed, and an MP4 file's moov box and
+// a Matroska file's header are all that is read of it. The result can't be
+// read from.
+int demux_probe(const char* filename, DEMUX_T** demux);
+
+// SPS and PPS as Annex-B, to be sent before the first frame
+const uint8_t* demux_config(const DEMUX_T* demux, size_t* size);
+
+// Length of the movie in microseconds, including the last frame, which is
+// what the timestamps move on by when it loops
+int64_t demux_duration(const DEMUX_T* demux);
+
+// Frames in one pass through the movie
+int demux_frames(const DEMUX_T* demux);
+
+// Frames per second as the container gives it (the first sample duration
+// of an MP4, the default duration of a Matroska track), 0 if it doesn't
+double demux_frame_rate(const DEMUX_T* demux);
+
+// Copy as much of the next access unit as fits into dest, as Annex-B.
+// *sample is the frame the bytes belong to, and *end is set once its last
+// byte was copied; the next call continues with the rest or the next frame.
+// Returns 0 at the end of the movie.
+size_t demux_read(DEMUX_T* demux, uint8_t* dest, size_t size,
+	const DEMUX_SAMPLE_T** sample, bool* end);
+
+// Start reading from the first frame again
+void demux_rewind(DEMUX_T* demux);
+
+#endif
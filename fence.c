@@ -0,0 +1,71 @@
+// Fences in the GPU command stream (EGL_KHR_fence_sync), to learn when the
+// GPU has finished a frame without draining it with glFinish
+
+#include <stdio.h>
+#include <string.h>
+
+#include "GLES2/gl2.h"
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+
+#include "fence.h"
+
+// extension functions aren't exported by every libEGL, so they are looked up
+static PFNEGLCREATESYNCKHRPROC create_sync;
+static PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+static PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+static bool has_extension(const char* extensions, const char* name)
+{
+	size_t length = strlen(name);
+	const char* found;
+
+	for (found = extensions; (found = strstr(found, name)) != NULL; found += length)
+	{
+		if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+			return true;
+	}
+	return false;
+}
+
+bool fence_init(EGLDisplay display)
+{
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+	if (extensions == NULL || !has_extension(extensions, "EGL_KHR_fence_sync"))
+		return false;
+
+	create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+	destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+	client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+	return create_sync != NULL && destroy_sync != NULL && client_wait_sync != NULL;
+}
+
+FENCE_T fence_insert(EGLDisplay display)
+{
+	EGLSyncKHR sync = create_sync(display, EGL_SYNC_FENCE_KHR, NULL);
+	return sync != EGL_NO_SYNC_KHR ? sync : NULL;
+}
+
+bool fence_signalled(EGLDisplay display, FENCE_T fence)
+{
+	// a zero timeout polls; the flush gets the commands to the GPU
+	return client_wait_sync(display, fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0) ==
+		EGL_CONDITION_SATISFIED_KHR;
+}
+
+int fence_wait(EGLDisplay display, FENCE_T fence)
+{
+	// flush, in case nothing has sent the commands before the fence yet
+	EGLint result = client_wait_sync(display, fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+		EGL_FOREVER_KHR);
+	destroy_sync(display, fence);
+
+	if (result != EGL_CONDITION_SATISFIED_KHR)
+	{
+		printf("warning: waiting for a fence failed (0x%x)\n", eglGetError());
+		glFinish();
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,27 @@
+// Fences in the GPU command stream (EGL_KHR_fence_sync), to learn when the
+// GPU has finished a frame without draining it with glFinish
+
+#ifndef FENCE_H
+#define FENCE_H
+
+#include <stdbool.h>
+
+#include "EGL/egl.h"
+
+typedef void* FENCE_T;
+
+// Whether the display supports fences; call before the others
+bool fence_init(EGLDisplay display);
+
+// Insert a fence after the GL commands issued so far, NULL on failure
+FENCE_T fence_insert(EGLDisplay display);
+
+// Whether the GPU has passed fence already, without waiting; the fence is
+// kept, and false is also returned if the query failed
+bool fence_signalled(EGLDisplay display, FENCE_T fence);
+
+// Wait until the GPU has passed fence, and delete it. Returns -1 if the
+// wait failed, after which the GPU is drained with glFinish instead.
+int fence_wait(EGLDisplay display, FENCE_T fence);
+
+#endif
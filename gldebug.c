@@ -0,0 +1,116 @@
+// GL error checks and call tracing, built in with GL_DEBUG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "GLES2/gl2.h"
+
+#include "gldebug.h"
+
+#ifdef GL_DEBUG
+
+// checks are on by default in a debug build, as the asserts were before
+GLDEBUG_MODE_T gldebug_mode = GLDEBUG_CHECK;
+
+// call sites in the order they were first called; GL is only called from
+// the render thread, so this needs no lock
+static GLDEBUG_SITE_T* sites;
+
+uint64_t gldebug_begin(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void gldebug_end(GLDEBUG_SITE_T* site, uint64_t start)
+{
+	site->ns += gldebug_begin() - start;
+	if (site->count++ == 0)
+	{
+		site->next = sites;
+		sites = site;
+	}
+}
+
+void gldebug_check(const char* call, const char* file, int line)
+{
+	GLenum error = glGetError();
+
+	if (error != GL_NO_ERROR)
+	{
+		printf("error: GL error 0x%04x at %s:%d%s%s\n", error, file, line,
+			call != NULL ? " in " : "", call != NULL ? call : "");
+		abort();
+	}
+}
+
+#endif
+
+int gldebug_set_mode(const char* mode)
+{
+	GLDEBUG_MODE_T value;
+
+	if (strcmp(mode, "off") == 0)
+		value = GLDEBUG_OFF;
+	else if (strcmp(mode, "check") == 0)
+		value = GLDEBUG_CHECK;
+	else if (strcmp(mode, "trace") == 0)
+		value = GLDEBUG_TRACE;
+	else
+		return -1;
+
+#ifdef GL_DEBUG
+	gldebug_mode = value;
+	return 0;
+#else
+	return value == GLDEBUG_OFF ? 0 : -1;
+#endif
+}
+
+#ifdef GL_DEBUG
+static int compare_sites(const void* a, const void* b)
+{
+	const GLDEBUG_SITE_T* x = *(const GLDEBUG_SITE_T* const*)a;
+	const GLDEBUG_SITE_T* y = *(const GLDEBUG_SITE_T* const*)b;
+	return x->ns < y->ns ? 1 : x->ns > y->ns ? -1 : 0;
+}
+#endif
+
+void gldebug_print(void)
+{
+#ifdef GL_DEBUG
+	GLDEBUG_SITE_T* site;
+	GLDEBUG_SITE_T** sorted;
+	int count = 0, i;
+	uint64_t total = 0;
+
+	for (site = sites; site != NULL; site = site->next)
+		count++;
+	if (count == 0)
+		return;
+	sorted = malloc(count * sizeof(GLDEBUG_SITE_T*));
+	if (sorted == NULL)
+		return;
+	for (site = sites, i = 0; site != NULL; site = site->next)
+	{
+		sorted[i++] = site;
+		total += site->ns;
+	}
+	qsort(sorted, count, sizeof(GLDEBUG_SITE_T*), compare_sites);
+
+	printf("GL calls: %.3f ms of CPU time\n", total * 1e-6);
+	printf("     calls   total ms    mean us  call\n");
+	for (i = 0; i < count; i++)
+	{
+		const char* file = strrchr(sorted[i]->file, '/');
+		site = sorted[i];
+		printf("  %8llu %10.3f %10.3f  %.60s (%s:%d)\n", (unsigned long long)site->count,
+			site->ns * 1e-6, site->ns * 1e-3 / site->count, site->call,
+			file != NULL ? file + 1 : site->file, site->line);
+	}
+	free(sorted);
+#endif
+}
@@ -0,0 +1,67 @@
+// GL error checks and call tracing, built in with GL_DEBUG (make
+// GL_DEBUG=1) and chosen at run time with --gl-debug. Without GL_DEBUG
+// checkgl() and GL() cost nothing.
+
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+#include <stdint.h>
+
+typedef enum
+{
+	GLDEBUG_OFF,
+	GLDEBUG_CHECK,            // glGetError after every checked call
+	GLDEBUG_TRACE,            // and the count and CPU time of every GL() call
+} GLDEBUG_MODE_T;
+
+// A call site of GL(), linked into the trace when it is first called
+typedef struct GLDEBUG_SITE_T
+{
+	const char* call;
+	const char* file;
+	int line;
+	uint64_t count;
+	uint64_t ns;
+	struct GLDEBUG_SITE_T* next;
+} GLDEBUG_SITE_T;
+
+#ifdef GL_DEBUG
+
+extern GLDEBUG_MODE_T gldebug_mode;
+
+uint64_t gldebug_begin(void);
+void gldebug_end(GLDEBUG_SITE_T* site, uint64_t start);
+void gldebug_check(const char* call, const char* file, int line);
+
+// Check for a GL error since the last check; abort on one
+#define checkgl() \
+	do { if (gldebug_mode != GLDEBUG_OFF) gldebug_check(NULL, __FILE__, __LINE__); } while (0)
+
+// Make a GL call; with tracing on, count and time it
+#define GL(...) \
+	do \
+	{ \
+		static GLDEBUG_SITE_T gl_site_ = { #__VA_ARGS__, __FILE__, __LINE__, 0, 0, NULL }; \
+		uint64_t gl_start_ = gldebug_mode == GLDEBUG_TRACE ? gldebug_begin() : 0; \
+		__VA_ARGS__; \
+		if (gldebug_mode == GLDEBUG_TRACE) \
+			gldebug_end(&gl_site_, gl_start_); \
+		if (gldebug_mode != GLDEBUG_OFF) \
+			gldebug_check(gl_site_.call, __FILE__, __LINE__); \
+	} while (0)
+
+#else
+
+#define checkgl() ((void)0)
+#define GL(...) do { __VA_ARGS__; } while (0)
+
+#endif
+
+// Parse a --gl-debug mode: off, check or trace. Returns -1 for anything
+// else, or for a mode other than off in a build without GL_DEBUG.
+int gldebug_set_mode(const char* mode);
+
+// Print the calls traced so far, the most expensive first
+void gldebug_print(void);
+
+#endif
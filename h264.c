@@ -0,0 +1,442 @@
+// Minimal H.264 sequence parameter set parser, to learn the frame size of
+// a movie without starting a decoder
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "h264.h"
+
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SPS 7
+#define NAL_PPS 8
+
+// an SPS with every optional part is still well below this
+#define SPS_MAX_SIZE H264_NAL_MAX
+
+// a slice header is read up to field_pic_flag, which is within these bytes
+// even with emulation prevention
+#define SLICE_HEADER_SIZE 16
+
+// Exp-Golomb bit reader over an RBSP; reads past the end return zeros and
+// set overrun
+typedef struct
+{
+	const uint8_t* data;
+	size_t size;
+	size_t bit;
+	bool overrun;
+} BITS_T;
+
+static uint32_t read_bits(BITS_T* bits, int n)
+{
+	uint32_t value = 0;
+
+	while (n-- > 0)
+	{
+		size_t byte = bits->bit >> 3;
+		int bit = 0;
+		if (byte < bits->size)
+			bit = (bits->data[byte] >> (7 - (bits->bit & 7))) & 1;
+		else
+			bits->overrun = true;
+		bits->bit++;
+		value = value << 1 | bit;
+	}
+	return value;
+}
+
+static uint32_t read_ue(BITS_T* bits)
+{
+	int zeros = 0;
+
+	while (read_bits(bits, 1) == 0)
+	{
+		// 32 leading zeros don't fit, and mean the data is garbage
+		if (++zeros == 32 || bits->overrun)
+		{
+			bits->overrun = true;
+			return 0;
+		}
+	}
+	return ((1u << zeros) - 1) + read_bits(bits, zeros);
+}
+
+static int32_t read_se(BITS_T* bits)
+{
+	uint32_t value = read_ue(bits);
+	return value & 1 ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+}
+
+static void skip_scaling_list(BITS_T* bits, int size)
+{
+	int last = 8, next = 8, i;
+
+	for (i = 0; i < size; i++)
+	{
+		if (next != 0)
+			next = (last + read_se(bits) + 256) % 256;
+		last = next == 0 ? last : next;
+	}
+}
+
+// Find the next start code at or after data[i]; returns the offset of the
+// first byte after it, or size if there is none
+static size_t next_nal(const uint8_t* data, size_t size, size_t i)
+{
+	for (; i + 3 <= size; i++)
+	{
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+			return i + 3;
+	}
+	return size;
+}
+
+// Copy a NAL unit without its emulation prevention bytes (00 00 03)
+static size_t unescape(const uint8_t* nal, size_t size, uint8_t* rbsp, size_t max)
+{
+	size_t n = 0, i, zeros = 0;
+
+	for (i = 0; i < size && n < max; i++)
+	{
+		if (zeros >= 2 && nal[i] == 3)
+		{
+			zeros = 0;
+			continue;
+		}
+		zeros = nal[i] == 0 ? zeros + 1 : 0;
+		rbsp[n++] = nal[i];
+	}
+	return n;
+}
+
+static int parse_sps_rbsp(BITS_T* bits, H264_INFO_T* info)
+{
+	int chroma_format_idc = 1, separate_colour_plane = 0;
+	int i;
+
+	info->profile_idc = read_bits(bits, 8);
+	read_bits(bits, 8);                 // constraint flags
+	info->level_idc = read_bits(bits, 8);
+	read_ue(bits);                      // seq_parameter_set_id
+
+	switch (info->profile_idc)
+	{
+	case 100: case 110: case 122: case 244: case 44: case 83:
+	case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+		chroma_format_idc = read_ue(bits);
+		if (chroma_format_idc == 3)
+			separate_colour_plane = read_bits(bits, 1);
+		read_ue(bits);                  // bit_depth_luma_minus8
+		read_ue(bits);                  // bit_depth_chroma_minus8
+		read_bits(bits, 1);             // qpprime_y_zero_transform_bypass_flag
+		if (read_bits(bits, 1))         // seq_scaling_matrix_present_flag
+		{
+			for (i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++)
+			{
+				if (read_bits(bits, 1))
+					skip_scaling_list(bits, i < 6 ? 16 : 64);
+			}
+		}
+		break;
+	}
+
+	info->separate_colour_plane = separate_colour_plane;
+	info->frame_num_bits = read_ue(bits) + 4;   // log2_max_frame_num_minus4
+	uint32_t pic_order_cnt_type = read_ue(bits);
+	if (pic_order_cnt_type == 0)
+		read_ue(bits);                  // log2_max_pic_order_cnt_lsb_minus4
+	else if (pic_order_cnt_type == 1)
+	{
+		read_bits(bits, 1);             // delta_pic_order_always_zero_flag
+		read_se(bits);                  // offset_for_non_ref_pic
+		read_se(bits);                  // offset_for_top_to_bottom_field
+		uint32_t cycle = read_ue(bits);
+		if (cycle > 255)
+			return -1;
+		for (i = 0; i < cycle; i++)
+			read_se(bits);
+	}
+
+	read_ue(bits);                      // max_num_ref_frames
+	read_bits(bits, 1);                 // gaps_in_frame_num_value_allowed_flag
+	uint32_t width_in_mbs = read_ue(bits) + 1;
+	uint32_t height_in_map_units = read_ue(bits) + 1;
+	int frame_mbs_only = read_bits(bits, 1);
+	info->frame_mbs_only = frame_mbs_only;
+	if (!frame_mbs_only)
+		read_bits(bits, 1);             // mb_adaptive_frame_field_flag
+	read_bits(bits, 1);                 // direct_8x8_inference_flag
+
+	uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+	if (read_bits(bits, 1))             // frame_cropping_flag
+	{
+		crop_left = read_ue(bits);
+		crop_right = read_ue(bits);
+		crop_top = read_ue(bits);
+		crop_bottom = read_ue(bits);
+	}
+
+	// crop offsets are in chroma samples, and in field pairs for interlaced
+	int chroma_array_type = separate_colour_plane ? 0 : chroma_format_idc;
+	int crop_unit_x = chroma_array_type == 1 || chroma_array_type == 2 ? 2 : 1;
+	int crop_unit_y = (chroma_array_type == 1 ? 2 : 1) * (2 - frame_mbs_only);
+
+	int width = (int)(width_in_mbs * 16 - crop_unit_x * (crop_left + crop_right));
+	int height = (int)((2 - frame_mbs_only) * height_in_map_units * 16 -
+		crop_unit_y * (crop_top + crop_bottom));
+	if (bits->overrun || width_in_mbs > 1024 || height_in_map_units > 1024 ||
+		width <= 0 || height <= 0 || info->frame_num_bits > 16)
+		return -1;
+	info->width = width;
+	info->height = height;
+
+	info->fps = 0;
+	if (read_bits(bits, 1))             // vui_parameters_present_flag
+	{
+		if (read_bits(bits, 1))         // aspect_ratio_info_present_flag
+		{
+			if (read_bits(bits, 8) == 255)  // aspect_ratio_idc, Extended_SAR
+				read_bits(bits, 32);    // sar_width, sar_height
+		}
+		if (read_bits(bits, 1))         // overscan_info_present_flag
+			read_bits(bits, 1);
+		if (read_bits(bits, 1))         // video_signal_type_present_flag
+		{
+			read_bits(bits, 4);         // video_format, video_full_range_flag
+			if (read_bits(bits, 1))     // colour_description_present_flag
+				read_bits(bits, 24);
+		}
+		if (read_bits(bits, 1))         // chroma_loc_info_present_flag
+		{
+			read_ue(bits);
+			read_ue(bits);
+		}
+		if (read_bits(bits, 1))         // timing_info_present_flag
+		{
+			uint32_t num_units_in_tick = read_bits(bits, 32);
+			uint32_t time_scale = read_bits(bits, 32);
+			// a frame is two ticks, one per field
+			if (!bits->overrun && num_units_in_tick > 0)
+				info->fps = time_scale / (2.0 * num_units_in_tick);
+		}
+	}
+
+	return 0;
+}
+
+int h264_parse_sps(const uint8_t* data, size_t size, H264_INFO_T* info)
+{
+	uint8_t rbsp[SPS_MAX_SIZE];
+	size_t start;
+
+	for (start = next_nal(data, size, 0); start < size; start = next_nal(data, size, start))
+	{
+		if ((data[start] & 0x1f) != NAL_SPS)
+			continue;
+
+		// the SPS has to be followed by another NAL unit, or it may be cut off
+		size_t end = next_nal(data, size, start);
+		if (end == size)
+			return -1;
+
+		BITS_T bits = { rbsp, 0, 8, false };   // after the NAL header
+		bits.size = unescape(data + start, end - 3 - start, rbsp, sizeof(rbsp));
+		return parse_sps_rbsp(&bits, info);
+	}
+
+	return -1;
+}
+
+int h264_probe_file(const char* filename, H264_INFO_T* info)
+{
+	uint8_t* data = malloc(H264_PROBE_SIZE);
+	FILE* in = fopen(filename, "rb");
+	int result = -1;
+
+	if (data != NULL && in != NULL)
+	{
+		size_t size = fread(data, 1, H264_PROBE_SIZE, in);
+		result = h264_parse_sps(data, size, info);
+	}
+
+	if (in != NULL)
+		fclose(in);
+	free(data);
+	return result;
+}
+
+int h264_find_gop(const uint8_t* data, size_t size, size_t* start, size_t* end)
+{
+	size_t pos, run = size;
+	bool found = false, sps_in_run = false, sps_before = false;
+
+	for (pos = next_nal(data, size, 0); pos < size; pos = next_nal(data, size, pos))
+	{
+		size_t code = pos >= 4 && data[pos - 4] == 0 ? pos - 4 : pos - 3;
+		int type = data[pos] & 0x1f;
+
+		// an access unit begins with the NAL units before its first slice
+		if (type < NAL_SLICE || type > NAL_IDR)
+		{
+			if (run == size)
+				run = code;
+			if (type == NAL_SPS)
+				sps_in_run = true;
+			continue;
+		}
+
+		size_t access_unit = run != size ? run : code;
+		bool first_slice = pos + 1 < size && (data[pos + 1] & 0x80);
+		bool sps = sps_in_run;
+		run = size;
+		sps_in_run = false;
+		if (type != NAL_IDR || !first_slice)
+		{
+			sps_before = sps_before || sps;
+			continue;
+		}
+
+		if (found)
+		{
+			*end = access_unit;
+			return 0;
+		}
+		// without parameter sets of its own it needs the ones before it
+		*start = sps || !sps_before ? access_unit : 0;
+		found = true;
+	}
+
+	*end = size;
+	return found ? 0 : -1;
+}
+
+size_t h264_parameter_sets(const uint8_t* data, size_t size, uint8_t* out, size_t max)
+{
+	size_t pos = next_nal(data, size, 0), n = 0;
+
+	while (pos < size)
+	{
+		int type = data[pos] & 0x1f;
+		size_t next = next_nal(data, size, pos);
+
+		if (type >= NAL_SLICE && type <= NAL_IDR)
+			break;
+		if (type == NAL_SPS || type == NAL_PPS)
+		{
+			// up to the next start code, without the zeros before it
+			size_t end = next == size ? size : next - 3;
+			while (end > pos && data[end - 1] == 0)
+				end--;
+			if (n + 4 + end - pos > max)
+				break;
+			memcpy(out + n, "\0\0\0\1", 4);
+			memcpy(out + n + 4, data + pos, end - pos);
+			n += 4 + end - pos;
+		}
+		pos = next;
+	}
+	return n;
+}
+
+// A frame starts with the slice in counter->nal if that starts a picture
+// which isn't the second field of a pair
+static void count_slice(H264_COUNTER_T* counter)
+{
+	uint8_t rbsp[SLICE_HEADER_SIZE];
+	BITS_T bits = { rbsp, 0, 8, false };   // after the NAL header
+	bool field = false;
+	uint32_t frame_num = 0;
+
+	bits.size = unescape(counter->nal, counter->nal_size, rbsp, sizeof(rbsp));
+	if (read_ue(&bits) != 0 || bits.overrun)   // first_mb_in_slice
+		return;
+
+	if (counter->have_sps && !counter->sps.frame_mbs_only)
+	{
+		read_ue(&bits);                 // slice_type
+		read_ue(&bits);                 // pic_parameter_set_id
+		if (counter->sps.separate_colour_plane)
+			read_bits(&bits, 2);        // colour_plane_id
+		frame_num = read_bits(&bits, counter->sps.frame_num_bits);
+		field = read_bits(&bits, 1) && !bits.overrun;   // field_pic_flag
+	}
+
+	if (field && counter->pending_field && frame_num == counter->frame_num)
+	{
+		counter->pending_field = false;
+		return;
+	}
+	counter->pending_field = field;
+	counter->frame_num = frame_num;
+	counter->idr = counter->type == NAL_IDR;
+	counter->pictures++;
+}
+
+// Bytes of a slice, with its NAL header, that tell whether it starts a
+// frame: first_mb_in_slice is in the first one after the header, unless
+// field_pic_flag is needed as well
+static size_t slice_bytes(const H264_COUNTER_T* counter)
+{
+	return counter->have_sps && !counter->sps.frame_mbs_only ? SLICE_HEADER_SIZE : 2;
+}
+
+// The SPS or slice in counter->nal is complete, or as much of it as needed
+static void count_nal(H264_COUNTER_T* counter)
+{
+	if (counter->type == NAL_SPS)
+	{
+		uint8_t rbsp[SPS_MAX_SIZE];
+		BITS_T bits = { rbsp, 0, 8, false };   // after the NAL header
+		H264_INFO_T info;
+
+		bits.size = unescape(counter->nal, counter->nal_size, rbsp, sizeof(rbsp));
+		if (parse_sps_rbsp(&bits, &info) == 0)
+		{
+			counter->sps = info;
+			counter->have_sps = true;
+		}
+	}
+	else
+		count_slice(counter);
+	counter->type = 0;
+}
+
+void h264_count_pictures(H264_COUNTER_T* counter, const uint8_t* data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+	{
+		uint8_t byte = data[i];
+
+		if (counter->header)
+		{
+			int type = byte & 0x1f;
+			if (type == NAL_SLICE || type == NAL_IDR || type == NAL_SPS)
+			{
+				counter->type = type;
+				counter->nal_size = 0;
+			}
+			counter->header = false;
+		}
+		if (counter->type != 0)
+		{
+			if (counter->nal_size < sizeof(counter->nal))
+				counter->nal[counter->nal_size++] = byte;
+			if (counter->type != NAL_SPS && counter->nal_size == slice_bytes(counter))
+				count_nal(counter);
+		}
+
+		counter->window = counter->window << 8 | byte;
+		if ((counter->window & 0xffffff) == 1)
+		{
+			// the end of a NAL unit shorter than what is collected of it
+			if (counter->type != 0)
+				count_nal(counter);
+			counter->header = true;
+		}
+	}
+}
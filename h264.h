@@ -0,0 +1,68 @@
+// Minimal H.264 sequence parameter set parser, to learn the frame size of
+// a movie without starting a decoder
+
+#ifndef H264_H
+#define H264_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+	int width, height;        // after cropping
+	int profile_idc, level_idc;
+	double fps;               // from the VUI timing info, 0 if absent
+
+	// what it takes to read a slice header up to field_pic_flag
+	bool frame_mbs_only;      // no field pictures
+	bool separate_colour_plane;
+	int frame_num_bits;
+} H264_INFO_T;
+
+// Parse the first SPS in an Annex-B byte stream. Returns 0 on success, -1
+// if there is no complete SPS in the data or it can't be parsed.
+int h264_parse_sps(const uint8_t* data, size_t size, H264_INFO_T* info);
+
+// Parse the SPS at the start of an Annex-B file, reading only the first
+// H264_PROBE_SIZE bytes
+#define H264_PROBE_SIZE (64 << 10)
+int h264_probe_file(const char* filename, H264_INFO_T* info);
+
+// Find the first GOP of an Annex-B stream: *start is where the access unit
+// of the first IDR picture begins, with the parameter sets before it, and
+// *end where the access unit of the next IDR picture begins, or size if
+// that isn't in data. Returns -1 if there is no IDR picture.
+int h264_find_gop(const uint8_t* data, size_t size, size_t* start, size_t* end);
+
+// Copy the SPS and PPS NAL units before the first slice of an Annex-B
+// stream into out, each with a 4 byte start code; returns the bytes copied
+size_t h264_parameter_sets(const uint8_t* data, size_t size, uint8_t* out, size_t max);
+
+// Counts the frames of an Annex-B stream fed in pieces of any size: every
+// slice that starts at macroblock 0 starts a picture, and in an interlaced
+// stream the two fields of a frame, which share a frame_num, count once.
+// The SPS in the stream tells whether the slice headers have to be read
+// that far. Start from a zeroed counter.
+#define H264_NAL_MAX 512
+
+typedef struct
+{
+	uint32_t window;          // the last bytes seen
+	bool header;              // the next byte is a NAL header
+	int type;                 // of the SPS or slice being collected, 0 for none
+	uint8_t nal[H264_NAL_MAX];
+	size_t nal_size;
+
+	H264_INFO_T sps;          // the last one seen, if have_sps
+	bool have_sps;
+	bool pending_field;       // the last picture was an unpaired field
+	uint32_t frame_num;       // of that field
+
+	uint64_t pictures;        // frames, each field pair once
+	bool idr;                 // the last frame counted starts with an IDR picture
+} H264_COUNTER_T;
+
+void h264_count_pictures(H264_COUNTER_T* counter, const uint8_t* data, size_t size);
+
+#endif
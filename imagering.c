@@ -0,0 +1,147 @@
+// Ring of source textures that egl_render decodes into in turn, so the
+// decoder fills one while the renderer draws from another
+
+#include <stdio.h>
+#include <string.h>
+
+#include "imagering.h"
+
+void image_ring_init(IMAGE_RING_T* ring, int count, const IMAGE_RING_OPS_T* ops, bool keep_all)
+{
+	memset(ring, 0, sizeof(*ring));
+	pthread_mutex_init(&ring->lock, NULL);
+	ring->ops = *ops;
+	ring->keep_all = keep_all;
+	ring->count = count < IMAGE_RING_MAX ? count : IMAGE_RING_MAX;
+	ring->shown = -1;
+}
+
+void image_ring_destroy(IMAGE_RING_T* ring)
+{
+	pthread_mutex_destroy(&ring->lock);
+}
+
+// The decoder is called without the lock held, since it may call back
+// into the ring before it returns. The slots are already marked as its own.
+static int hand_to_decoder(IMAGE_RING_T* ring, void** buffers, int count)
+{
+	int i, result = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (ring->ops.fill(ring->ops.context, buffers[i]) < 0)
+			result = -1;
+	}
+	return result;
+}
+
+// Give slot back to the decoder if it is running; with the lock held
+static void recycle(IMAGE_RING_T* ring, int slot, void** buffers, int* count)
+{
+	if (ring->running)
+	{
+		ring->slots[slot].state = IMAGE_DECODING;
+		buffers[(*count)++] = ring->slots[slot].buffer;
+	}
+	else
+		ring->slots[slot].state = IMAGE_IDLE;
+}
+
+int image_ring_start(IMAGE_RING_T* ring)
+{
+	void* buffers[IMAGE_RING_MAX];
+	int count = 0, i;
+
+	pthread_mutex_lock(&ring->lock);
+	ring->running = true;
+	for (i = 0; i < ring->count; i++)
+	{
+		if (ring->slots[i].state == IMAGE_IDLE)
+			recycle(ring, i, buffers, &count);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	return hand_to_decoder(ring, buffers, count);
+}
+
+void image_ring_stop(IMAGE_RING_T* ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->running = false;
+	pthread_mutex_unlock(&ring->lock);
+}
+
+int image_ring_filled(IMAGE_RING_T* ring, void* buffer)
+{
+	void* buffers[IMAGE_RING_MAX];
+	int count = 0, slot;
+
+	pthread_mutex_lock(&ring->lock);
+	for (slot = 0; slot < ring->count && ring->slots[slot].buffer != buffer; slot++)
+		;
+	if (slot == ring->count || ring->slots[slot].state != IMAGE_DECODING)
+	{
+		pthread_mutex_unlock(&ring->lock);
+		printf("error: egl_render returned a buffer it didn't have.\n");
+		return -1;
+	}
+
+	if (!ring->running)
+		ring->slots[slot].state = IMAGE_IDLE;
+	else
+	{
+		// only the latest frame is worth showing, unless all of them are
+		if (!ring->keep_all)
+		{
+			while (ring->ready_count > 0)
+				recycle(ring, ring->ready[--ring->ready_count], buffers, &count);
+		}
+		ring->slots[slot].state = IMAGE_READY;
+		ring->ready[ring->ready_count++] = slot;
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	return hand_to_decoder(ring, buffers, count);
+}
+
+GLuint image_ring_acquire(IMAGE_RING_T* ring)
+{
+	GLuint texture;
+
+	pthread_mutex_lock(&ring->lock);
+	ring->drawn++;
+	if (ring->ready_count > 0)
+	{
+		if (ring->shown >= 0)
+			ring->slots[ring->shown].state = IMAGE_RETIRED;
+		ring->shown = ring->ready[0];
+		ring->slots[ring->shown].state = IMAGE_SHOWN;
+		ring->ready_count--;
+		memmove(ring->ready, ring->ready + 1, ring->ready_count * sizeof(int));
+	}
+
+	// before the first frame, the first texture, which starts out cleared
+	if (ring->shown >= 0)
+		ring->slots[ring->shown].frame = ring->drawn;
+	texture = ring->slots[ring->shown >= 0 ? ring->shown : 0].texture;
+	pthread_mutex_unlock(&ring->lock);
+
+	return texture;
+}
+
+int image_ring_release(IMAGE_RING_T* ring)
+{
+	void* buffers[IMAGE_RING_MAX];
+	int count = 0, i;
+
+	pthread_mutex_lock(&ring->lock);
+	ring->finished++;
+	for (i = 0; i < ring->count; i++)
+	{
+		if (ring->slots[i].state == IMAGE_RETIRED && (int)(ring->slots[i].frame - ring->finished) <= 0)
+			recycle(ring, i, buffers, &count);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	return hand_to_decoder(ring, buffers, count);
+}
@@ -0,0 +1,87 @@
+// Ring of source textures that egl_render decodes into in turn, so the
+// decoder fills one while the renderer draws from another. Each image
+// belongs to one side at a time and is handed over explicitly; the decoder
+// is reached only through IMAGE_RING_OPS_T, so the ring runs without
+// OpenMAX as well.
+
+#ifndef IMAGERING_H
+#define IMAGERING_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "GLES2/gl2.h"
+
+// images in the ring: one shown, one still read by the frame before, which
+// the GPU may not have finished, one ready and one being decoded into
+#define IMAGE_RING_SIZE 4
+#define IMAGE_RING_MAX 4
+
+typedef enum
+{
+	IMAGE_IDLE,               // owned by nobody, before start or after stop
+	IMAGE_DECODING,           // handed to the decoder to fill
+	IMAGE_READY,              // filled, waiting for the renderer
+	IMAGE_SHOWN,              // the renderer draws from it
+	IMAGE_RETIRED,            // replaced, but the GPU may still read it
+} IMAGE_STATE_T;
+
+typedef struct
+{
+	// hand buffer to the decoder to fill; returns -1 on failure
+	int (*fill)(void* context, void* buffer);
+	void* context;
+} IMAGE_RING_OPS_T;
+
+typedef struct
+{
+	GLuint texture;
+	void* image;              // the EGL image of the texture
+	void* buffer;             // the decoder's buffer for the image
+	IMAGE_STATE_T state;
+	unsigned frame;           // the last frame drawn from it
+} IMAGE_SLOT_T;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	IMAGE_RING_OPS_T ops;
+	bool keep_all;            // show every frame, rather than the latest
+	bool running;
+	int count;
+	IMAGE_SLOT_T slots[IMAGE_RING_MAX];
+	int ready[IMAGE_RING_MAX];  // filled slots, oldest first
+	int ready_count;
+	int shown;                // slot the renderer draws from, -1 for none
+	unsigned drawn;           // frames the renderer started
+	unsigned finished;        // and the GPU finished
+} IMAGE_RING_T;
+
+// Set up a ring of count slots; their texture, image and buffer are filled
+// in by the caller. With keep_all the decoder waits for the renderer
+// instead of a newer frame replacing one that hasn't been shown.
+void image_ring_init(IMAGE_RING_T* ring, int count, const IMAGE_RING_OPS_T* ops, bool keep_all);
+void image_ring_destroy(IMAGE_RING_T* ring);
+
+// Hand every idle slot to the decoder. Returns -1 if it refused one.
+int image_ring_start(IMAGE_RING_T* ring);
+
+// After stop, buffers the decoder returns are kept rather than refilled
+void image_ring_stop(IMAGE_RING_T* ring);
+
+// Decoder thread: buffer has been filled. A frame that was never shown
+// goes straight back to the decoder unless keep_all is set. Returns -1 if
+// the buffer isn't in the ring or the decoder refused one.
+int image_ring_filled(IMAGE_RING_T* ring, void* buffer);
+
+// Render thread, before drawing a frame: take the next decoded frame if one
+// is ready, and return the texture to draw from. The one shown before is
+// retired.
+GLuint image_ring_acquire(IMAGE_RING_T* ring);
+
+// Render thread, once for every frame the GPU has finished drawing, in
+// order: hand the retired images that no frame still in flight reads back
+// to the decoder. Returns -1 if it refused one.
+int image_ring_release(IMAGE_RING_T* ring);
+
+#endif
@@ -0,0 +1,302 @@
+// Index of the IDR pictures of a raw H.264 movie, so playback can start and
+// loop anywhere without decoding from the start. The stream is scanned once
+// and the index cached next to it as <movie>.idx.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "h264.h"
+#include "keyframes.h"
+
+#define NAL_SLICE 1
+#define NAL_IDR 5
+
+// rate assumed for a stream without VUI timing
+#define KEYFRAMES_DEFAULT_FPS 25.0
+
+#define SCAN_BLOCK (1 << 20)
+#define NO_RUN UINT64_MAX
+
+// Byte by byte scan of an Annex-B stream. The counter finds where frames
+// start; the access unit of one starts at the NAL units before its first
+// slice.
+typedef struct
+{
+	KEYFRAMES_T* index;
+	int alloc;
+	uint64_t position;
+	uint32_t window;
+	bool header;
+	H264_COUNTER_T counter;
+	uint64_t code;            // start of the last start code
+	uint64_t run;             // start of the NAL units before a slice
+	uint64_t access_unit;
+} SCAN_T;
+
+static int add_keyframe(SCAN_T* scan, uint64_t offset, uint64_t picture)
+{
+	KEYFRAMES_T* index = scan->index;
+
+	if (index->count == scan->alloc)
+	{
+		int alloc = scan->alloc ? scan->alloc * 2 : 256;
+		KEYFRAME_T* keyframes = realloc(index->keyframes, alloc * sizeof(KEYFRAME_T));
+		if (keyframes == NULL)
+			return -1;
+		index->keyframes = keyframes;
+		scan->alloc = alloc;
+	}
+	index->keyframes[index->count].offset = offset;
+	index->keyframes[index->count].picture = picture;
+	index->count++;
+	return 0;
+}
+
+// Count the frames in data, up to the next slice: the counter finds at most
+// one new frame in there, that of the slice before, so of access_unit
+static int count_frames(SCAN_T* scan, const uint8_t* data, size_t size)
+{
+	uint64_t frames = scan->counter.pictures;
+
+	h264_count_pictures(&scan->counter, data, size);
+	if (scan->counter.pictures != frames && scan->counter.idr)
+		return add_keyframe(scan, scan->access_unit, frames);
+	return 0;
+}
+
+static int scan_block(SCAN_T* scan, const uint8_t* data, size_t size)
+{
+	size_t i, counted = 0;
+
+	for (i = 0; i < size; i++, scan->position++)
+	{
+		uint8_t byte = data[i];
+
+		if (scan->header)
+		{
+			int type = byte & 0x1f;
+			if (type >= NAL_SLICE && type <= NAL_IDR)
+			{
+				if (count_frames(scan, data + counted, i - counted) < 0)
+					return -1;
+				counted = i;
+				scan->access_unit = scan->run != NO_RUN ? scan->run : scan->code;
+				scan->run = NO_RUN;
+			}
+			else if (scan->run == NO_RUN)
+				scan->run = scan->code;
+			scan->header = false;
+		}
+
+		scan->window = scan->window << 8 | byte;
+		if ((scan->window & 0xffffff) == 1)
+		{
+			scan->header = true;
+			scan->code = scan->position - (scan->window == 1 ? 3 : 2);
+		}
+	}
+	return count_frames(scan, data + counted, size - counted);
+}
+
+static int scan_movie(const char* filename, KEYFRAMES_T* index)
+{
+	SCAN_T scan;
+	H264_INFO_T info;
+	size_t size;
+	int result = 0;
+
+	FILE* fp = fopen(filename, "rb");
+	uint8_t* block = malloc(SCAN_BLOCK);
+	if (fp == NULL || block == NULL)
+	{
+		if (fp != NULL)
+			fclose(fp);
+		free(block);
+		return -1;
+	}
+
+	memset(&scan, 0, sizeof(scan));
+	scan.index = index;
+	scan.window = 0xffffffff;
+	scan.run = NO_RUN;
+	while (result == 0 && (size = fread(block, 1, SCAN_BLOCK, fp)) > 0)
+		result = scan_block(&scan, block, size);
+	index->size = scan.position;
+	index->pictures = scan.counter.pictures;
+
+	fclose(fp);
+	free(block);
+
+	index->fps = h264_probe_file(filename, &info) == 0 && info.fps > 0 ?
+		info.fps : KEYFRAMES_DEFAULT_FPS;
+	return result;
+}
+
+static char* cache_filename(const char* filename)
+{
+	size_t cache_len = strlen(filename) + 5;
+	char* cache_name = malloc(cache_len);
+	if (cache_name != NULL)
+		snprintf(cache_name, cache_len, "%s.idx", filename);
+	return cache_name;
+}
+
+// Modification time in nanoseconds, so a movie rewritten within a second
+// of being indexed is scanned again
+static int64_t mtime_ns(const struct stat* st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int read_cache(const char* cache_name, const struct stat* movie_stat, KEYFRAMES_T* index)
+{
+	KEYFRAMES_FILE_HEADER_T header;
+	FILE* fp = fopen(cache_name, "rb");
+	int result = -1;
+
+	if (fp == NULL)
+		return -1;
+
+	// a movie of the same size and mtime is taken to be the same: hashing
+	// it would cost as much as scanning it again
+	if (fread(&header, sizeof(header), 1, fp) == 1 &&
+		memcmp(header.magic, KEYFRAMES_MAGIC, 4) == 0 && header.version == KEYFRAMES_VERSION &&
+		header.movie_size == movie_stat->st_size && header.movie_mtime == mtime_ns(movie_stat) &&
+		header.count > 0)
+	{
+		index->keyframes = malloc(header.count * sizeof(KEYFRAME_T));
+		if (index->keyframes != NULL &&
+			fread(index->keyframes, sizeof(KEYFRAME_T), header.count, fp) == header.count)
+		{
+			index->count = header.count;
+			index->pictures = header.pictures;
+			index->fps = header.fps;
+			index->size = header.movie_size;
+			result = 0;
+		}
+		else
+		{
+			free(index->keyframes);
+			index->keyframes = NULL;
+		}
+	}
+
+	fclose(fp);
+	return result;
+}
+
+// Written to a temporary file first, so readers never see a partial one
+static int write_cache(const char* cache_name, const struct stat* movie_stat, const KEYFRAMES_T* index)
+{
+	KEYFRAMES_FILE_HEADER_T header;
+	size_t tmp_len = strlen(cache_name) + 5;
+	char* tmp_name = malloc(tmp_len);
+	int result = -1;
+
+	if (tmp_name == NULL)
+		return -1;
+	snprintf(tmp_name, tmp_len, "%s.tmp", cache_name);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KEYFRAMES_MAGIC, 4);
+	header.version = KEYFRAMES_VERSION;
+	header.movie_size = movie_stat->st_size;
+	header.movie_mtime = mtime_ns(movie_stat);
+	header.pictures = index->pictures;
+	header.fps = index->fps;
+	header.count = index->count;
+
+	FILE* fp = fopen(tmp_name, "wb");
+	if (fp != NULL)
+	{
+		if (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+			fwrite(index->keyframes, sizeof(KEYFRAME_T), index->count, fp) == index->count)
+			result = 0;
+		if (fclose(fp) != 0)
+			result = -1;
+		if (result == 0 && rename(tmp_name, cache_name) != 0)
+			result = -1;
+		if (result != 0)
+			unlink(tmp_name);
+	}
+
+	free(tmp_name);
+	return result;
+}
+
+int keyframes_load(const char* filename, KEYFRAMES_T* index, bool verbose)
+{
+	struct stat movie_stat;
+	char* cache_name;
+
+	memset(index, 0, sizeof(*index));
+	if (stat(filename, &movie_stat) != 0)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	cache_name = cache_filename(filename);
+	if (cache_name != NULL && read_cache(cache_name, &movie_stat, index) == 0)
+	{
+		if (verbose)
+			printf("Using keyframe index %s\n", cache_name);
+		free(cache_name);
+		return 0;
+	}
+
+	if (verbose)
+		printf("Indexing the keyframes of %s\n", filename);
+	if (scan_movie(filename, index) < 0 || index->count == 0)
+	{
+		printf("error: %s has no IDR pictures to start from.\n", filename);
+		keyframes_free(index);
+		free(cache_name);
+		return -1;
+	}
+
+	// a read-only directory only costs the next start another scan
+	if (cache_name != NULL && write_cache(cache_name, &movie_stat, index) < 0 && verbose)
+		printf("warning: could not write %s\n", cache_name);
+	if (verbose)
+		printf("Keyframes: %d in %llu pictures at %.3f fps\n", index->count,
+			(unsigned long long)index->pictures, index->fps);
+
+	free(cache_name);
+	return 0;
+}
+
+void keyframes_free(KEYFRAMES_T* index)
+{
+	free(index->keyframes);
+	memset(index, 0, sizeof(*index));
+}
+
+double keyframes_time(const KEYFRAMES_T* index, int keyframe)
+{
+	return index->keyframes[keyframe].picture / index->fps;
+}
+
+int keyframes_find(const KEYFRAMES_T* index, double time, bool after)
+{
+	int low = 0, high = index->count;
+
+	// first keyframe after time
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (keyframes_time(index, middle) <= time)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (!after)
+		return low > 0 ? low - 1 : 0;
+	if (low > 0 && keyframes_time(index, low - 1) == time)
+		return low - 1;
+	return low;
+}
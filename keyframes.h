@@ -0,0 +1,55 @@
+// Index of the IDR pictures of a raw H.264 movie, so playback can start and
+// loop anywhere without decoding from the start. The stream is scanned once
+// and the index cached next to it as <movie>.idx.
+
+#ifndef KEYFRAMES_H
+#define KEYFRAMES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEYFRAMES_MAGIC   "IDX1"
+#define KEYFRAMES_VERSION 2
+
+typedef struct
+{
+	uint64_t offset;          // of the access unit in the file
+	uint64_t picture;         // frames before it in the stream, a field pair once
+} KEYFRAME_T;
+
+typedef struct
+{
+	KEYFRAME_T* keyframes;
+	int count;
+	uint64_t pictures;        // frames in the whole stream
+	double fps;               // from the SPS, or a guess
+	uint64_t size;            // of the file
+} KEYFRAMES_T;
+
+// On-disk header of the cache, followed by count KEYFRAME_T
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t movie_size;
+	int64_t movie_mtime;      // nanoseconds
+	uint64_t pictures;
+	double fps;
+	uint32_t count;
+	uint32_t reserved;
+} KEYFRAMES_FILE_HEADER_T;
+
+// Load the index of a raw H.264 movie from its cache, if that was made
+// from a file of the same size and mtime, or scan the movie and cache it.
+// Returns -1 if the movie can't be read or has no IDR picture.
+int keyframes_load(const char* filename, KEYFRAMES_T* index, bool verbose);
+void keyframes_free(KEYFRAMES_T* index);
+
+// The last keyframe at or before time seconds or, with after, the first at
+// or after it; count if there is none
+int keyframes_find(const KEYFRAMES_T* index, double time, bool after);
+
+// Seconds from the start of the stream to a keyframe
+double keyframes_time(const KEYFRAMES_T* index, int keyframe);
+
+#endif
@@ -0,0 +1,741 @@
+// UV map loading and the precompiled .uvm map format
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "png.h"
+
+#include "map.h"
+#include "deinterleave.h"
+
+static size_t align_up(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Decode a 16 bit RGBA PNG one row at a time and pass it on in bands of
+// MAP_BAND_ROWS rows, split into msb and lsb planes and in upload order.
+// Only one PNG row and one band are held in memory.
+static int stream_png(const char * file_name, MAP_BAND_FN fn, void* arg)
+{
+	png_byte header[8];
+
+	FILE *fp = fopen(file_name, "rb");
+	if (fp == 0)
+	{
+		perror(file_name);
+		return -1;
+	}
+
+	// read the header
+	if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8))
+	{
+		printf("error: %s is not a PNG.\n", file_name);
+		fclose(fp);
+		return -1;
+	}
+
+	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png_ptr)
+	{
+		printf("error: png_create_read_struct returned 0.\n");
+		fclose(fp);
+		return -1;
+	}
+
+	// create png info struct
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		printf("error: png_create_info_struct returned 0.\n");
+		png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+		fclose(fp);
+		return -1;
+	}
+
+	// create png info struct
+	png_infop end_info = png_create_info_struct(png_ptr);
+	if (!end_info)
+	{
+		printf("error: png_create_info_struct returned 0.\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
+		fclose(fp);
+		return -1;
+	}
+
+	// volatile as they are changed between setjmp and longjmp
+	png_byte * volatile row_data = NULL;
+	uint8_t * volatile band_data = NULL;
+
+	// the code in this if statement gets called if libpng encounters an error
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		printf("error from libpng\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		free(row_data);
+		free(band_data);
+		fclose(fp);
+		return -1;
+	}
+
+	// init png reading
+	png_init_io(png_ptr, fp);
+
+	// let libpng know you already read the first 8 bytes
+	png_set_sig_bytes(png_ptr, 8);
+
+	// read all the info up to the image data
+	png_read_info(png_ptr, info_ptr);
+
+	// variables to pass to get info
+	int bit_depth, color_type, interlace_type;
+	png_uint_32 temp_width, temp_height;
+
+	// get info about png
+	png_get_IHDR(png_ptr, info_ptr, &temp_width, &temp_height, &bit_depth, &color_type,
+		&interlace_type, NULL, NULL);
+
+	const char* error = NULL;
+	if(bit_depth!=16)
+		error = "expected 16 bit per channel map";
+	else if(color_type!=PNG_COLOR_TYPE_RGB_ALPHA)
+		error = "expected RGBA map";
+	else if(interlace_type!=PNG_INTERLACE_NONE)
+		// interlaced images can only be decoded as a whole
+		error = "interlaced maps are not supported, save the map without interlacing";
+	if (error)
+	{
+		printf("error: %s\n", error);
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		fclose(fp);
+		return -1;
+	}
+
+	// Update the png info struct.
+	png_read_update_info(png_ptr, info_ptr);
+
+	// Row size in bytes; a 16 bit RGBA row splits into two RGBA8 rows,
+	// which are always 4-byte aligned as glTexImage2d requires
+	int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+	int stride = rowbytes / 2;
+
+	row_data = malloc(rowbytes);
+	band_data = malloc(2 * (size_t)stride * MAP_BAND_ROWS);
+	if (row_data == NULL || band_data == NULL)
+	{
+		printf("error: could not allocate memory for PNG rows\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		free(row_data);
+		free(band_data);
+		fclose(fp);
+		return -1;
+	}
+
+	MAP_BAND_T band;
+	memset(&band, 0, sizeof(band));
+	band.width = temp_width;
+	band.height = temp_height;
+	band.stride = stride;
+	band.msb = band_data;
+	band.lsb = band_data + (size_t)stride * MAP_BAND_ROWS;
+
+	int result = 0;
+	int row = 0, i;
+	while (row < temp_height && result == 0)
+	{
+		band.rows = temp_height - row < MAP_BAND_ROWS ? temp_height - row : MAP_BAND_ROWS;
+		// PNG rows are top-down, textures bottom-up
+		band.y = temp_height - row - band.rows;
+
+		for (i = 0; i < band.rows; i++)
+		{
+			size_t offset = (size_t)(band.rows - 1 - i) * stride;
+			png_read_row(png_ptr, row_data, NULL);
+			// 16 bit samples are big endian, so the msb is the even byte
+			deinterleave(row_data, band_data + offset,
+				band_data + (size_t)stride * MAP_BAND_ROWS + offset, stride);
+		}
+
+		result = fn(arg, &band);
+		band.index++;
+		row += band.rows;
+	}
+
+	// clean up
+	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+	free(row_data);
+	free(band_data);
+	fclose(fp);
+
+	return result;
+}
+
+// FNV-1a hash of the file contents
+static int hash_file(const char* filename, uint64_t* hash)
+{
+	unsigned char block[64<<10];
+	size_t len, i;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	FILE* fp = fopen(filename, "rb");
+	if (fp == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	while ((len = fread(block, 1, sizeof(block), fp)) > 0)
+	{
+		for (i = 0; i < len; i++)
+		{
+			h ^= block[i];
+			h *= 0x100000001b3ULL;
+		}
+	}
+
+	fclose(fp);
+	*hash = h;
+	return 0;
+}
+
+static int write_all(int fd, const void* data, size_t size, off_t offset)
+{
+	const uint8_t* p = data;
+	while (size > 0)
+	{
+		ssize_t written = pwrite(fd, p, size, offset);
+		if (written <= 0)
+			return -1;
+		p += written;
+		offset += written;
+		size -= written;
+	}
+	return 0;
+}
+
+// Modification time in nanoseconds: a PNG rewritten within the second it
+// was cached in still has to be told apart
+static int64_t mtime_ns(const struct stat* st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+typedef struct
+{
+	int fd;
+	char* tmp_name;
+	MAP_FILE_HEADER_T header;
+	int result;
+} MAP_WRITER_T;
+
+// Start writing a .uvm file. It is written to a temporary file so readers
+// never see a partial one, and the header is written last.
+static int writer_open(MAP_WRITER_T* writer, const char* filename,
+	const struct stat* png_stat, uint64_t png_hash)
+{
+	memset(writer, 0, sizeof(*writer));
+	memcpy(writer->header.magic, MAP_FILE_MAGIC, 4);
+	writer->header.version = MAP_FILE_VERSION;
+	writer->header.png_size = png_stat->st_size;
+	writer->header.png_mtime = mtime_ns(png_stat);
+	writer->header.png_hash = png_hash;
+
+	size_t tmp_len = strlen(filename) + 5;
+	writer->tmp_name = malloc(tmp_len);
+	if (writer->tmp_name == NULL)
+		return -1;
+	snprintf(writer->tmp_name, tmp_len, "%s.tmp", filename);
+
+	writer->fd = open(writer->tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (writer->fd < 0)
+	{
+		free(writer->tmp_name);
+		return -1;
+	}
+	return 0;
+}
+
+static void writer_band(MAP_WRITER_T* writer, const MAP_BAND_T* band)
+{
+	MAP_FILE_HEADER_T* header = &writer->header;
+	size_t size = (size_t)band->stride * band->rows;
+	size_t offset = (size_t)band->stride * band->y;
+
+	if (band->index == 0)
+	{
+		header->width = band->width;
+		header->height = band->height;
+		header->stride = band->stride;
+		header->msb_offset = MAP_FILE_ALIGN;
+		header->lsb_offset = header->msb_offset +
+			align_up((size_t)band->stride * band->height, MAP_FILE_ALIGN);
+	}
+
+	if (writer->result == 0)
+		writer->result = write_all(writer->fd, band->msb, size, header->msb_offset + offset);
+	if (writer->result == 0)
+		writer->result = write_all(writer->fd, band->lsb, size, header->lsb_offset + offset);
+}
+
+// Finish the file and move it into place, or throw it away
+static int writer_close(MAP_WRITER_T* writer, const char* filename, bool commit)
+{
+	int result = writer->result;
+	if (!commit && result == 0)
+		result = -1;
+
+	if (result == 0)
+		result = write_all(writer->fd, &writer->header, sizeof(writer->header), 0);
+	if (close(writer->fd) != 0 && result == 0)
+		result = -1;
+	if (result == 0 && rename(writer->tmp_name, filename) != 0)
+		result = -1;
+
+	if (result != 0)
+	{
+		if (commit)
+			perror(writer->tmp_name);
+		unlink(writer->tmp_name);
+	}
+	free(writer->tmp_name);
+	return result;
+}
+
+// Map a .uvm file into memory and check its header
+static int map_file(const char* filename, MAP_T* map, MAP_FILE_HEADER_T* header, bool quiet)
+{
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		if (!quiet)
+			perror(filename);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(MAP_FILE_HEADER_T))
+	{
+		if (!quiet)
+			printf("error: %s is not a map file.\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	memcpy(header, mapping, sizeof(*header));
+	size_t plane_size = (size_t)header->stride * header->height;
+	if (memcmp(header->magic, MAP_FILE_MAGIC, 4) != 0 ||
+		header->version != MAP_FILE_VERSION ||
+		header->stride < header->width * 4 || header->stride % 4 != 0 ||
+		header->msb_offset + plane_size > st.st_size ||
+		header->lsb_offset + plane_size > st.st_size)
+	{
+		if (!quiet)
+			printf("error: %s is not a valid map file.\n", filename);
+		munmap(mapping, st.st_size);
+		return -1;
+	}
+
+	// the whole file is about to be uploaded front to back
+	madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+	madvise(mapping, st.st_size, MADV_WILLNEED);
+
+	memset(map, 0, sizeof(*map));
+	map->width = header->width;
+	map->height = header->height;
+	map->stride = header->stride;
+	map->msb = (const uint8_t*)mapping + header->msb_offset;
+	map->lsb = (const uint8_t*)mapping + header->lsb_offset;
+	map->mapping = mapping;
+	map->mapping_size = st.st_size;
+	return 0;
+}
+
+static bool is_map_file(const char* filename)
+{
+	char magic[4];
+	bool result = false;
+
+	FILE* fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return false;
+	if (fread(magic, 1, 4, fp) == 4)
+		result = memcmp(magic, MAP_FILE_MAGIC, 4) == 0;
+	fclose(fp);
+	return result;
+}
+
+// Look for a valid cached copy of a PNG map and map it. If the PNG had to
+// be hashed, *hashed is set and the hash left in *png_hash.
+static int open_cache(const char* filename, const char* cache_name,
+	const struct stat* png_stat, MAP_T* map, uint64_t* png_hash, bool* hashed, bool verbose)
+{
+	MAP_FILE_HEADER_T header;
+
+	*hashed = false;
+	if (map_file(cache_name, map, &header, true) != 0)
+		return -1;
+
+	// the cache is valid if it was built from a PNG with the same size and
+	// mtime, or failing that, the same contents
+	if (header.png_size == png_stat->st_size && header.png_mtime == mtime_ns(png_stat))
+	{
+		if (verbose)
+			printf("Using cached map %s\n", cache_name);
+		return 0;
+	}
+
+	if (header.png_size == png_stat->st_size && hash_file(filename, png_hash) == 0)
+		*hashed = true;
+	if (*hashed && header.png_hash == *png_hash)
+	{
+		// only touched; record the new mtime so the hash isn't needed next time
+		int fd = open(cache_name, O_WRONLY);
+		if (fd >= 0)
+		{
+			header.png_mtime = mtime_ns(png_stat);
+			write_all(fd, &header, sizeof(header), 0);
+			close(fd);
+		}
+		if (verbose)
+			printf("Using cached map %s (unchanged contents)\n", cache_name);
+		return 0;
+	}
+
+	map_close(map);
+	return -1;
+}
+
+static char* cache_filename(const char* filename)
+{
+	size_t cache_len = strlen(filename) + 5;
+	char* cache_name = malloc(cache_len);
+	if (cache_name != NULL)
+		snprintf(cache_name, cache_len, "%s.uvm", filename);
+	return cache_name;
+}
+
+// Collect bands into a heap copy of the map
+static int collect_band(void* arg, const MAP_BAND_T* band)
+{
+	MAP_T* map = arg;
+	size_t plane_size = (size_t)band->stride * band->height;
+
+	if (band->index == 0)
+	{
+		map->buffer = malloc(2 * plane_size);
+		if (map->buffer == NULL)
+		{
+			printf("error: could not allocate memory for map planes\n");
+			return -1;
+		}
+		map->width = band->width;
+		map->height = band->height;
+		map->stride = band->stride;
+		map->msb = map->buffer;
+		map->lsb = map->buffer + plane_size;
+	}
+
+	memcpy(map->buffer + (size_t)band->stride * band->y,
+		band->msb, (size_t)band->stride * band->rows);
+	memcpy(map->buffer + plane_size + (size_t)band->stride * band->y,
+		band->lsb, (size_t)band->stride * band->rows);
+	return 0;
+}
+
+typedef struct
+{
+	MAP_WRITER_T* writer;
+	MAP_BAND_FN fn;
+	void* arg;
+} MAP_STREAM_T;
+
+static int stream_band(void* arg, const MAP_BAND_T* band)
+{
+	MAP_STREAM_T* stream = arg;
+	if (stream->writer != NULL)
+		writer_band(stream->writer, band);
+	return stream->fn != NULL ? stream->fn(stream->arg, band) : 0;
+}
+
+// Decode a PNG map, passing the bands to fn and to a new cache file. The
+// PNG's hash is computed unless png_hash has it already. If the cache can't
+// be written and fallback isn't NULL, the map is collected into it instead.
+static int stream_and_cache(const char* filename, const char* cache_name,
+	const struct stat* png_stat, const uint64_t* png_hash, MAP_BAND_FN fn, void* arg,
+	MAP_T* fallback, bool verbose)
+{
+	MAP_WRITER_T writer;
+	MAP_STREAM_T stream = { NULL, fn, arg };
+	uint64_t hash;
+
+	if (verbose)
+		printf("Decoding map %s\n", filename);
+
+	// a failure to write the cache only costs time on the next start
+	if (png_hash != NULL)
+		hash = *png_hash;
+	if ((png_hash != NULL || hash_file(filename, &hash) == 0) &&
+		writer_open(&writer, cache_name, png_stat, hash) == 0)
+		stream.writer = &writer;
+	else if (fallback != NULL)
+	{
+		stream.fn = collect_band;
+		stream.arg = fallback;
+	}
+
+	int result = stream_png(filename, stream_band, &stream);
+
+	if (stream.writer != NULL &&
+		writer_close(&writer, cache_name, result == 0) == 0 && verbose)
+		printf("Cached map as %s\n", cache_name);
+
+	return result;
+}
+
+// Pass a complete map to a band consumer in one go
+static int whole_band(const MAP_T* map, MAP_BAND_FN fn, void* arg)
+{
+	MAP_BAND_T band;
+	band.width = map->width;
+	band.height = map->height;
+	band.stride = map->stride;
+	band.y = 0;
+	band.rows = map->height;
+	band.index = 0;
+	band.msb = map->msb;
+	band.lsb = map->lsb;
+	return fn(arg, &band);
+}
+
+int map_load(const char* filename, MAP_BAND_FN fn, void* arg, bool verbose)
+{
+	MAP_T map;
+	MAP_FILE_HEADER_T header;
+	struct stat png_stat;
+	uint64_t png_hash;
+	bool hashed;
+	int result;
+
+	if (is_map_file(filename))
+	{
+		if (map_file(filename, &map, &header, false) != 0)
+			return -1;
+		result = whole_band(&map, fn, arg);
+		map_close(&map);
+		return result;
+	}
+
+	if (stat(filename, &png_stat) != 0)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	char* cache_name = cache_filename(filename);
+	if (cache_name == NULL)
+		return -1;
+
+	if (open_cache(filename, cache_name, &png_stat, &map, &png_hash, &hashed, verbose) == 0)
+	{
+		result = whole_band(&map, fn, arg);
+		map_close(&map);
+	}
+	else
+		result = stream_and_cache(filename, cache_name, &png_stat, hashed ? &png_hash : NULL,
+			fn, arg, NULL, verbose);
+
+	free(cache_name);
+	return result;
+}
+
+int map_open(const char* filename, MAP_T* map, bool verbose)
+{
+	MAP_FILE_HEADER_T header;
+	struct stat png_stat;
+	uint64_t png_hash;
+	bool hashed;
+	int result;
+
+	memset(map, 0, sizeof(*map));
+
+	if (is_map_file(filename))
+		return map_file(filename, map, &header, false);
+
+	if (stat(filename, &png_stat) != 0)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	char* cache_name = cache_filename(filename);
+	if (cache_name == NULL)
+		return -1;
+
+	result = open_cache(filename, cache_name, &png_stat, map, &png_hash, &hashed, verbose);
+	if (result != 0)
+	{
+		// build the cache, then map it; if it can't be written the decoded
+		// map is kept in memory instead
+		result = stream_and_cache(filename, cache_name, &png_stat, hashed ? &png_hash : NULL,
+			NULL, NULL, map, verbose);
+
+		// written, but not committed or mapped after all: decode it again
+		if (result == 0 && map->buffer == NULL && map_file(cache_name, map, &header, true) != 0)
+			result = stream_png(filename, collect_band, map);
+		if (result != 0)
+			map_close(map);
+	}
+
+	free(cache_name);
+	return result;
+}
+
+void map_close(MAP_T* map)
+{
+	if (map->mapping != NULL)
+		munmap(map->mapping, map->mapping_size);
+	free(map->buffer);
+	memset(map, 0, sizeof(*map));
+}
+
+// The coordinates of a pixel in 1/MAP_PACKED_ONE, unless it is transparent
+static bool pixel_uv(const uint8_t* msb, const uint8_t* lsb, int* u, int* v)
+{
+	// alpha rounded the way map_pack does
+	if (msb[3] + ((lsb[3] + 128) >> 8) == 0)
+		return false;
+	*u = msb[0] << 8 | lsb[0];
+	*v = msb[1] << 8 | lsb[1];
+	if (*u > MAP_PACKED_ONE)
+		*u = MAP_PACKED_ONE;
+	if (*v > MAP_PACKED_ONE)
+		*v = MAP_PACKED_ONE;
+	return true;
+}
+
+void map_bounds(const MAP_T* map, MAP_BOUNDS_T* bounds)
+{
+	int min_u = MAP_PACKED_ONE, max_u = 0, min_v = MAP_PACKED_ONE, max_v = 0;
+	int step_u = MAP_PACKED_ONE, step_v = MAP_PACKED_ONE;
+	bool empty = true, stepped = false;
+	int x, y;
+
+	for (y = 0; y < map->height; y++)
+	{
+		const uint8_t* msb = map->msb + (size_t)y * map->stride;
+		const uint8_t* lsb = map->lsb + (size_t)y * map->stride;
+
+		for (x = 0; x < map->width; x++, msb += 4, lsb += 4)
+		{
+			int u, v, across_u, across_v, up_u, up_v, cover_u, cover_v;
+
+			if (!pixel_uv(msb, lsb, &u, &v))
+				continue;
+			empty = false;
+			if (u < min_u) min_u = u;
+			if (u > max_u) max_u = u;
+			if (v < min_v) min_v = v;
+			if (v > max_v) max_v = v;
+
+			// how far the coordinates move to the next pixel across and up;
+			// the larger of the two is what the pixel covers of the source.
+			// At the edge of the visible area that can't be told.
+			if (x + 1 == map->width || y + 1 == map->height ||
+				!pixel_uv(msb + 4, lsb + 4, &across_u, &across_v) ||
+				!pixel_uv(msb + map->stride, lsb + map->stride, &up_u, &up_v))
+				continue;
+			cover_u = abs(across_u - u) > abs(up_u - u) ? abs(across_u - u) : abs(up_u - u);
+			cover_v = abs(across_v - v) > abs(up_v - v) ? abs(across_v - v) : abs(up_v - v);
+			if (cover_u < step_u) step_u = cover_u;
+			if (cover_v < step_v) step_v = cover_v;
+			stepped = true;
+		}
+	}
+
+	// without a single step to go by, the source is sampled in full
+	if (!stepped)
+		step_u = step_v = 0;
+
+	bounds->empty = empty;
+	bounds->left = min_u / (float)MAP_PACKED_ONE;
+	bounds->right = max_u / (float)MAP_PACKED_ONE;
+	// v counts from the bottom of the source, the shader flips it
+	bounds->top = 1.0f - max_v / (float)MAP_PACKED_ONE;
+	bounds->bottom = 1.0f - min_v / (float)MAP_PACKED_ONE;
+	bounds->step_s = step_u / (float)MAP_PACKED_ONE;
+	bounds->step_t = step_v / (float)MAP_PACKED_ONE;
+}
+
+int map_compile(const char* png_filename, const char* uvm_filename)
+{
+	MAP_WRITER_T writer;
+	MAP_STREAM_T stream = { &writer, NULL, NULL };
+	struct stat png_stat;
+	uint64_t png_hash;
+
+	if (stat(png_filename, &png_stat) != 0)
+	{
+		perror(png_filename);
+		return -1;
+	}
+
+	if (hash_file(png_filename, &png_hash) != 0)
+		return -1;
+
+	if (writer_open(&writer, uvm_filename, &png_stat, png_hash) != 0)
+	{
+		perror(uvm_filename);
+		return -1;
+	}
+
+	int result = stream_png(png_filename, stream_band, &stream);
+	return writer_close(&writer, uvm_filename, result == 0) == 0 ? result : -1;
+}
+
+bool map_pack(const uint8_t* msb, const uint8_t* lsb, size_t n,
+	uint8_t* packed, uint8_t* alpha)
+{
+	bool graded = false;
+	size_t i;
+
+	for (i = 0; i < n; i++, msb += 4, lsb += 4, packed += 4)
+	{
+		unsigned u = msb[0] << 8 | lsb[0];
+		unsigned v = msb[1] << 8 | lsb[1];
+		// rounded to 8 bits the way the split shader and remap do
+		unsigned a = msb[3] + ((lsb[3] + 128) >> 8);
+		if (a > 255)
+			a = 255;
+
+		// anything past 1.0 samples the edge texel anyway
+		if (u > MAP_PACKED_ONE)
+			u = MAP_PACKED_ONE;
+		if (v > MAP_PACKED_ONE)
+			v = MAP_PACKED_ONE;
+		if (a == 0)
+			u = v = MAP_PACKED_TRANSPARENT;
+		else if (a != 255)
+			graded = true;
+
+		packed[0] = u >> 8;
+		packed[1] = u & 0xff;
+		packed[2] = v >> 8;
+		packed[3] = v & 0xff;
+		alpha[i] = a;
+	}
+
+	return graded;
+}
@@ -0,0 +1,107 @@
+// UV map loading and the precompiled .uvm map format
+
+#ifndef MAP_H
+#define MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Precompiled maps start with this header, followed by the msb and lsb
+// planes at page aligned offsets. The planes are RGBA8 rows in upload
+// order (bottom row first), so they can be handed to glTexImage2D straight
+// from the mapping. Fields are stored in host byte order.
+#define MAP_FILE_MAGIC   "UVM1"
+#define MAP_FILE_VERSION 1
+#define MAP_FILE_ALIGN   4096
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t stride;          // bytes per plane row, multiple of 4
+	uint32_t reserved;
+	uint64_t msb_offset, lsb_offset;
+
+	// the PNG this file was compiled from, to validate a cached copy
+	uint64_t png_size;
+	int64_t png_mtime;        // nanoseconds
+	uint64_t png_hash;
+} MAP_FILE_HEADER_T;
+
+typedef struct
+{
+	int width, height;
+	int stride;               // bytes per row of each plane
+	const uint8_t* msb;
+	const uint8_t* lsb;
+
+	// backing storage: either a mapping of a .uvm file or a heap buffer
+	void* mapping;
+	size_t mapping_size;
+	uint8_t* buffer;
+} MAP_T;
+
+// A horizontal band of a map: rows [y, y+rows) in upload order (row 0 is
+// the bottom of the map), split into msb and lsb RGBA8 planes
+#define MAP_BAND_ROWS 16
+
+typedef struct
+{
+	int width, height;        // size of the whole map
+	int stride;               // bytes per row in msb and lsb
+	int y, rows;
+	int index;                // bands are numbered from 0
+	const uint8_t* msb;
+	const uint8_t* lsb;
+} MAP_BAND_T;
+
+// Receives the bands of a map; returning non-zero stops loading
+typedef int (*MAP_BAND_FN)(void* arg, const MAP_BAND_T* band);
+
+// Load a map band by band. A .uvm file or a valid cached copy is passed on
+// as a single band straight from the mapping; a PNG is decoded and split
+// MAP_BAND_ROWS rows at a time, from the top of the map down, while its
+// cache is written, so memory use does not depend on the map size.
+int map_load(const char* filename, MAP_BAND_FN fn, void* arg, bool verbose);
+
+// Open a map. A .uvm file is mapped directly; for a PNG the cached copy
+// next to it (<file>.uvm) is used if it is still valid, or is (re)built
+// first. Returns 0 on success.
+int map_open(const char* filename, MAP_T* map, bool verbose);
+void map_close(MAP_T* map);
+
+// Packed format for drivers with highp fragment floats: one RGBA8 texel per
+// pixel holds the 16 bit u in r,g and v in b,a, so the shader needs a single
+// map fetch and reads it back like the split planes, u = r + g/256. Pixels
+// with zero alpha get u = MAP_PACKED_TRANSPARENT, which is outside the range
+// of real coordinates (MAP_PACKED_ONE is 1.0 in texture coordinates).
+#define MAP_PACKED_ONE 65280
+#define MAP_PACKED_TRANSPARENT 0xffff
+
+// Pack n pixels of the msb and lsb planes into packed, and their 8 bit alpha
+// into alpha. Returns true if any alpha is neither 0 nor 255, which the
+// transparent marker alone can't represent.
+bool map_pack(const uint8_t* msb, const uint8_t* lsb, size_t n,
+	uint8_t* packed, uint8_t* alpha);
+
+// The part of the source a map samples, in source texture coordinates
+// with t = 0 at the top of the frame, as the shader samples it
+typedef struct
+{
+	bool empty;               // no pixel with alpha > 0
+	float left, top, right, bottom;
+	// the smallest step in s and t between neighbouring visible pixels; a
+	// map that never steps by less than a source pixel can take a smaller
+	// source
+	float step_s, step_t;
+} MAP_BOUNDS_T;
+
+// Bounds of the coordinates of the pixels with alpha > 0
+void map_bounds(const MAP_T* map, MAP_BOUNDS_T* bounds);
+
+// Convert a 16 bit RGBA PNG map to a .uvm file
+int map_compile(const char* png_filename, const char* uvm_filename);
+
+#endif
@@ -28,79 +28,156 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // OpenGL|ES 2 UV Mapper
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <pthread.h>
 #include <stdbool.h>
-
-#include "bcm_host.h"
-#include "png.h"
+#include <time.h>
+#include <math.h>
 
 #include "GLES2/gl2.h"
 #include "EGL/egl.h"
 #include "EGL/eglext.h"
 
-typedef struct
-{
-	char* filename;
-	bool loop;
-	void* egl_image;
-} VIDEO_INFO;
+#include "deinterleave.h"
+#include "fence.h"
+#include "gldebug.h"
+#include "map.h"
+#include "output.h"
+#include "platform.h"
+#include "readahead.h"
+#include "reload.h"
+#include "remap.h"
+#include "shader.h"
+#include "stats.h"
+#include "tasks.h"
+#include "video.h"
+#include "workers.h"
+
+// frames the GPU may still be drawing when the next one is started
+#define FRAMES_IN_FLIGHT 2
+
+// source pixels kept around the part of the frame the map samples, for the
+// rounding of the coordinates
+#define CROP_MARGIN 1
 
 typedef struct
 {
 	int status;
 	bool verbose;
+	bool stats;
 	
 	uint32_t screen_width;
 	uint32_t screen_height;
+
+	// --render-scale: the map is drawn at render_width x render_height, a
+	// fraction of the screen, and scaled up to it by the display where it
+	// can; with --upscale gpu, or where it can't, it is drawn into
+	// render_fbo and a last pass scales render_texture up bilinearly
+	float render_scale;
+	bool gpu_upscale;
+	uint32_t render_width, render_height;
+	GLuint render_texture, render_fbo;
+	GLuint upscale_program, upscale_buffer;
+	GLuint attrib_upscale_vertex, uniform_upscale_source;
+
+	// --cpu-remap: the frame is read back from the video texture into
+	// cpu_source, remapped by the worker pool into cpu_output and uploaded
+	// into render_texture, which the upscale pass draws
+	bool cpu_remap;
+	REMAP_T remap;
+	WORKERS_T* workers;
+	GLuint source_fbo;
+	uint32_t* cpu_source;
+	uint32_t* cpu_output;
 	
 	// OpenGL|ES objects
 	EGLDisplay display;
 	EGLSurface surface;
 	EGLContext context;
 
+	// pipelined present: fences after the frames the GPU may still be
+	// drawing, oldest first, unless --finish drains it every frame
+	bool finish;
+	bool pipelined;
+	FENCE_T fences[FRAMES_IN_FLIGHT];
+	uint32_t fence_frames[FRAMES_IN_FLIGHT];
+	int fence_count;
+
 	GLuint program;
+	// texture[0] and [1] hold the map: msb and lsb, or packed uv and alpha
 	GLuint texture[3];
+	SHADER_MAP_T map_format;
 	GLuint vertex_buffer;
+	GLsizei vertex_count;
+
+	// the interpolated mesh is drawn first from the start of vertex_buffer,
+	// then vertex_count per pixel vertices after it
+	bool mesh;
+	float mesh_error;       // in source pixels
+	GLuint mesh_program;
+	GLsizei mesh_count;
 
 	// shader attribs
 	GLuint attrib_vertex;
-	GLuint uniform_mapMsb, uniform_mapLsb;
+	GLuint uniform_map[2];
 	GLuint uniform_source;
-
-	// video texture
-	void* egl_image;
+	GLuint attrib_mesh_vertex;
+	GLuint uniform_mesh_source;
+
+	int video_width, video_height;
+	double video_fps;       // 0 if the movie doesn't say
+
+	// --crop: the decoder only delivers the part of the frame the map
+	// samples, scaled to texture_width x texture_height if the map never
+	// samples it at full resolution; source_rect is where that part is in
+	// the frame, for the shaders
+	bool crop;
+	VIDEO_CROP_T video_crop;
+	int texture_width, texture_height;
+	float source_rect[4];
+
+	// map upload: a prepared map is uploaded into reload_texture, up to
+	// reload_row, then swapped with texture[0] and [1]; while playing a
+	// changed map is uploaded a few rows per frame
+	RELOAD_T* reload;
+	RELOAD_MAP_T* reload_map;
+	GLuint reload_texture[2];
+	int reload_row;
+
+	// video texture, filled by the decoder thread
+	void* video_target;
+	VIDEO_INFO video_info;
 	pthread_t video_thread;
-	
-	int frame_available;
+	int readahead;
+	double start, end;        // range of the movie to play, in seconds
+
+	// frame handoff from the video thread; frame_seq counts the frames
+	// decoded so far
+	pthread_mutex_t frame_lock;
+	pthread_cond_t frame_cond;
+	uint32_t frame_seq;
+
+	// batch output: frames are drawn into a ring of framebuffers, so one can
+	// be read back while the next is being drawn
+	OUTPUT_T* output;
+	GLuint output_texture[2];
+	GLuint output_fbo[2];
 } APP_STATE_T;
 static APP_STATE_T _state, *state=&_state;
 
-
-// forward declaration
-void* video_decode(void* arg);
-int video_decode_dimensions(char *filename, int *frame_width, int *frame_height);
+// seconds between --stats reports
+#define STATS_INTERVAL 5.0
 
 
-
-#define checkgl() assert(glGetError() == 0)
-
-static void show_shaderlog(GLint shader)
+// A size times the render scale, rounded to an even number of pixels
+static uint32_t scaled_size(uint32_t size, float scale)
 {
-	// Prints the compile log for a shader
-	char log[1024];
-	glGetShaderInfoLog(shader,sizeof log,NULL,log);
-	if (log[0]!=0)
-		printf("Shader (%d): %s\n", shader, log);
-}
-
-static void show_programlog(GLint shader)
-{
-	// Prints the information log for a program object
-	char log[1024];
-	glGetProgramInfoLog(shader,sizeof log,NULL,log);
-	if (log[0]!=0)
-		printf("Program (%d): %s\n", shader, log);
+	uint32_t scaled = ((uint32_t)(size * scale + 0.5f) + 1) & ~1;
+	if (scaled < 2)
+		scaled = 2;
+	return scaled < size ? scaled : size;
 }
 
 /***********************************************************
@@ -113,25 +190,17 @@ static void show_programlog(GLint shader)
  ***********************************************************/
 static void init_ogl()
 {
-	int32_t success = 0;
 	EGLBoolean result;
 	EGLint num_config;
 
-	static EGL_DISPMANX_WINDOW_T nativewindow;
-
-	DISPMANX_ELEMENT_HANDLE_T dispman_element;
-	DISPMANX_DISPLAY_HANDLE_T dispman_display;
-	DISPMANX_UPDATE_HANDLE_T dispman_update;
-	VC_RECT_T dst_rect;
-	VC_RECT_T src_rect;
-
-	static const EGLint attribute_list[] =
+	const EGLint attribute_list[] =
 	{
 		EGL_RED_SIZE, 8,
 		EGL_GREEN_SIZE, 8,
 		EGL_BLUE_SIZE, 8,
 		EGL_ALPHA_SIZE, 8,
-		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_SURFACE_TYPE, platform_surface_type(),
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
 		EGL_NONE
 	};
 
@@ -143,7 +212,7 @@ static void init_ogl()
 	EGLConfig config;
 
 	// get an EGL display connection
-	state->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	state->display = platform_get_display();
 	assert(state->display!=EGL_NO_DISPLAY);
 	checkgl();
 
@@ -155,7 +224,7 @@ static void init_ogl()
 	// get an appropriate EGL frame buffer configuration
 	result = eglChooseConfig(state->display, attribute_list,
 		&config, 1, &num_config);
-	assert(EGL_FALSE != result);
+	assert(EGL_FALSE != result && num_config > 0);
 	checkgl();
 
 	// get an appropriate EGL frame buffer configuration
@@ -169,40 +238,35 @@ static void init_ogl()
 	assert(state->context!=EGL_NO_CONTEXT);
 	checkgl();
 
-	// create an EGL window surface
-	success = graphics_get_display_size(0 /* LCD */,
-		&state->screen_width, &state->screen_height);
-	assert( success >= 0 );
-
-	dst_rect.x = 0;
-	dst_rect.y = 0;
-	dst_rect.width = state->screen_width;
-	dst_rect.height = state->screen_height;
-
-	src_rect.x = 0;
-	src_rect.y = 0;
-	src_rect.width = state->screen_width << 16;
-	src_rect.height = state->screen_height << 16;
-
-	dispman_display = vc_dispmanx_display_open( 0 /* LCD */);
-	dispman_update = vc_dispmanx_update_start( 0 );
-
-	dispman_element = vc_dispmanx_element_add ( dispman_update, dispman_display,
-		0/*layer*/, &dst_rect, 0/*src*/,
-		&src_rect, DISPMANX_PROTECTION_NONE, 0 /*alpha*/, 0/*clamp*/, 0/*transform*/);
-
-	nativewindow.element = dispman_element;
-	nativewindow.width = state->screen_width;
-	nativewindow.height = state->screen_height;
-	vc_dispmanx_update_submit_sync( dispman_update );
-
-	checkgl();
-
-	state->surface = eglCreateWindowSurface( state->display,
-		config, &nativewindow, NULL );
+	// create the surface to render to; screen_width and screen_height hold
+	// the requested size, if any
+	bool display_upscale = state->render_scale < 1 && !state->gpu_upscale;
+	state->surface = platform_create_surface(state->display, config,
+		&state->screen_width, &state->screen_height,
+		display_upscale ? state->render_scale : 1);
 	assert(state->surface != EGL_NO_SURFACE);
 	checkgl();
 
+	// the map is drawn at the size of the surface where the display scales
+	// it up, or at a fraction of the screen for the upscale pass
+	if (display_upscale)
+	{
+		EGLint width, height;
+		eglQuerySurface(state->display, state->surface, EGL_WIDTH, &width);
+		eglQuerySurface(state->display, state->surface, EGL_HEIGHT, &height);
+		state->render_width = width;
+		state->render_height = height;
+	}
+	else
+	{
+		state->render_width = scaled_size(state->screen_width, state->render_scale);
+		state->render_height = scaled_size(state->screen_height, state->render_scale);
+	}
+	if (state->verbose && state->render_scale < 1)
+		printf("Render size: %u x %u, scaled up to %u x %u by the %s\n",
+			state->render_width, state->render_height, state->screen_width, state->screen_height,
+			display_upscale ? "display" : "GPU");
+
 	// connect the context to the surface
 	result = eglMakeCurrent(state->display, state->surface,
 		state->surface, state->context);
@@ -220,461 +284,1199 @@ static void init_ogl()
 }
 
 
-static void init_shaders()
+static void set_map_program(SHADER_MAP_T format)
 {
-	static const GLfloat vertex_data[] = {
-		-1.0,-1.0, 1.0, 1.0,
-		 1.0,-1.0, 1.0, 1.0,
-		 1.0, 1.0, 1.0, 1.0,
-		-1.0, 1.0, 1.0, 1.0
-	};
-	const GLchar *vshader_source =
-		"attribute vec4 vertex;"
-		"varying vec2 tcoord;"
-		"void main(void) {"
-		"  gl_Position = vertex;"
-		"  tcoord = vertex.xy*0.5+0.5;"
-		"}";
-
-	// UV Mapping fragment shader, flips source vertically
-	const GLchar *fshader_source =
-		"varying vec2 tcoord;"
-		"uniform sampler2D mapMsb;"
-		"uniform sampler2D mapLsb;"
-		"uniform sampler2D source;"
-		"void main(void) {"
-		"  vec4 uv = texture2D(mapMsb,tcoord) + texture2D(mapLsb,tcoord)/256.;"
-		"  uv.g = 1.0 - uv.g;"
-		"  gl_FragColor.rgb = texture2D(source, uv.xy).rgb;"
-		"  gl_FragColor.a = uv.a;"
-		"}";
-
-	GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vshader, 1, &vshader_source, 0);
-	glCompileShader(vshader);
+	state->map_format = format;
+	state->program = shader_uvmap_program(format, state->verbose);
 	checkgl();
 
-	if (state->verbose)
-		 show_shaderlog(vshader);
-
-	GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fshader, 1, &fshader_source, 0);
-	glCompileShader(fshader);
-	checkgl();
-
-	if (state->verbose)
-		 show_shaderlog(fshader);
-
-	state->program = glCreateProgram();
-	glAttachShader(state->program, vshader);
-	glAttachShader(state->program, fshader);
-	glLinkProgram(state->program);
-	checkgl();
-
-	if (state->verbose)
-		 show_programlog(state->program);
-
 	state->attrib_vertex  = glGetAttribLocation(state->program, "vertex");
-	state->uniform_mapMsb = glGetUniformLocation(state->program, "mapMsb");
-	state->uniform_mapLsb = glGetUniformLocation(state->program, "mapLsb");
+	state->uniform_map[0] = glGetUniformLocation(state->program,
+		format == SHADER_MAP_SPLIT ? "mapMsb" : "map");
+	state->uniform_map[1] = glGetUniformLocation(state->program,
+		format == SHADER_MAP_SPLIT ? "mapLsb" : "mapAlpha");
 	state->uniform_source = glGetUniformLocation(state->program, "source");
+	shader_source_rect(state->program, state->source_rect[0], state->source_rect[1],
+		state->source_rect[2], state->source_rect[3]);
 	checkgl();
+}
 
-	glClearColor ( 0.0, 0.0, 0.0, 1.0 );
+static void upload_vertices(const GLfloat* vertex_data, int mesh_count, int vertex_count)
+{
+	state->mesh_count = mesh_count;
+	state->vertex_count = vertex_count;
+	glBindBuffer(GL_ARRAY_BUFFER, state->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, (mesh_count + vertex_count) * 4 * sizeof(GLfloat),
+								vertex_data, GL_STATIC_DRAW);
+	checkgl();
+}
+
+static void init_shaders()
+{
+	// transparent, like the pixels the shader draws with zero map alpha, so
+	// skipping empty tiles doesn't change the output
+	glClearColor ( 0.0, 0.0, 0.0, 0.0 );
 
 	glGenBuffers(1, &state->vertex_buffer);
 	checkgl();
 
 	// Prepare viewport
-	glViewport (0, 0, state->screen_width, state->screen_height);
+	glViewport (0, 0, state->render_width, state->render_height);
 	checkgl();
 
-	// Upload vertex data to a buffer
-	glBindBuffer(GL_ARRAY_BUFFER, state->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data),
-								vertex_data, GL_STATIC_DRAW);
-	glVertexAttribPointer(state->attrib_vertex, 4, GL_FLOAT, 0, 16, 0);
-	glEnableVertexAttribArray(state->attrib_vertex);
-	checkgl();
+	// the map program follows the map, see swap_in_map
+	if (state->mesh)
+	{
+		state->mesh_program = shader_mesh_program(state->verbose);
+		state->attrib_mesh_vertex = glGetAttribLocation(state->mesh_program, "vertex");
+		state->uniform_mesh_source = glGetUniformLocation(state->mesh_program, "source");
+		shader_source_rect(state->mesh_program, state->source_rect[0], state->source_rect[1],
+			state->source_rect[2], state->source_rect[3]);
+		checkgl();
+	}
 }
 
 
-static int load_map(const char * file_name)
+// The framebuffer the map is drawn into at the reduced size, and the pass
+// that scales it up to the screen
+static int init_upscale(void)
 {
-	png_byte header[8];
+	static const GLfloat quad[] = {
+		-1.0,-1.0, 1.0, 1.0,
+		 1.0,-1.0, 1.0, 1.0,
+		 1.0, 1.0, 1.0, 1.0,
+		-1.0, 1.0, 1.0, 1.0
+	};
 
-	if (state->verbose)
-		printf("Loading map\n");		
-	
-	FILE *fp = fopen(file_name, "rb");
-	if (fp == 0)
+	glGenTextures(1, &state->render_texture);
+	glBindTexture(GL_TEXTURE_2D, state->render_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, state->render_width, state->render_height, 0,
+					 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenFramebuffers(1, &state->render_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, state->render_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+								  state->render_texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 	{
-		perror(file_name);
+		printf("error: render framebuffer is incomplete.\n");
 		return -1;
 	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	state->upscale_program = shader_upscale_program(state->verbose);
+	state->attrib_upscale_vertex = glGetAttribLocation(state->upscale_program, "vertex");
+	state->uniform_upscale_source = glGetUniformLocation(state->upscale_program, "source");
+	glGenBuffers(1, &state->upscale_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, state->upscale_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	checkgl();
+	return 0;
+}
 
-	// read the header
-	fread(header, 1, 8, fp);
-
-	if (png_sig_cmp(header, 0, 8))
+static int make_video_texture(int video_width, int video_height)
+{
+	// setup texture for video
+	int image_size = video_width * video_height * 4;
+	GLubyte* image_buffer = malloc(image_size);
+	if (image_buffer == 0)
 	{
-		printf("error: %s is not a PNG.\n", file_name);
-		fclose(fp);
+		printf("error: could not allocate memory for video buffer.\n");
 		return -1;
 	}
 
-	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (!png_ptr)
-	{
-		printf("error: png_create_read_struct returned 0.\n");
-		fclose(fp);
+	memset(image_buffer, 0x00, image_size);  // black transparant
+
+	glBindTexture(GL_TEXTURE_2D, state->texture[2]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, video_width, video_height, 0,
+					 GL_RGBA, GL_UNSIGNED_BYTE, image_buffer);
+
+	free(image_buffer);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	
+	// hand the texture to the decoder
+	state->video_target = 0;
+	if (video_attach_texture(state->display, state->context, state->texture[2],
+			video_width, video_height, &state->video_target) < 0)
 		return -1;
-	}
 
-	// create png info struct
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-	{
-		printf("error: png_create_info_struct returned 0.\n");
-		png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-		fclose(fp);
+	if (state->verbose)
+		printf("Video texture attached = %p\n", state->video_target);
+		
+	return 0;
+}
+
+// Round up to a multiple of 16, the block size of the Pi's video pipeline
+static int align_block(int size)
+{
+	return (size + 15) & ~15;
+}
+
+// Crop the source to the part of the frame the map samples, starting on
+// even pixels so that it starts on a whole chroma sample, and scale it down
+// as far as the map never steps by less than a texel of the result
+static void choose_crop(const MAP_BOUNDS_T* bounds)
+{
+	int width = state->video_width, height = state->video_height;
+	VIDEO_CROP_T* crop = &state->video_crop;
+
+	state->texture_width = width;
+	state->texture_height = height;
+	if (bounds->empty)
+		return;
+
+	int left = ((int)floorf(bounds->left * width) - CROP_MARGIN) & ~1;
+	int top = ((int)floorf(bounds->top * height) - CROP_MARGIN) & ~1;
+	int right = (int)ceilf(bounds->right * width) + CROP_MARGIN;
+	int bottom = (int)ceilf(bounds->bottom * height) + CROP_MARGIN;
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	crop->left = left;
+	crop->top = top;
+	crop->width = ((right > width ? width : right) - left + 1) & ~1;
+	crop->height = ((bottom > height ? height : bottom) - top + 1) & ~1;
+	if (crop->width > width - left)
+		crop->width = width - left;
+	if (crop->height > height - top)
+		crop->height = height - top;
+
+	// source pixels per step of the map; where it steps by less, every
+	// pixel of the crop can be sampled
+	float scale_x = bounds->step_s * width, scale_y = bounds->step_t * height;
+	state->texture_width = crop->width;
+	state->texture_height = crop->height;
+	if (scale_x > 1 && align_block((int)ceilf(crop->width / scale_x)) < crop->width)
+		state->texture_width = align_block((int)ceilf(crop->width / scale_x));
+	if (scale_y > 1 && align_block((int)ceilf(crop->height / scale_y)) < crop->height)
+		state->texture_height = align_block((int)ceilf(crop->height / scale_y));
+
+	state->source_rect[0] = (float)crop->left / width;
+	state->source_rect[1] = (float)crop->top / height;
+	state->source_rect[2] = (float)crop->width / width;
+	state->source_rect[3] = (float)crop->height / height;
+
+	if (state->verbose)
+		printf("Crop: %d x %d at %d, %d, scaled to %d x %d, %.0f%% of the frame\n",
+			crop->width, crop->height, crop->left, crop->top,
+			state->texture_width, state->texture_height,
+			100.0 * state->texture_width * state->texture_height / ((double)width * height));
+
+	// the whole frame at full size needs no cropping
+	if (crop->width == width && crop->height == height &&
+		state->texture_width == width && state->texture_height == height)
+		memset(crop, 0, sizeof(*crop));
+}
+
+static int init_output(const char *output_filename)
+{
+	int i;
+
+	state->output = output_open(output_filename, state->screen_width, state->screen_height,
+		state->video_fps);
+	if (state->output == NULL)
 		return -1;
-	}
 
-	// create png info struct
-	png_infop end_info = png_create_info_struct(png_ptr);
-	if (!end_info)
+	glGenTextures(2, state->output_texture);
+	glGenFramebuffers(2, state->output_fbo);
+	for (i = 0; i < 2; i++)
 	{
-		printf("error: png_create_info_struct returned 0.\n");
-		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
-		fclose(fp);
-		return -1;
+		glBindTexture(GL_TEXTURE_2D, state->output_texture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, state->screen_width, state->screen_height, 0,
+						 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, state->output_fbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+									  state->output_texture[i], 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("error: output framebuffer is incomplete.\n");
+			return -1;
+		}
+		checkgl();
 	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	// the code in this if statement gets called if libpng encounters an error
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		printf("error from libpng\n");
-		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-		fclose(fp);
-		return -1;
+	return 0;
+}
+
+static void start_rendering(char *video_filename, bool loop, bool batch)
+{
+	// the decoder thread copies this, but it has to outlive pthread_create
+	VIDEO_INFO* video_info = &state->video_info;
+	memset( video_info, 0, sizeof( *video_info ) );
+	video_info->filename = video_filename;
+	video_info->loop = loop;
+	video_info->batch = batch;
+	video_info->target = state->video_target;
+	video_info->readahead = state->readahead;
+	video_info->start = state->start;
+	video_info->end = state->end;
+	video_info->crop = state->video_crop;
+	video_info->verbose = state->verbose;
+	
+	// Start rendering
+	pthread_create(&state->video_thread, NULL, video_decode, video_info);	
+
+	if (state->verbose)
+		printf("Video thread created\n");
+}
+
+static void draw_triangles(GLuint framebuffer)
+{
+	// Upload the new frame if the decoder doesn't render into the texture,
+	// or pick the texture it rendered the latest frame into
+	GLuint source = video_update_texture();
+
+	// Render to the main frame buffer, or an output framebuffer
+	GL(glBindFramebuffer(GL_FRAMEBUFFER,framebuffer));
+
+	// Clear the background
+	GL(glClear(GL_COLOR_BUFFER_BIT));
+
+	GL(glBindBuffer(GL_ARRAY_BUFFER, state->vertex_buffer));
+	GL(glActiveTexture(GL_TEXTURE0));
+	GL(glBindTexture(GL_TEXTURE_2D,state->texture[0]));
+	GL(glActiveTexture(GL_TEXTURE1));
+	GL(glBindTexture(GL_TEXTURE_2D,state->texture[1]));
+	GL(glActiveTexture(GL_TEXTURE2));
+	GL(glBindTexture(GL_TEXTURE_2D,source));
+
+	if (state->mesh_count > 0)
+	{
+		GL(glUseProgram ( state->mesh_program ));
+		GL(glVertexAttribPointer(state->attrib_mesh_vertex, 4, GL_FLOAT, 0, 16, 0));
+		GL(glEnableVertexAttribArray(state->attrib_mesh_vertex));
+		GL(glUniform1i(state->uniform_mesh_source, 2));
+
+		GL(glDrawArrays ( GL_TRIANGLES, 0, state->mesh_count ));
 	}
 
-	// init png reading
-	png_init_io(png_ptr, fp);
+	GL(glUseProgram ( state->program ));
+	GL(glVertexAttribPointer(state->attrib_vertex, 4, GL_FLOAT, 0, 16,
+		(void*)(state->mesh_count * 4 * sizeof(GLfloat))));
+	GL(glEnableVertexAttribArray(state->attrib_vertex));
+
+	GL(glUniform1i(state->uniform_map[0], 0));
+	GL(glUniform1i(state->uniform_map[1], 1));
+	GL(glUniform1i(state->uniform_source, 2));
 
-	// let libpng know you already read the first 8 bytes
-	png_set_sig_bytes(png_ptr, 8);
+	GL(glDrawArrays ( GL_TRIANGLES, 0, state->vertex_count ));
 
-	// read all the info up to the image data
-	png_read_info(png_ptr, info_ptr);
+	GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+// Apply the map on the CPU: read the frame back, remap it on every core and
+// upload the result into render_texture
+static void remap_frame_cpu(void)
+{
+	GLuint source = video_update_texture();
 
-	// variables to pass to get info
-	int bit_depth, color_type;
-	png_uint_32 temp_width, temp_height;
+	GL(glBindFramebuffer(GL_FRAMEBUFFER, state->source_fbo));
+	GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0));
+	GL(glReadPixels(0, 0, state->video_width, state->video_height,
+					 GL_RGBA, GL_UNSIGNED_BYTE, state->cpu_source));
 
-	// get info about png
-	png_get_IHDR(png_ptr, info_ptr, &temp_width, &temp_height, &bit_depth, &color_type,
-		NULL, NULL, NULL);
-		
-	if(bit_depth!=16)
+	remap_frame_parallel(&state->remap, state->workers, state->cpu_source, state->cpu_output);
+
+	GL(glActiveTexture(GL_TEXTURE0));
+	GL(glBindTexture(GL_TEXTURE_2D, state->render_texture));
+	GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, state->render_width, state->render_height,
+					 GL_RGBA, GL_UNSIGNED_BYTE, state->cpu_output));
+}
+
+// Draw the map, at the reduced size into render_fbo first if the GPU scales
+// it up to the screen, or on the CPU into render_texture
+static void draw_frame(GLuint framebuffer)
+{
+	if (state->cpu_remap)
+		remap_frame_cpu();
+	else if (state->render_fbo == 0)
 	{
-		printf("error: expected 16 bit per channel map\n");
-		return -1;
+		draw_triangles(framebuffer);
+		return;
 	}
-	if(color_type!=PNG_COLOR_TYPE_RGB_ALPHA)
+	else
 	{
-		printf("error: expected RGBA map\n");
-		return -1;
+		GL(glViewport(0, 0, state->render_width, state->render_height));
+		draw_triangles(state->render_fbo);
 	}
 
-	// Update the png info struct.
-	png_read_update_info(png_ptr, info_ptr);
+	GL(glViewport(0, 0, state->screen_width, state->screen_height));
+	GL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+	GL(glBindBuffer(GL_ARRAY_BUFFER, state->upscale_buffer));
+	GL(glActiveTexture(GL_TEXTURE0));
+	GL(glBindTexture(GL_TEXTURE_2D, state->render_texture));
+	GL(glUseProgram(state->upscale_program));
+	GL(glVertexAttribPointer(state->attrib_upscale_vertex, 4, GL_FLOAT, 0, 16, 0));
+	GL(glEnableVertexAttribArray(state->attrib_upscale_vertex));
+	GL(glUniform1i(state->uniform_upscale_source, 0));
+	GL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+	GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
 
-	// Row size in bytes.
-	int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+// Wait for the oldest frame in flight, and hand the textures it read back
+static void retire_frame(void)
+{
+	fence_wait(state->display, state->fences[0]);
+	stats_gpu_done(state->fence_frames[0]);
+	state->fence_count--;
+	memmove(state->fences, state->fences + 1, state->fence_count * sizeof(FENCE_T));
+	memmove(state->fence_frames, state->fence_frames + 1, state->fence_count * sizeof(uint32_t));
+	video_release_texture();
+}
 
-	// glTexImage2d requires rows to be 4-byte aligned
-	rowbytes += 3 - ((rowbytes-1) % 4);
+static void present_frame(uint32_t seq)
+{
+	FENCE_T fence = state->pipelined ? fence_insert(state->display) : NULL;
 
-	// Allocate the image_data as a big block, to be given to opengl
-	png_byte * image_data;
-	image_data = malloc(rowbytes * temp_height * sizeof(png_byte)+15);
-	if (image_data == NULL)
+	if (fence != NULL)
 	{
-		printf("error: could not allocate memory for PNG image data\n");
-		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-		fclose(fp);
-		return -1;
+		// the GPU carries on drawing while the CPU swaps and waits for the
+		// next frame; if it is done already the frame counts as finished
+		// before the swap, otherwise only once its fence is waited on
+		state->fences[state->fence_count] = fence;
+		state->fence_frames[state->fence_count++] = seq;
+		if (fence_signalled(state->display, fence))
+			stats_mark(STATS_FINISH);
+	}
+	else
+	{
+		while (state->fence_count > 0)
+			retire_frame();
+		GL(glFlush());
+		GL(glFinish());
+		stats_mark(STATS_FINISH);
+		video_release_texture();
 	}
 
-	// row_pointers is for pointing to image_data for reading the png with libpng
-	png_bytep * row_pointers = malloc(temp_height * sizeof(png_bytep));
-	if (row_pointers == NULL)
+	GL(eglSwapBuffers(state->display, state->surface));
+	stats_mark(STATS_SWAP_DONE);
+
+	while (state->fence_count >= FRAMES_IN_FLIGHT)
+		retire_frame();
+}
+
+// rows of a reloaded map uploaded after each frame, so that the upload
+// doesn't make the next frame late
+#define RELOAD_ROWS_PER_FRAME 64
+
+// A map is uploaded into reload_texture, then swapped in: at startup as it
+// is streamed, while playing a few rows of a prepared map per frame
+static void make_map_textures(SHADER_MAP_T map_format, int width, int height)
+{
+	int i;
+
+	glGenTextures(2, state->reload_texture);
+	for (i = 0; i < 2; i++)
 	{
-		printf("error: could not allocate memory for PNG row pointers\n");
-		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-		free(image_data);
-		fclose(fp);
-		return -1;
+		GLenum format = i == 1 && map_format != SHADER_MAP_SPLIT ? GL_ALPHA : GL_RGBA;
+		// binary alpha needs no alpha texture
+		bool used = i == 0 || map_format != SHADER_MAP_PACKED_BINARY;
+
+		glBindTexture(GL_TEXTURE_2D, state->reload_texture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, used ? width : 1, used ? height : 1, 0, format,
+			GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		checkgl();
 	}
+}
+
+static void begin_map_upload(RELOAD_MAP_T* map)
+{
+	state->reload_map = map;
+	state->reload_row = 0;
+	make_map_textures(map->format, map->width, map->height);
+}
 
-	// set the individual row_pointers to point at the correct offsets of image_data
+static void upload_map_rows(int max_rows)
+{
+	RELOAD_MAP_T* map = state->reload_map;
+	int rows = map->height - state->reload_row;
 	int i;
-	for (i = 0; i < temp_height; i++)
+
+	if (rows > max_rows)
+		rows = max_rows;
+
+	for (i = 0; i < 2; i++)
 	{
-		row_pointers[temp_height - 1 - i] = image_data + i * rowbytes;
+		if (map->texels[i] == NULL)
+			continue;
+		GLenum format = i == 1 && map->format != SHADER_MAP_SPLIT ? GL_ALPHA : GL_RGBA;
+		size_t texel_size = format == GL_ALPHA ? 1 : 4;
+
+		GL(glBindTexture(GL_TEXTURE_2D, state->reload_texture[i]));
+		GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, state->reload_row, map->width, rows, format,
+			GL_UNSIGNED_BYTE, map->texels[i] + (size_t)state->reload_row * map->width * texel_size));
 	}
+	state->reload_row += rows;
+}
 
+// Replace the map once the new one is completely uploaded; the frames
+// before that keep using the old textures
+static void swap_in_map(void)
+{
+	RELOAD_MAP_T* map = state->reload_map;
 
-	if (state->verbose)
-		printf("Splitting map\n");	
+	glDeleteTextures(2, state->texture);
+	state->texture[0] = state->reload_texture[0];
+	state->texture[1] = state->reload_texture[1];
 
-	// read the png into image_data through row_pointers
-	png_read_image(png_ptr, row_pointers);
-	
-	// split 16 image into two 8 bit imagebuffers
-	int map_sz = rowbytes * temp_height / 2;
-	char* texture_buffer1 = malloc(map_sz);
-	char* texture_buffer2 = malloc(map_sz);
+	// the decoder keeps the crop it started with
+	if (state->video_crop.width > 0 && !map->bounds.empty &&
+		(map->bounds.left < state->source_rect[0] ||
+		 map->bounds.top < state->source_rect[1] ||
+		 map->bounds.right > state->source_rect[0] + state->source_rect[2] ||
+		 map->bounds.bottom > state->source_rect[1] + state->source_rect[3]))
+		printf("warning: the map samples outside the cropped source, restart to see all of it\n");
 
-	for(i = 0; i < map_sz; i++)
+	if (state->program == 0 || map->format != state->map_format)
 	{
-		texture_buffer1[i] = image_data[2*i];
-		texture_buffer2[i] = image_data[2*i+1];
+		if (state->program != 0)
+			glDeleteProgram(state->program);
+		set_map_program(map->format);
 	}
+	upload_vertices(map->vertices, map->mesh_count, map->pixel_count);
 
-	// first texture (map msb)
-	glBindTexture(GL_TEXTURE_2D, state->texture[0]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, temp_width, temp_height, 0,
-					 GL_RGBA, GL_UNSIGNED_BYTE, texture_buffer1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	checkgl();
+	if (state->verbose)
+		printf("Map: %d x %d, %s format, %d interpolated quads, %d per pixel quads\n",
+			map->width, map->height, map->format == SHADER_MAP_SPLIT ? "split" :
+			map->format == SHADER_MAP_PACKED ? "packed" : "packed binary alpha",
+			map->mesh_count / 6, map->pixel_count / 6);
 
-	// second texture (map lsb)
-	glBindTexture(GL_TEXTURE_2D, state->texture[1]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, temp_width, temp_height, 0,
-					 GL_RGBA, GL_UNSIGNED_BYTE, texture_buffer2);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	checkgl();
-	
-	// release texture buffers
-	free(texture_buffer1);
-	free(texture_buffer2);	
-	
-	// clean up
-	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-	free(image_data);
-	free(row_pointers);
-	fclose(fp);
-	
-	return 0;
+	reload_map_free(map);
+	state->reload_map = NULL;
 }
 
-
-static int make_video_texture(int video_width, int video_height)
+// Called between frames: pick up a changed map and upload part of it
+static void update_map_reload(void)
 {
-	// setup texture for video
-	int image_size = video_width * video_height * 4;
-	GLubyte* image_buffer = malloc(image_size);
-	if (image_buffer == 0)
+	if (state->reload_map == NULL)
 	{
-		printf("error: could not allocate memory for video buffer.\n");
-		return -1;
+		RELOAD_MAP_T* map = reload_take(state->reload);
+		if (map == NULL)
+			return;
+		begin_map_upload(map);
 	}
 
-	memset(image_buffer, 0x00, image_size);  // black transparant
+	upload_map_rows(RELOAD_ROWS_PER_FRAME);
+	if (state->reload_row >= state->reload_map->height)
+		swap_in_map();
+}
 
-	glBindTexture(GL_TEXTURE_2D, state->texture[2]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, video_width, video_height, 0,
-					 GL_RGBA, GL_UNSIGNED_BYTE, image_buffer);
+static void read_output(GLuint framebuffer)
+{
+	uint8_t* buffer = output_get_buffer(state->output);
 
-	free(image_buffer);
+	GL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+	GL(glReadPixels(0, 0, state->screen_width, state->screen_height,
+					 GL_RGBA, GL_UNSIGNED_BYTE, buffer));
+	output_submit(state->output);
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	
-	// Create EGL Image
-	state->egl_image = 0;
-	state->egl_image = eglCreateImageKHR(
-					 state->display,
-					 state->context,
-					 EGL_GL_TEXTURE_2D_KHR,
-					 (EGLClientBuffer)state->texture[2],
-					 0);
-	 
-	if (state->egl_image == EGL_NO_IMAGE_KHR)
-	{
-		printf("error: eglCreateImageKHR failed.\n");
+// Draw frame n into the output ring and read back frame n-1 meanwhile; the
+// I/O thread converts and writes it while the next frame is decoded
+static void output_frame(uint32_t n)
+{
+	draw_frame(state->output_fbo[n % 2]);
+	GL(glFlush());
+
+	if (n > 0)
+		read_output(state->output_fbo[(n - 1) % 2]);
+
+	GL(glFinish());
+	stats_mark(STATS_FINISH);
+	video_release_texture();
+	stats_mark(STATS_SWAP_DONE);
+}
+
+// Called from the decoder thread when a new frame is available
+void set_frame_available()
+{
+	pthread_mutex_lock(&state->frame_lock);
+	state->frame_seq++;
+	stats_frame_decoded(state->frame_seq);
+	pthread_cond_signal(&state->frame_cond);
+	pthread_mutex_unlock(&state->frame_lock);
+}
+
+void set_status(int status)
+{
+	pthread_mutex_lock(&state->frame_lock);
+	state->status = status;
+	pthread_cond_signal(&state->frame_cond);
+	pthread_mutex_unlock(&state->frame_lock);
+}
+
+// Sleep until a frame newer than *seq has arrived or playback has stopped.
+// Returns the number of frames since *seq (more than 1 if frames were
+// coalesced), or 0 when playback stopped and every frame has been seen.
+static uint32_t wait_for_frame(uint32_t *seq)
+{
+	uint32_t frames = 0;
+
+	pthread_mutex_lock(&state->frame_lock);
+	while (state->status == 0 && state->frame_seq == *seq)
+		pthread_cond_wait(&state->frame_cond, &state->frame_lock);
+
+	// a frame that arrived before playback stopped is still drawn
+	frames = state->frame_seq - *seq;
+	*seq = state->frame_seq;
+	pthread_mutex_unlock(&state->frame_lock);
+
+	return frames;
+}
+
+static void cleanup(void)
+// Clean up resources
+{
+	pthread_cancel(state->video_thread);
+
+	if (state->video_target != 0)
+		video_detach_texture(state->display, state->video_target);
+
+	if (state->workers != NULL)
+		workers_destroy(state->workers);
+	remap_free(&state->remap);
+	free(state->cpu_source);
+	free(state->cpu_output);
+
+	// clear screen
+	glClear( GL_COLOR_BUFFER_BIT );
+	eglSwapBuffers(state->display, state->surface);
+
+	// Release OpenGL resources
+	eglMakeCurrent( state->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	platform_destroy_surface( state->display, state->surface );
+	eglDestroyContext( state->display, state->context );
+	eglTerminate( state->display );
+
+	if (state->stats || state->verbose)
+		stats_print();
+	gldebug_print();
+
+	if (state->verbose)
+		printf("App closed\n");
+}
+
+// At startup the map is streamed from the worker that decodes and packs it
+// to the GL thread, which uploads it a band at a time; only the bands in
+// between are held, in a few slots
+#define MAP_QUEUE_SLOTS 4
+
+typedef struct
+{
+	int y, rows;
+	uint8_t* texels[2];
+} MAP_QUEUE_SLOT_T;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	MAP_QUEUE_SLOT_T slots[MAP_QUEUE_SLOTS];
+	int head, count;          // oldest band queued, and how many are
+	int width, height;        // of the map, set with the first band
+	SHADER_MAP_T format;
+	bool closed;              // no more bands: the map is prepared, or
+	RELOAD_MAP_T* map;        // NULL if that failed
+	bool cancelled;           // the GL thread takes no more bands
+} MAP_QUEUE_T;
+
+// Worker: copy a band into a free slot, once there is one
+static int queue_map_band(void* arg, const RELOAD_BAND_T* band)
+{
+	MAP_QUEUE_T* queue = arg;
+	MAP_QUEUE_SLOT_T* slot;
+	bool cancelled;
+	int i;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == MAP_QUEUE_SLOTS && !queue->cancelled)
+		pthread_cond_wait(&queue->changed, &queue->lock);
+	cancelled = queue->cancelled;
+	slot = &queue->slots[(queue->head + queue->count) % MAP_QUEUE_SLOTS];
+	pthread_mutex_unlock(&queue->lock);
+	if (cancelled)
 		return -1;
+
+	for (i = 0; i < 2; i++)
+	{
+		size_t row_size = (size_t)band->width * (i == 1 && band->format != SHADER_MAP_SPLIT ? 1 : 4);
+
+		// slots are allocated when first used, for the largest band
+		if (slot->texels[i] == NULL)
+			slot->texels[i] = malloc(row_size * MAP_BAND_ROWS);
+		if (slot->texels[i] == NULL)
+		{
+			printf("error: could not allocate memory for the map.\n");
+			return -1;
+		}
+		memcpy(slot->texels[i], band->texels[i], row_size * band->rows);
 	}
+	slot->y = band->y;
+	slot->rows = band->rows;
 
-	if (state->verbose)
-		printf("EGL image created = %x\n", (uint)state->egl_image);
-		
+	pthread_mutex_lock(&queue->lock);
+	if (queue->width == 0)
+	{
+		queue->width = band->width;
+		queue->height = band->height;
+		queue->format = band->format;
+	}
+	queue->count++;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
 	return 0;
 }
 
-static void init_textures(char *map_filename, char *video_filename)
+// Worker: no more bands, map is the prepared map or NULL
+static void close_map_queue(MAP_QUEUE_T* queue, RELOAD_MAP_T* map)
 {
-	if(load_map(map_filename)<0)
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = true;
+	queue->map = map;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// GL thread: take no more bands, so the worker doesn't wait for a slot
+static void cancel_map_queue(MAP_QUEUE_T* queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->cancelled = true;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static void free_map_queue(MAP_QUEUE_T* queue)
+{
+	int i;
+
+	for (i = 0; i < MAP_QUEUE_SLOTS; i++)
 	{
-		exit(-1);
+		free(queue->slots[i].texels[0]);
+		free(queue->slots[i].texels[1]);
 	}
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+}
+
+// Startup runs as a task graph, so that decoding the map, probing the
+// movie and setting up GL and the decoder overlap
+typedef struct
+{
+	char* map_filename;
+	char* video_filename;
+	bool split_map;
+	bool loop;
+	char* output_filename;
 
-	int frame_width, frame_height;
-	if(video_decode_dimensions(video_filename, &frame_width, &frame_height)<0)
+	MAP_T map;                // open for --crop and --cpu-remap only
+	MAP_BOUNDS_T bounds;
+	MAP_QUEUE_T queue;
+} STARTUP_T;
+
+enum
+{
+	STARTUP_GL,
+	STARTUP_PROBE,
+	STARTUP_MAP,
+	STARTUP_VIDEO_TEXTURE,
+	STARTUP_DECODER,
+	STARTUP_SHADERS,
+	STARTUP_OUTPUT,
+	STARTUP_PREPARE,
+	STARTUP_UPLOAD,
+	STARTUP_TASKS
+};
+
+static int startup_gl(void* arg)
+{
+	STARTUP_T* startup = arg;
+
+	init_ogl();
+	state->pipelined = !state->finish && fence_init(state->display);
+	if (state->verbose)
+		printf("Present: %s\n", state->pipelined ? "pipelined, with fences" : "glFinish every frame");
+	// one map fetch per pixel instead of two where the precision allows
+	state->map_format = !startup->split_map && !state->cpu_remap && shader_packed_supported() ?
+		SHADER_MAP_PACKED : SHADER_MAP_SPLIT;
+	// interpolated coordinates need the same precision
+	state->mesh = state->mesh_error > 0 && !state->cpu_remap && shader_packed_supported();
+	return 0;
+}
+
+static int startup_probe(void* arg)
+{
+	STARTUP_T* startup = arg;
+
+	if (video_decode_dimensions(startup->video_filename, &state->video_width, &state->video_height,
+			&state->video_fps) < 0)
 	{
 		printf("error: could not get video dimensions.\n");
-		exit(-1);		
+		return -1;
 	}
 	if (state->verbose)
-		printf("Video dimensions: %d x %d\n", frame_width, frame_height);
-		
-	if(make_video_texture(frame_width, frame_height)<0)
-	{
-		exit(-1);
-	}
+		printf("Video dimensions: %d x %d, %.3f fps\n", state->video_width, state->video_height,
+			state->video_fps);
+	return 0;
 }
 
-static void start_rendering(char *video_filename, bool loop)
+// The crop is chosen from the bounds of the whole map, and the CPU remap
+// keeps the whole map, so for those it is opened in one go: mapped from its
+// cache, which is built first if need be
+static int startup_map(void* arg)
 {
-	VIDEO_INFO video_info;
-	memset( &video_info, 0, sizeof( video_info ) );
-	video_info.filename = video_filename;
-	video_info.loop = loop;
-	video_info.egl_image = state->egl_image;
-	
-	// Start rendering
-	pthread_create(&state->video_thread, NULL, video_decode, &video_info);	
+	STARTUP_T* startup = arg;
 
+	if (!state->crop && !state->cpu_remap)
+		return 0;
 	if (state->verbose)
-		printf("Video thread created\n");
+		printf("Loading map\n");
+	if (map_open(startup->map_filename, &startup->map, state->verbose) != 0)
+		return -1;
+	if (state->crop)
+		map_bounds(&startup->map, &startup->bounds);
+	return 0;
 }
 
-static void draw_triangles()
+static int startup_video_texture(void* arg)
 {
-	// Render to the main frame buffer
-	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	STARTUP_T* startup = arg;
 
-	// Clear the background
-	glClear(GL_COLOR_BUFFER_BIT);
-	checkgl();
+	state->texture_width = state->video_width;
+	state->texture_height = state->video_height;
+	if (state->crop)
+		choose_crop(&startup->bounds);
+	return make_video_texture(state->texture_width, state->texture_height);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, state->vertex_buffer);
-	checkgl();
-	glUseProgram ( state->program );
-	checkgl();
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D,state->texture[0]);
-	checkgl();
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D,state->texture[1]);
-	checkgl();
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D,state->texture[2]);
-	checkgl();
+static int startup_decoder(void* arg)
+{
+	STARTUP_T* startup = arg;
 
-	glUniform1i(state->uniform_mapMsb, 0);
-	checkgl();
-	glUniform1i(state->uniform_mapLsb, 1);
-	checkgl();
-	glUniform1i(state->uniform_source, 2);
-	checkgl();
+	// the decoder sets itself up while the map is still being prepared
+	start_rendering(startup->video_filename, startup->loop, startup->output_filename != NULL);
+	return 0;
+}
 
-	glDrawArrays ( GL_TRIANGLE_FAN, 0, 4 );
-	checkgl();
+static int startup_shaders(void* arg)
+{
+	(void)arg;
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	init_shaders();
+	if (state->cpu_remap)
+		glGenFramebuffers(1, &state->source_fbo);
+	return (state->render_scale < 1 || state->cpu_remap) && state->gpu_upscale ? init_upscale() : 0;
+}
 
-	glFlush();
-	glFinish();
-	checkgl();
+static int startup_output(void* arg)
+{
+	STARTUP_T* startup = arg;
 
-	eglSwapBuffers(state->display, state->surface);
-	checkgl();
+	return startup->output_filename != NULL ? init_output(startup->output_filename) : 0;
 }
 
-void set_frame_available()
+// The CPU remap and the worker pool it runs on, kept for the whole playback
+static int init_cpu_remap(const MAP_T* map)
 {
-	state->frame_available = 1;
+	state->workers = workers_create(0);
+	if (state->workers == NULL)
+	{
+		printf("error: could not start the remap workers.\n");
+		return -1;
+	}
+
+	if (remap_init(&state->remap, map->msb, map->lsb, map->width, map->height, map->stride,
+			state->video_width, state->video_height, state->render_width, state->render_height) < 0)
+		return -1;
+
+	state->cpu_source = malloc((size_t)state->video_width * state->video_height * 4);
+	state->cpu_output = malloc((size_t)state->render_width * state->render_height * 4);
+	if (state->cpu_source == NULL || state->cpu_output == NULL)
+	{
+		printf("error: could not allocate memory for the CPU remap.\n");
+		return -1;
+	}
+
+	if (state->verbose)
+		printf("CPU remap: %d workers, %s kernel, %d tiles\n", workers_count(state->workers),
+			remap_kernel_name(), state->remap.tile_count);
+	return 0;
 }
 
-void set_status(int status)
+// Pack the map and fit its tiles or mesh band by band, handing the bands
+// to the GL thread as they are done
+static int startup_prepare(void* arg)
 {
-	state->status = status;
+	STARTUP_T* startup = arg;
+	RELOAD_MAP_T* map;
+
+	if (state->cpu_remap)
+	{
+		int result = init_cpu_remap(&startup->map);
+		map_close(&startup->map);
+		return result;
+	}
+
+	if (startup->map.msb == NULL && state->verbose)
+		printf("Loading map\n");
+	map = reload_stream(startup->map.msb != NULL ? &startup->map : NULL, startup->map_filename,
+		state->map_format, state->mesh ? state->mesh_error : 0,
+		state->video_width, state->video_height, queue_map_band, &startup->queue, state->verbose);
+	map_close(&startup->map);
+	if (map != NULL)
+		map->bounds = startup->bounds;
+	close_map_queue(&startup->queue, map);
+	return map != NULL ? 0 : -1;
 }
 
-static void cleanup(void)
-// Clean up resources
+static void startup_prepare_skipped(void* arg)
 {
-	pthread_cancel(state->video_thread);
+	STARTUP_T* startup = arg;
 
-	if (state->egl_image != 0)
+	close_map_queue(&startup->queue, NULL);
+}
+
+// Upload the bands of the map as they arrive, then swap it in
+static int startup_upload(void* arg)
+{
+	STARTUP_T* startup = arg;
+	MAP_QUEUE_T* queue = &startup->queue;
+	RELOAD_MAP_T* map;
+	bool started = false;
+	int i;
+
+	// the CPU remap keeps the map to itself
+	if (state->cpu_remap)
+		return 0;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	pthread_mutex_lock(&queue->lock);
+	for (;;)
 	{
-		if (!eglDestroyImageKHR(state->display, (EGLImageKHR) state->egl_image))
-			printf("eglDestroyImageKHR failed.");
+		while (queue->count == 0 && !queue->closed)
+			pthread_cond_wait(&queue->changed, &queue->lock);
+		if (queue->count == 0)
+			break;
+
+		// the worker leaves the slot alone until it is handed back
+		MAP_QUEUE_SLOT_T* slot = &queue->slots[queue->head];
+		SHADER_MAP_T map_format = queue->format;
+		int width = queue->width, height = queue->height;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (!started)
+			make_map_textures(map_format, width, height);
+		started = true;
+		for (i = 0; i < 2; i++)
+		{
+			GLenum format = i == 1 && map_format != SHADER_MAP_SPLIT ? GL_ALPHA : GL_RGBA;
+
+			GL(glBindTexture(GL_TEXTURE_2D, state->reload_texture[i]));
+			GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, slot->y, width, slot->rows, format,
+				GL_UNSIGNED_BYTE, slot->texels[i]));
+		}
+
+		pthread_mutex_lock(&queue->lock);
+		queue->head = (queue->head + 1) % MAP_QUEUE_SLOTS;
+		queue->count--;
+		pthread_cond_broadcast(&queue->changed);
 	}
+	map = queue->map;
+	pthread_mutex_unlock(&queue->lock);
 
-	// clear screen
-	glClear( GL_COLOR_BUFFER_BIT );
-	eglSwapBuffers(state->display, state->surface);
+	// the worker said why it failed
+	if (map == NULL)
+		return -1;
 
-	// Release OpenGL resources
-	eglMakeCurrent( state->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
-	eglDestroySurface( state->display, state->surface );
-	eglDestroyContext( state->display, state->context );
-	eglTerminate( state->display );
+	// a packed map turned out to have only 0 and 1 alpha
+	if (map->format == SHADER_MAP_PACKED_BINARY)
+	{
+		glBindTexture(GL_TEXTURE_2D, state->reload_texture[1]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, 1, 1, 0, GL_ALPHA, GL_UNSIGNED_BYTE, NULL);
+		checkgl();
+	}
+	state->reload_map = map;
+	swap_in_map();
+	return 0;
+}
 
-	if (state->verbose)
-		printf("App closed\n");
+static void startup_upload_skipped(void* arg)
+{
+	STARTUP_T* startup = arg;
+
+	cancel_map_queue(&startup->queue);
 }
 
 //==============================================================================
 
 int main (int argc, char **argv)
 {
+	double launched = tasks_now();
+
 	// Clear application state
 	memset( state, 0, sizeof( *state ) );
 	state->status = 0;
-	
+	pthread_mutex_init(&state->frame_lock, NULL);
+	pthread_cond_init(&state->frame_cond, NULL);
+
+	// the SIMD kernels are picked once, before the startup tasks and the
+	// reload thread use them
+	deinterleave_select_kernel(NULL);
+	remap_select_kernel(NULL);
+
+	// Convert a map without starting playback
+	if (argc == 4 && (strcmp(argv[1],"-c")==0 || strcmp(argv[1],"--compile") == 0))
+		return map_compile(argv[2], argv[3]) < 0 ? 1 : 0;
+
 	atexit(cleanup);
-	bcm_host_init();
+	platform_init();
 
 	if (argc < 3) {
 		printf("Usage: %s [OPTION] <mapfile> <moviefile>\n", argv[0]);
+		printf("       %s --compile <mapfile.png> <mapfile.uvm>\n", argv[0]);
 		printf("  -l, --loop						Loop playback forever\n");
 		printf("  -v, --verbose						Show debug information\n");
+		printf("  -s, --stats						Print frame latency and throughput statistics\n");
+		printf("  -c, --compile						Convert a PNG map to a precompiled .uvm map\n");
+		printf("  -o, --output <file>					Render every frame to a .y4m, .rgba or %%d.png file as fast as possible\n");
+		printf("      --size <width>x<height>				Render size of the headless build (default 1920x1080)\n");
+		printf("      --split-map					Use the two texture map format even if the packed one is supported\n");
+		printf("      --crop						Decode only the part of the movie the map samples, scaled down if the map never samples it at full resolution\n");
+		printf("      --mesh-error <pixels>				Largest error of interpolated map coordinates, 0 to look up every pixel (default 0.125)\n");
+		printf("      --gl-debug <off|check|trace>			GL error checks, or checks and a profile of the GL calls printed at exit (GL_DEBUG builds)\n");
+		printf("      --render-scale <fraction>				Draw the map at this fraction of the screen size and scale it up (default 1)\n");
+		printf("      --upscale <display|gpu>				Scale up with the display hardware where there is one, or a GPU pass (default display)\n");
+		printf("      --cpu-remap					Apply the map on the CPU, on every core, instead of in a shader; the map isn't reloaded\n");
+		printf("      --finish						Wait for the GPU to finish every frame instead of keeping %d in flight\n", FRAMES_IN_FLIGHT);
+		printf("      --readahead <chunks>				Chunks of 256 KB of the movie the Pi decoder reads ahead (default %d)\n", READAHEAD_DEPTH);
+		printf("      --start <seconds>					Start playing at the keyframe at or before this time\n");
+		printf("      --end <seconds>					Stop playing at the keyframe at or after this time\n");
+		printf("      --loop-range <start>:<end>			Loop between the keyframes around these times\n");
 		exit(1);
 	}
 	
 	bool loop = false;
+	bool split_map = false;
+	state->mesh_error = 0.125f;
+	state->render_scale = 1;
+	state->source_rect[2] = state->source_rect[3] = 1;
+	state->readahead = READAHEAD_DEPTH;
+	char *output_filename = NULL;
 	int c;
 	for(c=1; c<argc-1; c++) {
 		if (strcmp(argv[c],"-l")==0 || strcmp(argv[c],"--loop") == 0)
 			loop = true;
 		if (strcmp(argv[c],"-v")==0 || strcmp(argv[c],"--verbose") == 0)
 			state->verbose = true;
+		if (strcmp(argv[c],"-s")==0 || strcmp(argv[c],"--stats") == 0)
+			state->stats = true;
+		if ((strcmp(argv[c],"-o")==0 || strcmp(argv[c],"--output") == 0) && c+1 < argc-2)
+			output_filename = argv[++c];
+		if (strcmp(argv[c],"--split-map") == 0)
+			split_map = true;
+		if (strcmp(argv[c],"--crop") == 0)
+			state->crop = true;
+		if (strcmp(argv[c],"--finish") == 0)
+			state->finish = true;
+		if (strcmp(argv[c],"--cpu-remap") == 0)
+			state->cpu_remap = true;
+		if (strcmp(argv[c],"--gl-debug") == 0 && c+1 < argc-2)
+		{
+			if (gldebug_set_mode(argv[++c]) < 0)
+			{
+				printf("error: --gl-debug takes off, check or trace, and needs a build with GL_DEBUG=1\n");
+				exit(1);
+			}
+		}
+		if (strcmp(argv[c],"--render-scale") == 0 && c+1 < argc-2)
+			state->render_scale = atof(argv[++c]);
+		if (strcmp(argv[c],"--upscale") == 0 && c+1 < argc-2)
+		{
+			c++;
+			if (strcmp(argv[c],"gpu") != 0 && strcmp(argv[c],"display") != 0)
+			{
+				printf("error: --upscale takes display or gpu\n");
+				exit(1);
+			}
+			state->gpu_upscale = strcmp(argv[c],"gpu") == 0;
+		}
+		if (strcmp(argv[c],"--mesh-error") == 0 && c+1 < argc-2)
+			state->mesh_error = atof(argv[++c]);
+		if (strcmp(argv[c],"--readahead") == 0 && c+1 < argc-2)
+			state->readahead = atoi(argv[++c]);
+		if (strcmp(argv[c],"--start") == 0 && c+1 < argc-2)
+			state->start = atof(argv[++c]);
+		if (strcmp(argv[c],"--end") == 0 && c+1 < argc-2)
+			state->end = atof(argv[++c]);
+		if (strcmp(argv[c],"--loop-range") == 0 && c+1 < argc-2)
+		{
+			if (sscanf(argv[++c], "%lf:%lf", &state->start, &state->end) != 2)
+			{
+				printf("error: --loop-range takes <start>:<end>\n");
+				exit(1);
+			}
+			loop = true;
+		}
+		if (strcmp(argv[c],"--size") == 0 && c+1 < argc-2)
+		{
+			if (sscanf(argv[++c], "%ux%u", &state->screen_width, &state->screen_height) != 2)
+			{
+				printf("error: --size takes <width>x<height>\n");
+				exit(1);
+			}
+		}
 	}
 		
-	// Start OGLES
-	init_ogl();
-	init_textures(argv[argc-2], argv[argc-1]);
-	init_shaders();
-	
-	start_rendering(argv[argc-1], loop);
+	if (state->start < 0 || state->end < 0 || (state->end > 0 && state->end <= state->start))
+	{
+		printf("error: the end of the range has to come after its start\n");
+		exit(1);
+	}
+
+	if (!(state->render_scale > 0 && state->render_scale <= 1))
+	{
+		printf("error: --render-scale takes a fraction above 0 and up to 1\n");
+		exit(1);
+	}
 
-	while (state->status == 0)
+	// the CPU remap reads whole frames and always goes through the
+	// upscale pass to the screen
+	if (state->cpu_remap)
 	{
-		if (state->frame_available)
+		if (state->crop)
+			printf("warning: --crop is ignored with --cpu-remap\n");
+		state->crop = false;
+		state->gpu_upscale = true;
+	}
+
+	// --output is read back at full size, so the GPU scales that up
+	if (state->render_scale < 1 && !state->gpu_upscale &&
+		(output_filename != NULL || !platform_display_scales()))
+	{
+		if (state->verbose)
+			printf("The display can't scale here, scaling up on the GPU\n");
+		state->gpu_upscale = true;
+	}
+
+	if (output_filename != NULL && loop)
+	{
+		printf("warning: --loop is ignored with --output\n");
+		loop = false;
+	}
+
+	// GL tasks run here, in this order as far as their dependencies allow
+	STARTUP_T startup = { argv[argc-2], argv[argc-1], split_map, loop, output_filename };
+	pthread_mutex_init(&startup.queue.lock, NULL);
+	pthread_cond_init(&startup.queue.changed, NULL);
+	TASK_T tasks[STARTUP_TASKS] =
+	{
+		[STARTUP_GL] = { "gl", startup_gl, &startup, true, 0 },
+		[STARTUP_PROBE] = { "probe video", startup_probe, &startup, false, 0 },
+		[STARTUP_MAP] = { "open map", startup_map, &startup, false, 0 },
+		// the crop follows the map, which only needs waiting for with --crop
+		[STARTUP_VIDEO_TEXTURE] = { "video texture", startup_video_texture, &startup, true,
+			TASK_AFTER(STARTUP_GL) | TASK_AFTER(STARTUP_PROBE) |
+			(state->crop ? TASK_AFTER(STARTUP_MAP) : 0) },
+		[STARTUP_DECODER] = { "start decoder", startup_decoder, &startup, true,
+			TASK_AFTER(STARTUP_VIDEO_TEXTURE) },
+		[STARTUP_SHADERS] = { "shaders", startup_shaders, &startup, true,
+			TASK_AFTER(STARTUP_GL) | (state->crop ? TASK_AFTER(STARTUP_VIDEO_TEXTURE) : 0) },
+		[STARTUP_OUTPUT] = { "output", startup_output, &startup, true,
+			TASK_AFTER(STARTUP_GL) | TASK_AFTER(STARTUP_PROBE) },
+		[STARTUP_PREPARE] = { "decode map", startup_prepare, &startup, false,
+			TASK_AFTER(STARTUP_GL) | TASK_AFTER(STARTUP_PROBE) | TASK_AFTER(STARTUP_MAP),
+			startup_prepare_skipped },
+		// takes the map's bands while it is decoded, once the GL thread is
+		// free; the decoder is started first
+		[STARTUP_UPLOAD] = { "upload map", startup_upload, &startup, true,
+			TASK_AFTER(STARTUP_SHADERS) | TASK_AFTER(STARTUP_DECODER) | TASK_AFTER(STARTUP_OUTPUT),
+			startup_upload_skipped },
+	};
+	if (tasks_run(tasks, STARTUP_TASKS) < 0)
+	{
+		if (state->verbose)
+			tasks_print(tasks, STARTUP_TASKS, launched);
+		exit(-1);
+	}
+	if (state->verbose)
+		tasks_print(tasks, STARTUP_TASKS, launched);
+	free_map_queue(&startup.queue);
+
+	if (output_filename == NULL && !state->cpu_remap)
+	{
+		// pick up changes to the map while playing; the packed format may
+		// change between graded and binary alpha with the map
+		state->reload = reload_start(argv[argc-2],
+			state->map_format == SHADER_MAP_SPLIT ? SHADER_MAP_SPLIT : SHADER_MAP_PACKED,
+			state->mesh ? state->mesh_error : 0, state->video_width, state->video_height,
+			state->verbose);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// draw every time a new frame arrives, sleeping in between
+	uint32_t seq = 0, frames, drawn = 0;
+	while ((frames = wait_for_frame(&seq)) > 0)
+	{
+		uint32_t before = drawn;
+		if (state->output != NULL)
 		{
-			state->frame_available = 0;
-			draw_triangles();
+			// batch mode: the decoder keeps every frame, so one is drawn for
+			// each that arrived, also those that queued up meanwhile
+			for (; frames > 0; frames--)
+			{
+				stats_draw_start(seq - frames + 1, 0);
+				output_frame(drawn++);
+			}
 		}
+		else
+		{
+			stats_draw_start(seq, frames - 1);
+			draw_frame(0);
+			present_frame(seq);
+			drawn++;
+			if (state->reload != NULL)
+				update_map_reload();
+		}
+		if (before == 0 && state->verbose)
+			printf("First frame after %.1f ms\n", (tasks_now() - launched) * 1e3);
+
+		if (state->stats)
+			stats_report(STATS_INTERVAL);
+	}
+
+	if (state->output != NULL)
+	{
+		// the last frame is still in the ring
+		if (drawn > 0)
+			read_output(state->output_fbo[(drawn - 1) % 2]);
+		int written = output_close(state->output);
+		state->output = NULL;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+		if (written < 0)
+			return 1;
+		printf("Rendered %d frames to %s in %.2f s (%.1f fps)\n", written, output_filename,
+			elapsed, elapsed > 0 ? written / elapsed : 0);
 	}
 
-	return state->status;
+	return state->status == VIDEO_EOF ? 0 : state->status;
 }
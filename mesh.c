@@ -0,0 +1,278 @@
+// Adaptive mesh approximation of a UV map: smooth parts of the map are
+// drawn as quads with interpolated source coordinates, so the GPU doesn't
+// have to fetch the map for them
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh.h"
+
+// growable list of GL_TRIANGLES vertices
+typedef struct
+{
+	float* data;
+	int count, capacity;      // in vertices
+} MESH_LIST_T;
+
+typedef struct
+{
+	const MESH_MAP_T* map;
+	float max_u, max_v;       // the error bound in 16 bit map units
+	MESH_LIST_T mesh, pixel;
+	int failed;
+} MESH_FIT_T;
+
+typedef enum
+{
+	CELL_EMPTY,               // nothing visible, nothing drawn
+	CELL_PIXEL,               // drawn by the per pixel shader only
+	CELL_MESH,                // at least partly interpolated
+} MESH_CELL_T;
+
+int mesh_init(MESH_MAP_T* map, int width, int height)
+{
+	size_t n = (size_t)width * height;
+
+	map->width = width;
+	map->height = height;
+	map->u = malloc(n * sizeof(uint16_t));
+	map->v = malloc(n * sizeof(uint16_t));
+	map->alpha = malloc(n);
+	if (map->u == NULL || map->v == NULL || map->alpha == NULL)
+	{
+		mesh_free(map);
+		return -1;
+	}
+	return 0;
+}
+
+void mesh_free(MESH_MAP_T* map)
+{
+	free(map->u);
+	free(map->v);
+	free(map->alpha);
+	map->u = map->v = NULL;
+	map->alpha = NULL;
+}
+
+void mesh_add_band(MESH_MAP_T* map, const MAP_BAND_T* band)
+{
+	int x, y;
+
+	for (y = 0; y < band->rows; y++)
+	{
+		const uint8_t* msb = band->msb + (size_t)y * band->stride;
+		const uint8_t* lsb = band->lsb + (size_t)y * band->stride;
+		size_t i = (size_t)(band->y + y) * map->width;
+
+		for (x = 0; x < band->width; x++, i++, msb += 4, lsb += 4)
+		{
+			map->u[i] = msb[0] << 8 | lsb[0];
+			map->v[i] = msb[1] << 8 | lsb[1];
+
+			// classified by the 8 bit alpha the shaders see
+			int alpha = msb[3] + ((lsb[3] + 128) >> 8);
+			map->alpha[i] = alpha == 0 ? MESH_TRANSPARENT :
+				alpha >= 255 ? MESH_OPAQUE : MESH_PARTIAL;
+		}
+	}
+}
+
+static void list_push_quad(MESH_FIT_T* fit, MESH_LIST_T* list, const float corners[4][4])
+{
+	// two triangles, ABC and ACD, for corners A B C D counterclockwise
+	static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+	int i;
+
+	if (list->count + 6 > list->capacity)
+	{
+		int capacity = list->capacity > 0 ? list->capacity * 2 : 6 * 256;
+		float* data = realloc(list->data, (size_t)capacity * 4 * sizeof(float));
+		if (data == NULL)
+		{
+			fit->failed = 1;
+			return;
+		}
+		list->data = data;
+		list->capacity = capacity;
+	}
+
+	for (i = 0; i < 6; i++)
+		memcpy(list->data + (size_t)(list->count + i) * 4, corners[order[i]], 4 * sizeof(float));
+	list->count += 6;
+}
+
+// the corners of cell [x0,x1) x [y0,y1) in clip space, row 0 at the bottom
+static void cell_corners(const MESH_MAP_T* map, int x0, int y0, int x1, int y1,
+	float corners[4][4])
+{
+	float cx0 = 2.0f * x0 / map->width - 1.0f, cx1 = 2.0f * x1 / map->width - 1.0f;
+	float cy0 = 2.0f * y0 / map->height - 1.0f, cy1 = 2.0f * y1 / map->height - 1.0f;
+
+	corners[0][0] = cx0; corners[0][1] = cy0;
+	corners[1][0] = cx1; corners[1][1] = cy0;
+	corners[2][0] = cx1; corners[2][1] = cy1;
+	corners[3][0] = cx0; corners[3][1] = cy1;
+}
+
+static void push_pixel_cell(MESH_FIT_T* fit, int x0, int y0, int x1, int y1)
+{
+	float corners[4][4];
+	int i;
+
+	cell_corners(fit->map, x0, y0, x1, y1, corners);
+	for (i = 0; i < 4; i++)
+		corners[i][2] = corners[i][3] = 1.0f;
+	list_push_quad(fit, &fit->pixel, corners);
+}
+
+// Extrapolate a coordinate plane from the texel centres at the corners of
+// the cell out to the cell edges, giving A B C D counterclockwise from
+// (x0,y0). e is half a texel relative to the distance between the centres.
+static void extrapolate(const uint16_t* plane, int stride, int x0, int y0, int x1, int y1,
+	float values[4])
+{
+	float ex = x1 - x0 > 1 ? 0.5f / (x1 - x0 - 1) : 0;
+	float ey = y1 - y0 > 1 ? 0.5f / (y1 - y0 - 1) : 0;
+	float p00 = plane[(size_t)y0 * stride + x0], p10 = plane[(size_t)y0 * stride + x1 - 1];
+	float p01 = plane[(size_t)(y1 - 1) * stride + x0], p11 = plane[(size_t)(y1 - 1) * stride + x1 - 1];
+
+	// along x on the bottom and top rows, then along y
+	float a0 = (1 + ex) * p00 - ex * p10, a1 = (1 + ex) * p10 - ex * p00;
+	float b0 = (1 + ex) * p01 - ex * p11, b1 = (1 + ex) * p11 - ex * p01;
+
+	values[0] = (1 + ey) * a0 - ey * b0;
+	values[1] = (1 + ey) * a1 - ey * b1;
+	values[2] = (1 + ey) * b1 - ey * a1;
+	values[3] = (1 + ey) * b0 - ey * a0;
+}
+
+// Check that interpolating the corner values across triangles ABC and ACD
+// stays within max of the plane at every texel centre of the cell
+static int plane_fits(const uint16_t* plane, int stride, int x0, int y0, int x1, int y1,
+	const float values[4], float max)
+{
+	float w = x1 - x0, h = y1 - y0;
+	int x, y;
+
+	for (y = y0; y < y1; y++)
+	{
+		const uint16_t* row = plane + (size_t)y * stride;
+		float t = (y + 0.5f - y0) / h;
+
+		for (x = x0; x < x1; x++)
+		{
+			float s = (x + 0.5f - x0) / w;
+			float value = s >= t ?
+				values[0] + s * (values[1] - values[0]) + t * (values[2] - values[1]) :
+				values[0] + s * (values[2] - values[3]) + t * (values[3] - values[0]);
+			if (fabsf(value - row[x]) > max)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int try_mesh_cell(MESH_FIT_T* fit, int x0, int y0, int x1, int y1)
+{
+	const MESH_MAP_T* map = fit->map;
+	float u[4], v[4], corners[4][4];
+	int i;
+
+	extrapolate(map->u, map->width, x0, y0, x1, y1, u);
+	if (!plane_fits(map->u, map->width, x0, y0, x1, y1, u, fit->max_u))
+		return 0;
+	extrapolate(map->v, map->width, x0, y0, x1, y1, v);
+	if (!plane_fits(map->v, map->width, x0, y0, x1, y1, v, fit->max_v))
+		return 0;
+
+	// the shaders flip the source vertically
+	cell_corners(map, x0, y0, x1, y1, corners);
+	for (i = 0; i < 4; i++)
+	{
+		corners[i][2] = u[i] / MAP_PACKED_ONE;
+		corners[i][3] = 1.0f - v[i] / MAP_PACKED_ONE;
+	}
+	list_push_quad(fit, &fit->mesh, corners);
+	return 1;
+}
+
+static MESH_CELL_T fit_cell(MESH_FIT_T* fit, int x0, int y0, int size)
+{
+	const MESH_MAP_T* map = fit->map;
+	int x1 = x0 + size < map->width ? x0 + size : map->width;
+	int y1 = y0 + size < map->height ? y0 + size : map->height;
+	int transparent = 0, opaque = 0;
+	int x, y;
+
+	if (x0 >= map->width || y0 >= map->height)
+		return CELL_EMPTY;
+
+	for (y = y0; y < y1; y++)
+	{
+		const uint8_t* row = map->alpha + (size_t)y * map->width;
+		for (x = x0; x < x1; x++)
+		{
+			transparent += row[x] == MESH_TRANSPARENT;
+			opaque += row[x] == MESH_OPAQUE;
+		}
+	}
+
+	int n = (x1 - x0) * (y1 - y0);
+	if (transparent == n)
+		return CELL_EMPTY;
+	if (opaque == n && try_mesh_cell(fit, x0, y0, x1, y1))
+		return CELL_MESH;
+
+	if (size > MESH_MIN_CELL)
+	{
+		int half = size / 2, pixels = fit->pixel.count;
+		MESH_CELL_T a = fit_cell(fit, x0, y0, half);
+		MESH_CELL_T b = fit_cell(fit, x0 + half, y0, half);
+		MESH_CELL_T c = fit_cell(fit, x0, y0 + half, half);
+		MESH_CELL_T d = fit_cell(fit, x0 + half, y0 + half, half);
+		if (a == CELL_MESH || b == CELL_MESH || c == CELL_MESH || d == CELL_MESH)
+			return CELL_MESH;
+
+		// nothing to interpolate in here, so draw it as one quad
+		fit->pixel.count = pixels;
+	}
+
+	push_pixel_cell(fit, x0, y0, x1, y1);
+	return CELL_PIXEL;
+}
+
+int mesh_vertices(const MESH_MAP_T* map, int source_width, int source_height,
+	float max_error, float** vertices, int* mesh_count, int* pixel_count)
+{
+	MESH_FIT_T fit;
+	int x, y;
+
+	memset(&fit, 0, sizeof(fit));
+	fit.map = map;
+	fit.max_u = max_error * MAP_PACKED_ONE / source_width;
+	fit.max_v = max_error * MAP_PACKED_ONE / source_height;
+
+	for (y = 0; y < map->height; y += MESH_MAX_CELL)
+	{
+		for (x = 0; x < map->width; x += MESH_MAX_CELL)
+			fit_cell(&fit, x, y, MESH_MAX_CELL);
+	}
+
+	float* v = fit.failed ? NULL :
+		malloc(((size_t)fit.mesh.count + fit.pixel.count + 1) * 4 * sizeof(float));
+	if (v != NULL)
+	{
+		memcpy(v, fit.mesh.data, (size_t)fit.mesh.count * 4 * sizeof(float));
+		memcpy(v + (size_t)fit.mesh.count * 4, fit.pixel.data,
+			(size_t)fit.pixel.count * 4 * sizeof(float));
+		*mesh_count = fit.mesh.count;
+		*pixel_count = fit.pixel.count;
+	}
+
+	free(fit.mesh.data);
+	free(fit.pixel.data);
+	*vertices = v;
+	return v != NULL ? 0 : -1;
+}
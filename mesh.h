@@ -0,0 +1,48 @@
+// Adaptive mesh approximation of a UV map: smooth parts of the map are
+// drawn as quads with interpolated source coordinates, so the GPU doesn't
+// have to fetch the map for them
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+
+#include "map.h"
+
+// quadtree cells are split from MESH_MAX_CELL down to MESH_MIN_CELL map
+// texels per side before giving up on interpolation
+#define MESH_MAX_CELL 256
+#define MESH_MIN_CELL 8
+
+// Dense copy of the map, gathered while it loads
+typedef struct
+{
+	int width, height;
+	uint16_t* u;              // 16 bit coordinates, MAP_PACKED_ONE is 1.0
+	uint16_t* v;
+	uint8_t* alpha;           // MESH_TRANSPARENT, MESH_PARTIAL or MESH_OPAQUE
+} MESH_MAP_T;
+
+#define MESH_TRANSPARENT 0
+#define MESH_PARTIAL 1
+#define MESH_OPAQUE 2
+
+int mesh_init(MESH_MAP_T* map, int width, int height);
+void mesh_free(MESH_MAP_T* map);
+
+void mesh_add_band(MESH_MAP_T* map, const MAP_BAND_T* band);
+
+// Fit the map with quads whose corner coordinates, interpolated across
+// their two triangles, are within max_error source pixels of every map
+// texel they cover. Cells that can't be fitted, or aren't fully opaque,
+// are left to the per pixel shader.
+//
+// *vertices gets *mesh_count GL_TRIANGLES vertices of interpolated quads
+// (vec4: clip space position in xy, source texture coordinates in zw),
+// followed by *pixel_count vertices of per pixel quads in the layout of
+// tiles_vertices. Fully transparent areas are left out. *vertices is
+// malloc'ed; returns -1 if out of memory.
+int mesh_vertices(const MESH_MAP_T* map, int source_width, int source_height,
+	float max_error, float** vertices, int* mesh_count, int* pixel_count);
+
+#endif
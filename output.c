@@ -0,0 +1,379 @@
+// Offline batch output: remapped frames read back from the GPU are queued
+// and written to a file by a separate I/O thread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "png.h"
+
+#include "output.h"
+
+// frames that can be queued between readback and the I/O thread
+#define OUTPUT_BUFFERS 4
+
+// for a movie without a frame rate, what the decoders assume as well
+#define OUTPUT_FPS 25
+
+typedef enum
+{
+	OUTPUT_Y4M,
+	OUTPUT_RGBA,
+	OUTPUT_PNG
+} OUTPUT_FORMAT_T;
+
+struct OUTPUT_T
+{
+	OUTPUT_FORMAT_T format;
+	char* filename;
+	FILE* file;
+	int width, height;
+
+	uint8_t* buffer[OUTPUT_BUFFERS];
+	uint8_t* yuv;
+
+	// buffers [tail, head) are queued, the others free for the renderer
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t head, tail;
+	bool closing;
+	bool failed;
+	int written;
+};
+
+static bool has_suffix(const char* name, const char* suffix)
+{
+	size_t n = strlen(name), m = strlen(suffix);
+	return n >= m && strcmp(name + n - m, suffix) == 0;
+}
+
+// A PNG sequence name is used as the printf format for the frame number, so
+// it has to hold a single %d or %0Nd and no other conversion
+static bool is_frame_pattern(const char* name)
+{
+	const char* p = strchr(name, '%');
+
+	if (p == NULL)
+		return false;
+	p++;
+	if (*p == '0')
+	{
+		while (isdigit((unsigned char)*p))
+			p++;
+	}
+	return *p == 'd' && strchr(p, '%') == NULL;
+}
+
+// A frame rate as a fraction for the Y4M header, exact for the NTSC rates
+// such as 30000/1001
+static void frame_rate_fraction(double fps, int* num, int* den)
+{
+	int a, b;
+
+	if (!(fps > 0))
+		fps = OUTPUT_FPS;
+	*den = fabs(fps * 1.001 - round(fps * 1.001)) < 1e-4 ? 1001 : 1000;
+	*num = (int)round(fps * *den);
+
+	for (a = *num, b = *den; b != 0; )
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	*num /= a;
+	*den /= a;
+}
+
+static size_t yuv420_size(int width, int height)
+{
+	return (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+// BT.601 limited range, colours composited over black by their alpha
+static void rgba_to_yuv420(const uint8_t* rgba, uint8_t* yuv, int width, int height)
+{
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	uint8_t* py = yuv;
+	uint8_t* pu = yuv + width * height;
+	uint8_t* pv = pu + cw * ch;
+	int x, y, i;
+
+	for (y = 0; y < height; y++)
+	{
+		// GL rows are bottom up
+		const uint8_t* src = rgba + (size_t)(height - 1 - y) * width * 4;
+		for (x = 0; x < width; x++, src += 4)
+		{
+			int r = src[0] * src[3] / 255, g = src[1] * src[3] / 255, b = src[2] * src[3] / 255;
+			py[y * width + x] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		}
+	}
+
+	for (y = 0; y < ch; y++)
+	{
+		for (x = 0; x < cw; x++)
+		{
+			// average the 2x2 block, clamped at odd edges
+			int r = 0, g = 0, b = 0;
+			for (i = 0; i < 4; i++)
+			{
+				int sx = 2 * x + (i & 1), sy = 2 * y + (i >> 1);
+				if (sx >= width)
+					sx = width - 1;
+				if (sy >= height)
+					sy = height - 1;
+				const uint8_t* src = rgba + ((size_t)(height - 1 - sy) * width + sx) * 4;
+				r += src[0] * src[3] / 255;
+				g += src[1] * src[3] / 255;
+				b += src[2] * src[3] / 255;
+			}
+			r /= 4;
+			g /= 4;
+			b /= 4;
+			pu[y * cw + x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			pv[y * cw + x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		}
+	}
+}
+
+static int write_png(OUTPUT_T* output, const uint8_t* rgba)
+{
+	char name[4096];
+	int y;
+
+	snprintf(name, sizeof(name), output->filename, output->written);
+	FILE* fp = fopen(name, "wb");
+	if (fp == NULL)
+	{
+		perror(name);
+		return -1;
+	}
+
+	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info_ptr = png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL;
+	if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+	{
+		printf("error: could not write %s.\n", name);
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		return -1;
+	}
+
+	png_init_io(png_ptr, fp);
+	// speed over size, these are previews
+	png_set_compression_level(png_ptr, 1);
+	png_set_IHDR(png_ptr, info_ptr, output->width, output->height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+	for (y = output->height - 1; y >= 0; y--)
+		png_write_row(png_ptr, (png_const_bytep)(rgba + (size_t)y * output->width * 4));
+	png_write_end(png_ptr, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+
+	if (fclose(fp) != 0)
+	{
+		perror(name);
+		return -1;
+	}
+	return 0;
+}
+
+static int write_frame(OUTPUT_T* output, const uint8_t* rgba)
+{
+	size_t row = (size_t)output->width * 4;
+	int y;
+
+	switch (output->format)
+	{
+	case OUTPUT_Y4M:
+	{
+		size_t size = yuv420_size(output->width, output->height);
+		rgba_to_yuv420(rgba, output->yuv, output->width, output->height);
+		if (fputs("FRAME\n", output->file) < 0 ||
+			fwrite(output->yuv, 1, size, output->file) != size)
+			return -1;
+		return 0;
+	}
+	case OUTPUT_RGBA:
+		for (y = output->height - 1; y >= 0; y--)
+		{
+			if (fwrite(rgba + y * row, 1, row, output->file) != row)
+				return -1;
+		}
+		return 0;
+	case OUTPUT_PNG:
+		return write_png(output, rgba);
+	}
+	return -1;
+}
+
+static void* output_thread(void* arg)
+{
+	OUTPUT_T* output = arg;
+
+	pthread_mutex_lock(&output->lock);
+	for (;;)
+	{
+		while (output->head == output->tail && !output->closing)
+			pthread_cond_wait(&output->cond, &output->lock);
+		if (output->head == output->tail)
+			break;
+
+		uint8_t* rgba = output->buffer[output->tail % OUTPUT_BUFFERS];
+		pthread_mutex_unlock(&output->lock);
+
+		// after a failure keep consuming frames so the renderer doesn't stall
+		bool ok = !output->failed && write_frame(output, rgba) == 0;
+
+		pthread_mutex_lock(&output->lock);
+		if (ok)
+			output->written++;
+		else if (!output->failed)
+		{
+			printf("error: writing frame %d to %s failed.\n", output->written, output->filename);
+			output->failed = true;
+		}
+		output->tail++;
+		pthread_cond_broadcast(&output->cond);
+	}
+	pthread_mutex_unlock(&output->lock);
+
+	return NULL;
+}
+
+OUTPUT_T* output_open(const char* filename, int width, int height, double fps)
+{
+	OUTPUT_T* output = calloc(1, sizeof(OUTPUT_T));
+	int i;
+
+	if (output == NULL)
+	{
+		printf("error: out of memory\n");
+		return NULL;
+	}
+
+	if (is_frame_pattern(filename))
+		output->format = OUTPUT_PNG;
+	else if (strchr(filename, '%') != NULL)
+	{
+		printf("error: a PNG sequence name takes a single %%d or %%0Nd for the frame number and no other %%, not %s.\n", filename);
+		free(output);
+		return NULL;
+	}
+	else if (has_suffix(filename, ".y4m"))
+		output->format = OUTPUT_Y4M;
+	else if (has_suffix(filename, ".rgba"))
+		output->format = OUTPUT_RGBA;
+	else
+	{
+		printf("error: unknown output format for %s, use .y4m, .rgba or a %%d pattern for PNGs.\n", filename);
+		free(output);
+		return NULL;
+	}
+
+	output->filename = strdup(filename);
+	output->width = width;
+	output->height = height;
+	pthread_mutex_init(&output->lock, NULL);
+	pthread_cond_init(&output->cond, NULL);
+
+	for (i = 0; i < OUTPUT_BUFFERS; i++)
+		output->buffer[i] = malloc((size_t)width * height * 4);
+	if (output->format == OUTPUT_Y4M)
+		output->yuv = malloc(yuv420_size(width, height));
+
+	bool ok = output->filename != NULL && (output->format != OUTPUT_Y4M || output->yuv != NULL);
+	for (i = 0; i < OUTPUT_BUFFERS; i++)
+		ok = ok && output->buffer[i] != NULL;
+	if (!ok)
+		printf("error: out of memory\n");
+
+	if (ok && output->format != OUTPUT_PNG)
+	{
+		output->file = fopen(filename, "wb");
+		if (output->file == NULL)
+		{
+			perror(filename);
+			ok = false;
+		}
+		else if (output->format == OUTPUT_Y4M)
+		{
+			int num, den;
+			frame_rate_fraction(fps, &num, &den);
+			fprintf(output->file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+				width, height, num, den);
+		}
+	}
+
+	if (ok && pthread_create(&output->thread, NULL, output_thread, output) != 0)
+	{
+		printf("error: could not start the output thread.\n");
+		ok = false;
+	}
+
+	if (!ok)
+	{
+		if (output->file != NULL)
+			fclose(output->file);
+		for (i = 0; i < OUTPUT_BUFFERS; i++)
+			free(output->buffer[i]);
+		free(output->yuv);
+		free(output->filename);
+		free(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+uint8_t* output_get_buffer(OUTPUT_T* output)
+{
+	pthread_mutex_lock(&output->lock);
+	while (output->head - output->tail == OUTPUT_BUFFERS)
+		pthread_cond_wait(&output->cond, &output->lock);
+	uint8_t* buffer = output->buffer[output->head % OUTPUT_BUFFERS];
+	pthread_mutex_unlock(&output->lock);
+
+	return buffer;
+}
+
+void output_submit(OUTPUT_T* output)
+{
+	pthread_mutex_lock(&output->lock);
+	output->head++;
+	pthread_cond_broadcast(&output->cond);
+	pthread_mutex_unlock(&output->lock);
+}
+
+int output_close(OUTPUT_T* output)
+{
+	int i;
+
+	pthread_mutex_lock(&output->lock);
+	output->closing = true;
+	pthread_cond_broadcast(&output->cond);
+	pthread_mutex_unlock(&output->lock);
+	pthread_join(output->thread, NULL);
+
+	bool failed = output->failed;
+	if (output->file != NULL && fclose(output->file) != 0)
+	{
+		perror(output->filename);
+		failed = true;
+	}
+
+	int written = output->written;
+	for (i = 0; i < OUTPUT_BUFFERS; i++)
+		free(output->buffer[i]);
+	free(output->yuv);
+	free(output->filename);
+	free(output);
+
+	return failed ? -1 : written;
+}
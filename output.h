@@ -0,0 +1,28 @@
+// Offline batch output: remapped frames read back from the GPU are queued
+// and written to a file by a separate I/O thread
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+typedef struct OUTPUT_T OUTPUT_T;
+
+// Open an output for width x height RGBA frames. The format follows the
+// file name: "*.y4m" is a YUV4MPEG2 4:2:0 stream, "*.rgba" raw RGBA frames,
+// and a name with a %d or %0Nd for the frame number such as "frame%05d.png"
+// a PNG sequence; a name with any other % is refused.
+// A Y4M stream gets the frame rate fps, or 25 fps if that is 0.
+OUTPUT_T* output_open(const char* filename, int width, int height, double fps);
+
+// Buffer for the next frame, in GL row order (bottom row first); blocks
+// while the I/O thread is behind by every buffer
+uint8_t* output_get_buffer(OUTPUT_T* output);
+// Queue the buffer from output_get_buffer for writing
+void output_submit(OUTPUT_T* output);
+
+// Write out the queued frames and close; returns the number of frames
+// written, or -1 if writing failed
+int output_close(OUTPUT_T* output);
+
+#endif
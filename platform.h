@@ -0,0 +1,32 @@
+// Display backends, chosen at build time: platform_rpi.c opens a dispmanx
+// window on the Pi, platform_mesa.c a headless pbuffer on Mesa
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "EGL/egl.h"
+
+// Called once at startup, before any other EGL or video call
+int platform_init(void);
+
+EGLDisplay platform_get_display(void);
+
+// EGL_SURFACE_TYPE bits the config needs for platform_create_surface
+EGLint platform_surface_type(void);
+
+// True if the display can scale a smaller surface up to its size as it
+// shows it, at no cost to the GPU
+bool platform_display_scales(void);
+
+// Create the surface to render to. *width and *height are the requested
+// size, 0 for the size of the display, and return the size shown. Where
+// the display scales, the surface is scale times that size and scaled up
+// to it; eglQuerySurface tells its size. Elsewhere scale has to be 1.
+EGLSurface platform_create_surface(EGLDisplay display, EGLConfig config,
+	uint32_t* width, uint32_t* height, float scale);
+void platform_destroy_surface(EGLDisplay display, EGLSurface surface);
+
+#endif
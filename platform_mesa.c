@@ -0,0 +1,72 @@
+// Headless display backend for desktop Linux: a pbuffer on Mesa's
+// surfaceless platform, so llvmpipe renders without a GPU or X server
+
+#include <stdio.h>
+#include <string.h>
+
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+
+#include "platform.h"
+
+// pbuffer size when none is requested
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+
+int platform_init(void)
+{
+	return 0;
+}
+
+EGLDisplay platform_get_display(void)
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL)
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (get_platform_display != NULL)
+			return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+#endif
+	// older Mesa: let it pick a platform from the environment
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+EGLint platform_surface_type(void)
+{
+	return EGL_PBUFFER_BIT;
+}
+
+bool platform_display_scales(void)
+{
+	// a pbuffer is never shown
+	return false;
+}
+
+EGLSurface platform_create_surface(EGLDisplay display, EGLConfig config,
+	uint32_t* width, uint32_t* height, float scale)
+{
+	// nothing scales a pbuffer up, so it is made the size asked for
+	(void)scale;
+
+	if (*width == 0 || *height == 0)
+	{
+		*width = DEFAULT_WIDTH;
+		*height = DEFAULT_HEIGHT;
+	}
+
+	const EGLint attributes[] =
+	{
+		EGL_WIDTH, (EGLint)*width,
+		EGL_HEIGHT, (EGLint)*height,
+		EGL_NONE
+	};
+	return eglCreatePbufferSurface(display, config, attributes);
+}
+
+void platform_destroy_surface(EGLDisplay display, EGLSurface surface)
+{
+	eglDestroySurface(display, surface);
+}
@@ -0,0 +1,86 @@
+// Display backend for the Raspberry Pi: a full screen dispmanx window
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "bcm_host.h"
+
+#include "platform.h"
+
+static EGL_DISPMANX_WINDOW_T nativewindow;
+
+int platform_init(void)
+{
+	bcm_host_init();
+	return 0;
+}
+
+EGLDisplay platform_get_display(void)
+{
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+EGLint platform_surface_type(void)
+{
+	return EGL_WINDOW_BIT;
+}
+
+bool platform_display_scales(void)
+{
+	// the HVS scales dispmanx elements as it composes the display
+	return true;
+}
+
+EGLSurface platform_create_surface(EGLDisplay display, EGLConfig config,
+	uint32_t* width, uint32_t* height, float scale)
+{
+	int32_t success = 0;
+
+	DISPMANX_ELEMENT_HANDLE_T dispman_element;
+	DISPMANX_DISPLAY_HANDLE_T dispman_display;
+	DISPMANX_UPDATE_HANDLE_T dispman_update;
+	VC_RECT_T dst_rect;
+	VC_RECT_T src_rect;
+	uint32_t surface_width, surface_height;
+
+	// the window always covers the whole display
+	success = graphics_get_display_size(0 /* LCD */, width, height);
+	assert( success >= 0 );
+
+	dst_rect.x = 0;
+	dst_rect.y = 0;
+	dst_rect.width = *width;
+	dst_rect.height = *height;
+
+	// the element is scaled from the size of the surface to the display
+	surface_width = ((uint32_t)(*width * scale + 0.5f) + 1) & ~1;
+	surface_height = ((uint32_t)(*height * scale + 0.5f) + 1) & ~1;
+	if (surface_width > *width)
+		surface_width = *width;
+	if (surface_height > *height)
+		surface_height = *height;
+
+	src_rect.x = 0;
+	src_rect.y = 0;
+	src_rect.width = surface_width << 16;
+	src_rect.height = surface_height << 16;
+
+	dispman_display = vc_dispmanx_display_open( 0 /* LCD */);
+	dispman_update = vc_dispmanx_update_start( 0 );
+
+	dispman_element = vc_dispmanx_element_add ( dispman_update, dispman_display,
+		0/*layer*/, &dst_rect, 0/*src*/,
+		&src_rect, DISPMANX_PROTECTION_NONE, 0 /*alpha*/, 0/*clamp*/, 0/*transform*/);
+
+	nativewindow.element = dispman_element;
+	nativewindow.width = surface_width;
+	nativewindow.height = surface_height;
+	vc_dispmanx_update_submit_sync( dispman_update );
+
+	return eglCreateWindowSurface( display, config, &nativewindow, NULL );
+}
+
+void platform_destroy_surface(EGLDisplay display, EGLSurface surface)
+{
+	eglDestroySurface( display, surface );
+}
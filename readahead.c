@@ -0,0 +1,370 @@
+// Read-ahead of a raw H.264 movie on a thread of its own, so that a slow
+// read from an SD card or USB stick doesn't starve the decoder, and gapless
+// looping from the first GOP, which is kept in memory
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "h264.h"
+#include "readahead.h"
+#include "stats.h"
+
+// Single producer, single consumer ring of chunks. Each side owns its own
+// index; the semaphores count the filled and the free chunks, so neither
+// side takes a lock while the other keeps up.
+struct READAHEAD_T
+{
+	int fd;
+	bool loop;
+	int depth;
+	uint8_t* buffer;          // depth chunks, page aligned
+	size_t* length;           // bytes in each chunk; 0 marks the end
+	bool* pass_end;           // the chunk ends a pass through the file
+	sem_t filled, free;
+	pthread_t thread;
+	bool quit;
+
+	// the first GOP, which every pass starts with, where the reader carries
+	// on after it, and where a pass ends
+	uint8_t* head;
+	size_t head_size;
+	off_t body;
+	off_t end;
+	off_t position;           // of the reader in the file
+
+	// reader side: pictures are counted through the first pass
+	H264_COUNTER_T counter;
+	uint64_t pictures;
+
+	// consumer side
+	size_t head_pos;
+	unsigned tail;
+	size_t offset;            // read position in chunk tail
+	bool holding;             // chunk tail has been taken from filled
+	bool eof;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Fill a chunk up to the end of the range; when looping the reader then
+// goes back to the end of the first GOP for the next pass
+static size_t fill_chunk(READAHEAD_T* reader, uint8_t* chunk, bool* pass_end)
+{
+	size_t n = 0;
+
+	*pass_end = false;
+	while (n < READAHEAD_CHUNK)
+	{
+		size_t want = READAHEAD_CHUNK - n;
+		if ((off_t)want > reader->end - reader->position)
+			want = reader->end - reader->position;
+
+		ssize_t result = want > 0 ? read(reader->fd, chunk + n, want) : 0;
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0)
+		{
+			perror("error: reading the movie");
+			break;
+		}
+		if (result == 0)
+		{
+			*pass_end = reader->loop && lseek(reader->fd, reader->body, SEEK_SET) == reader->body;
+			if (*pass_end)
+				reader->position = reader->body;
+			break;
+		}
+		n += result;
+		reader->position += result;
+	}
+	return n;
+}
+
+static void* read_ahead(void* arg)
+{
+	READAHEAD_T* reader = arg;
+	bool counting = true;
+	unsigned head;
+
+	for (head = 0; ; head++)
+	{
+		while (sem_wait(&reader->free) != 0 && errno == EINTR)
+			;
+		if (__atomic_load_n(&reader->quit, __ATOMIC_ACQUIRE))
+			break;
+
+		int slot = head % reader->depth;
+		uint8_t* chunk = reader->buffer + (size_t)slot * READAHEAD_CHUNK;
+		bool pass_end;
+		size_t length = fill_chunk(reader, chunk, &pass_end);
+
+		if (counting)
+		{
+			h264_count_pictures(&reader->counter, chunk, length);
+			if (pass_end || length == 0)
+			{
+				__atomic_store_n(&reader->pictures, reader->counter.pictures, __ATOMIC_RELEASE);
+				counting = false;
+			}
+		}
+
+		reader->length[slot] = length;
+		reader->pass_end[slot] = pass_end;
+		sem_post(&reader->filled);
+
+		if (length == 0 && !pass_end)
+			break;
+	}
+	return NULL;
+}
+
+// The SPS and PPS at the start of the file, for a range that starts at an
+// IDR picture without its own
+static size_t file_parameter_sets(READAHEAD_T* reader, uint8_t* out, size_t max)
+{
+	uint8_t* probe = malloc(H264_PROBE_SIZE);
+	ssize_t size;
+	size_t n = 0;
+
+	if (probe == NULL)
+		return 0;
+	size = pread(reader->fd, probe, H264_PROBE_SIZE, 0);
+	if (size > 0)
+		n = h264_parameter_sets(probe, size, out, max);
+	free(probe);
+	return n;
+}
+
+// Read the start of the range, and keep its first GOP
+static int read_head(READAHEAD_T* reader, off_t start)
+{
+	size_t size = 0, limit = READAHEAD_HEAD_MAX, gop_start, gop_end, config = 0;
+	uint8_t* head = malloc(READAHEAD_HEAD_MAX + H264_PROBE_SIZE);
+
+	if (head == NULL)
+		return -1;
+	if (lseek(reader->fd, start, SEEK_SET) != start)
+	{
+		free(head);
+		return -1;
+	}
+	if ((off_t)limit > reader->end - start)
+		limit = reader->end - start;
+	while (size < limit)
+	{
+		ssize_t result = read(reader->fd, head + size, limit - size);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			break;
+		size += result;
+	}
+
+	// without an IDR picture in there, loop over the whole range
+	if (h264_find_gop(head, size, &gop_start, &gop_end) < 0)
+	{
+		gop_start = 0;
+		gop_end = size;
+	}
+
+	// the decoder can't start without parameter sets: past the start of the
+	// file they may only be found there
+	if (start > 0 && gop_end > gop_start &&
+		h264_parameter_sets(head + gop_start, gop_end - gop_start, head + size, H264_PROBE_SIZE) == 0)
+		config = file_parameter_sets(reader, head + size, H264_PROBE_SIZE);
+
+	memmove(head + config, head + gop_start, gop_end - gop_start);
+	memmove(head, head + size, config);
+	reader->head_size = config + gop_end - gop_start;
+	reader->head = realloc(head, reader->head_size > 0 ? reader->head_size : 1);
+	reader->body = start + gop_end;
+	reader->position = reader->body;
+	h264_count_pictures(&reader->counter, reader->head, reader->head_size);
+
+	// an empty range has nothing to loop
+	if (size == 0)
+		reader->loop = false;
+	return lseek(reader->fd, reader->body, SEEK_SET) == reader->body ? 0 : -1;
+}
+
+READAHEAD_T* readahead_open(const char* filename, int depth, bool loop,
+	uint64_t start, uint64_t end)
+{
+	READAHEAD_T* reader = calloc(1, sizeof(READAHEAD_T));
+	void* buffer = NULL;
+	struct stat file_stat;
+
+	if (reader == NULL)
+		return NULL;
+	if (depth < 2)
+		depth = 2;
+
+	reader->fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (reader->fd < 0)
+	{
+		free(reader);
+		return NULL;
+	}
+	// the chunks are large already, but this doubles the kernel's own
+	// read-ahead. The page cache is kept (no O_DIRECT), so a looping movie
+	// is read from the card only once if it fits in memory.
+	posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	reader->end = fstat(reader->fd, &file_stat) == 0 ? file_stat.st_size : 0;
+	if (end > 0 && (off_t)end < reader->end)
+		reader->end = end;
+	if ((off_t)start > reader->end)
+		start = reader->end;
+
+	reader->loop = loop;
+	reader->depth = depth;
+	reader->length = calloc(depth, sizeof(size_t));
+	reader->pass_end = calloc(depth, sizeof(bool));
+	if (reader->length == NULL || reader->pass_end == NULL || read_head(reader, start) < 0 ||
+		posix_memalign(&buffer, 4096, (size_t)depth * READAHEAD_CHUNK) != 0)
+	{
+		printf("error: could not allocate memory for the read-ahead.\n");
+		close(reader->fd);
+		free(reader->head);
+		free(reader->length);
+		free(reader->pass_end);
+		free(reader);
+		return NULL;
+	}
+	reader->buffer = buffer;
+
+	sem_init(&reader->filled, 0, 0);
+	sem_init(&reader->free, 0, depth);
+	if (pthread_create(&reader->thread, NULL, read_ahead, reader) != 0)
+	{
+		printf("error: could not start the read-ahead thread.\n");
+		sem_destroy(&reader->filled);
+		sem_destroy(&reader->free);
+		close(reader->fd);
+		free(reader->head);
+		free(reader->buffer);
+		free(reader->length);
+		free(reader->pass_end);
+		free(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
+void readahead_close(READAHEAD_T* reader)
+{
+	if (reader == NULL)
+		return;
+
+	__atomic_store_n(&reader->quit, true, __ATOMIC_RELEASE);
+	sem_post(&reader->free);
+	pthread_join(reader->thread, NULL);
+
+	sem_destroy(&reader->filled);
+	sem_destroy(&reader->free);
+	close(reader->fd);
+	free(reader->head);
+	free(reader->buffer);
+	free(reader->length);
+	free(reader->pass_end);
+	free(reader);
+}
+
+// Every pass starts with the copy of the first GOP
+static size_t copy_head(READAHEAD_T* reader, uint8_t* dest, size_t size)
+{
+	size_t n = 0;
+
+	if (reader->head_pos < reader->head_size && !reader->eof)
+	{
+		n = reader->head_size - reader->head_pos;
+		if (n > size)
+			n = size;
+		memcpy(dest, reader->head + reader->head_pos, n);
+		reader->head_pos += n;
+	}
+	return n;
+}
+
+size_t readahead_read(READAHEAD_T* reader, uint8_t* dest, size_t size, bool* pass_end)
+{
+	size_t copied;
+
+	*pass_end = false;
+	copied = copy_head(reader, dest, size);
+
+	while (copied < size && !reader->eof)
+	{
+		int slot = reader->tail % reader->depth;
+
+		if (!reader->holding)
+		{
+			if (sem_trywait(&reader->filled) != 0)
+			{
+				// the reader is behind: this is what the ring is meant to avoid
+				uint64_t start = now_ns();
+				while (sem_wait(&reader->filled) != 0 && errno == EINTR)
+					;
+				stats_feed_wait(now_ns() - start);
+			}
+			reader->holding = true;
+			reader->offset = 0;
+			if (reader->length[slot] == 0 && !reader->pass_end[slot])
+			{
+				reader->eof = true;
+				break;
+			}
+		}
+
+		size_t n = reader->length[slot] - reader->offset;
+		if (n > size - copied)
+			n = size - copied;
+		memcpy(dest + copied, reader->buffer + (size_t)slot * READAHEAD_CHUNK + reader->offset, n);
+		copied += n;
+		reader->offset += n;
+
+		if (reader->offset == reader->length[slot])
+		{
+			// stop at the end of a pass, so it ends a buffer of the decoder
+			bool end = reader->pass_end[slot];
+			reader->holding = false;
+			reader->tail++;
+			sem_post(&reader->free);
+			if (end)
+			{
+				reader->head_pos = 0;
+				if (copied > 0)
+				{
+					*pass_end = true;
+					break;
+				}
+				// a pass that ended on a chunk boundary leaves an empty chunk,
+				// which must not look like the end of the stream
+				copied = copy_head(reader, dest, size);
+			}
+		}
+	}
+
+	stats_feed_read(copied);
+	return copied;
+}
+
+uint64_t readahead_pictures(READAHEAD_T* reader)
+{
+	return __atomic_load_n(&reader->pictures, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,42 @@
+// Read-ahead of a raw H.264 movie on a thread of its own, so that a slow
+// read from an SD card or USB stick doesn't starve the decoder, and gapless
+// looping from the first GOP, which is kept in memory
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// bytes per chunk of the ring, and the default number of chunks
+#define READAHEAD_CHUNK (256 << 10)
+#define READAHEAD_DEPTH 8
+
+// most of the start of the movie kept in memory for looping
+#define READAHEAD_HEAD_MAX (4 << 20)
+
+typedef struct READAHEAD_T READAHEAD_T;
+
+// Open filename and start reading up to depth chunks ahead, from byte start
+// up to byte end of the file (0 for all of it). The stream starts at the
+// access unit of the first IDR picture in that range, and its first GOP (up
+// to READAHEAD_HEAD_MAX bytes) is read once and kept in memory. With loop
+// every pass through the range starts from that copy, so the loop point
+// needs no I/O. Returns NULL if the file can't be opened.
+READAHEAD_T* readahead_open(const char* filename, int depth, bool loop,
+	uint64_t start, uint64_t end);
+void readahead_close(READAHEAD_T* reader);
+
+// Copy the next size bytes of the stream into dest, waiting for the reader
+// thread if it is behind. Returns the number of bytes copied, which is
+// less than size at the end of a pass, when *pass_end is set, and 0 at the
+// end of the stream. A pass that ends just as a call fills dest runs on
+// into the next call without *pass_end.
+size_t readahead_read(READAHEAD_T* reader, uint8_t* dest, size_t size, bool* pass_end);
+
+// Frames in one pass through the stream, 0 until the reader has been
+// through it once
+uint64_t readahead_pictures(READAHEAD_T* reader);
+
+#endif
@@ -0,0 +1,347 @@
+// Hot reload of the map: the map file is watched with inotify and a changed
+// map is decoded, packed and fitted on a background thread, ready for the
+// render thread to upload
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "map.h"
+#include "mesh.h"
+#include "reload.h"
+#include "tiles.h"
+
+// a change is picked up once the file has been left alone this long, as
+// most tools write a file in several steps
+#define RELOAD_SETTLE_MS 200
+
+// nice value of the thread that decodes changed maps
+#define RELOAD_NICE 10
+
+struct RELOAD_T
+{
+	char* filename;
+	char* name;               // the file name in its directory
+	SHADER_MAP_T format;
+	float mesh_error;
+	int source_width, source_height;
+	bool verbose;
+
+	int fd;
+	pthread_t thread;
+
+	// one prepared map at a time is handed over
+	pthread_mutex_t lock;
+	pthread_cond_t taken;
+	RELOAD_MAP_T* ready;
+};
+
+// state of one map being prepared
+typedef struct
+{
+	float mesh_error;
+	RELOAD_MAP_T* map;
+	bool graded;
+	TILES_T tiles;
+	MESH_MAP_T mesh;
+
+	// streamed: every MAP_BAND_ROWS rows of texels are passed to fn, and
+	// only that many are kept
+	RELOAD_BAND_FN fn;
+	void* arg;
+	uint8_t* texels[2];
+} RELOAD_LOAD_T;
+
+void reload_map_free(RELOAD_MAP_T* map)
+{
+	if (map == NULL)
+		return;
+	free(map->texels[0]);
+	free(map->texels[1]);
+	free(map->vertices);
+	free(map);
+}
+
+static int prepare_band(void* arg, const MAP_BAND_T* band)
+{
+	RELOAD_LOAD_T* load = arg;
+	RELOAD_MAP_T* map = load->map;
+	bool split = map->format == SHADER_MAP_SPLIT;
+	int y, rows;
+
+	if (band->index == 0)
+	{
+		size_t n = (size_t)band->width * (load->fn != NULL ? MAP_BAND_ROWS : band->height);
+		map->width = band->width;
+		map->height = band->height;
+		load->texels[0] = malloc(n * 4);
+		load->texels[1] = malloc(split ? n * 4 : n);
+		if (load->texels[0] == NULL || load->texels[1] == NULL ||
+			(load->mesh_error > 0 ? mesh_init(&load->mesh, band->width, band->height) :
+				tiles_init(&load->tiles, band->width, band->height)) < 0)
+		{
+			printf("error: could not allocate memory for the map.\n");
+			return -1;
+		}
+	}
+
+	// a whole mapped map is streamed a few rows at a time as well
+	for (y = 0; y < band->rows; y += rows)
+	{
+		int first = load->fn != NULL ? 0 : band->y + y;
+		int i;
+
+		rows = load->fn == NULL || band->rows - y < MAP_BAND_ROWS ? band->rows - y : MAP_BAND_ROWS;
+		for (i = 0; i < rows; i++)
+		{
+			const uint8_t* msb = band->msb + (size_t)(y + i) * band->stride;
+			const uint8_t* lsb = band->lsb + (size_t)(y + i) * band->stride;
+			size_t offset = (size_t)(first + i) * band->width;
+
+			if (split)
+			{
+				memcpy(load->texels[0] + offset * 4, msb, (size_t)band->width * 4);
+				memcpy(load->texels[1] + offset * 4, lsb, (size_t)band->width * 4);
+			}
+			else if (map_pack(msb, lsb, band->width, load->texels[0] + offset * 4, load->texels[1] + offset))
+				load->graded = true;
+		}
+
+		if (load->fn != NULL)
+		{
+			RELOAD_BAND_T out = { map->width, map->height, map->format, band->y + y, rows,
+				{ load->texels[0], load->texels[1] } };
+			if (load->fn(load->arg, &out) != 0)
+				return -1;
+		}
+	}
+
+	if (load->mesh_error > 0)
+		mesh_add_band(&load->mesh, band);
+	else
+		tiles_add_band(&load->tiles, band);
+	return 0;
+}
+
+// Start preparing a map; NULL if out of memory
+static RELOAD_MAP_T* begin_prepare(RELOAD_LOAD_T* load, SHADER_MAP_T format, float mesh_error,
+	RELOAD_BAND_FN fn, void* arg)
+{
+	memset(load, 0, sizeof(*load));
+	load->mesh_error = mesh_error;
+	load->fn = fn;
+	load->arg = arg;
+	load->map = calloc(1, sizeof(RELOAD_MAP_T));
+	if (load->map != NULL)
+		load->map->format = format;
+	return load->map;
+}
+
+// Fit the mesh or tiles once every band has been through prepare_band,
+// which returned result, and settle the format
+static RELOAD_MAP_T* finish_prepare(RELOAD_LOAD_T* load, int result,
+	int source_width, int source_height)
+{
+	if (load->fn == NULL)
+	{
+		load->map->texels[0] = load->texels[0];
+		load->map->texels[1] = load->texels[1];
+	}
+	else
+	{
+		free(load->texels[0]);
+		free(load->texels[1]);
+	}
+
+	if (result == 0)
+	{
+		if (load->mesh_error > 0)
+			result = mesh_vertices(&load->mesh, source_width, source_height,
+				load->mesh_error, &load->map->vertices, &load->map->mesh_count,
+				&load->map->pixel_count);
+		else
+			result = load->map->pixel_count = tiles_vertices(&load->tiles, &load->map->vertices);
+		if (result < 0)
+			printf("error: could not allocate memory for the map.\n");
+	}
+	mesh_free(&load->mesh);
+	tiles_free(&load->tiles);
+
+	if (result < 0)
+	{
+		reload_map_free(load->map);
+		return NULL;
+	}
+
+	// with only 0 and 1 alpha the uv texture is all the shader needs
+	if (load->map->format == SHADER_MAP_PACKED && !load->graded)
+	{
+		load->map->format = SHADER_MAP_PACKED_BINARY;
+		free(load->map->texels[1]);
+		load->map->texels[1] = NULL;
+	}
+	return load->map;
+}
+
+RELOAD_MAP_T* reload_prepare(const MAP_T* source, SHADER_MAP_T format, float mesh_error,
+	int source_width, int source_height)
+{
+	MAP_BAND_T band = { source->width, source->height, source->stride, 0, source->height, 0,
+		source->msb, source->lsb };
+	RELOAD_LOAD_T load;
+
+	if (begin_prepare(&load, format, mesh_error, NULL, NULL) == NULL)
+		return NULL;
+	map_bounds(source, &load.map->bounds);
+	return finish_prepare(&load, prepare_band(&load, &band), source_width, source_height);
+}
+
+RELOAD_MAP_T* reload_stream(const MAP_T* source, const char* filename, SHADER_MAP_T format,
+	float mesh_error, int source_width, int source_height, RELOAD_BAND_FN fn, void* arg,
+	bool verbose)
+{
+	RELOAD_LOAD_T load;
+	int result;
+
+	if (begin_prepare(&load, format, mesh_error, fn, arg) == NULL)
+		return NULL;
+	if (source != NULL)
+	{
+		MAP_BAND_T band = { source->width, source->height, source->stride, 0, source->height, 0,
+			source->msb, source->lsb };
+		result = prepare_band(&load, &band);
+	}
+	else
+		result = map_load(filename, prepare_band, &load, verbose);
+	return finish_prepare(&load, result, source_width, source_height);
+}
+
+// True if the events in buffer include a write to, or a rename onto, the map
+static bool map_changed(const RELOAD_T* reload, const char* buffer, ssize_t length)
+{
+	const char* p = buffer;
+
+	while (p < buffer + length)
+	{
+		const struct inotify_event* event = (const struct inotify_event*)p;
+		if (event->len > 0 && strcmp(event->name, reload->name) == 0)
+			return true;
+		p += sizeof(struct inotify_event) + event->len;
+	}
+	return false;
+}
+
+static void* watch_map(void* arg)
+{
+	RELOAD_T* reload = arg;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd fd = { reload->fd, POLLIN, 0 };
+
+	// decoding a map takes a while; the render and decoder threads come
+	// first, so that playback doesn't stutter meanwhile
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), RELOAD_NICE);
+
+	for (;;)
+	{
+		ssize_t length = read(reload->fd, buffer, sizeof(buffer));
+		if (length < 0 && errno == EINTR)
+			continue;
+		if (length <= 0)
+		{
+			printf("error: could not watch %s for changes.\n", reload->filename);
+			break;
+		}
+		if (!map_changed(reload, buffer, length))
+			continue;
+
+		while (poll(&fd, 1, RELOAD_SETTLE_MS) > 0)
+		{
+			if (read(reload->fd, buffer, sizeof(buffer)) < 0 && errno != EINTR)
+				break;
+		}
+
+		if (reload->verbose)
+			printf("Map changed, reloading %s\n", reload->filename);
+		MAP_T source;
+		if (map_open(reload->filename, &source, reload->verbose) != 0)
+			continue;
+		RELOAD_MAP_T* map = reload_prepare(&source, reload->format, reload->mesh_error,
+			reload->source_width, reload->source_height);
+		map_close(&source);
+		if (map == NULL)
+			continue;
+
+		pthread_mutex_lock(&reload->lock);
+		while (reload->ready != NULL)
+			pthread_cond_wait(&reload->taken, &reload->lock);
+		reload->ready = map;
+		pthread_mutex_unlock(&reload->lock);
+	}
+
+	return NULL;
+}
+
+RELOAD_T* reload_start(const char* filename, SHADER_MAP_T format, float mesh_error,
+	int source_width, int source_height, bool verbose)
+{
+	RELOAD_T* reload = calloc(1, sizeof(RELOAD_T));
+	if (reload == NULL)
+		return NULL;
+
+	// editors tend to replace a file rather than write it in place, which
+	// a watch on the file itself would miss, so the directory is watched
+	char* directory_copy = strdup(filename);
+	char* name_copy = strdup(filename);
+	reload->filename = strdup(filename);
+	reload->name = name_copy != NULL ? strdup(basename(name_copy)) : NULL;
+	reload->fd = inotify_init1(IN_CLOEXEC);
+	if (directory_copy == NULL || reload->filename == NULL || reload->name == NULL ||
+		reload->fd < 0 ||
+		inotify_add_watch(reload->fd, dirname(directory_copy), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		printf("error: could not watch %s for changes.\n", filename);
+		if (reload->fd >= 0)
+			close(reload->fd);
+		free(directory_copy);
+		free(name_copy);
+		free(reload->filename);
+		free(reload->name);
+		free(reload);
+		return NULL;
+	}
+	free(directory_copy);
+	free(name_copy);
+
+	reload->format = format;
+	reload->mesh_error = mesh_error;
+	reload->source_width = source_width;
+	reload->source_height = source_height;
+	reload->verbose = verbose;
+	pthread_mutex_init(&reload->lock, NULL);
+	pthread_cond_init(&reload->taken, NULL);
+
+	// the thread goes with the process, like the decoder thread
+	pthread_create(&reload->thread, NULL, watch_map, reload);
+	return reload;
+}
+
+RELOAD_MAP_T* reload_take(RELOAD_T* reload)
+{
+	RELOAD_MAP_T* map;
+
+	pthread_mutex_lock(&reload->lock);
+	map = reload->ready;
+	reload->ready = NULL;
+	pthread_cond_signal(&reload->taken);
+	pthread_mutex_unlock(&reload->lock);
+
+	return map;
+}
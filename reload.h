@@ -0,0 +1,71 @@
+// Hot reload of the map: the map file is watched with inotify and a changed
+// map is decoded, packed and fitted on a background thread, ready for the
+// render thread to upload
+
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "map.h"
+#include "shader.h"
+
+// A decoded map in the layout of the map textures; the initial map is
+// prepared the same way, but streamed
+typedef struct
+{
+	int width, height;
+	SHADER_MAP_T format;
+	// texture[0] and [1] rows, bottom up: RGBA msb and lsb for the split
+	// format, RGBA packed uv and ALPHA for the packed one; texels[1] is NULL
+	// for SHADER_MAP_PACKED_BINARY, which needs no alpha texture
+	uint8_t* texels[2];
+	// as in APP_STATE_T: mesh_count mesh vertices, then pixel_count per
+	// pixel vertices
+	float* vertices;
+	int mesh_count, pixel_count;
+	MAP_BOUNDS_T bounds;      // of the source it samples
+} RELOAD_MAP_T;
+
+// A band of a map being streamed: rows [y, y+rows) of the textures, laid
+// out as texels in RELOAD_MAP_T. The format is packed rather than packed
+// binary, as that is only known at the end.
+typedef struct
+{
+	int width, height;        // of the whole map
+	SHADER_MAP_T format;
+	int y, rows;
+	const uint8_t* texels[2];
+} RELOAD_BAND_T;
+
+// Receives the bands of a streamed map; returning non-zero stops it
+typedef int (*RELOAD_BAND_FN)(void* arg, const RELOAD_BAND_T* band);
+
+typedef struct RELOAD_T RELOAD_T;
+
+// Start watching filename. Changed maps are prepared with reload_prepare.
+// Returns NULL if the file can't be watched.
+RELOAD_T* reload_start(const char* filename, SHADER_MAP_T format, float mesh_error,
+	int source_width, int source_height, bool verbose);
+
+// Prepare a map for format (split or packed, which becomes binary where it
+// can), with a mesh fitted if mesh_error > 0 or tiles otherwise. Returns
+// NULL if out of memory.
+RELOAD_MAP_T* reload_prepare(const MAP_T* map, SHADER_MAP_T format, float mesh_error,
+	int source_width, int source_height);
+
+// Prepare a map the same way, but pass its texels to fn MAP_BAND_ROWS rows
+// at a time instead of keeping them: from source if it is open already, or
+// else loaded from filename band by band. The map returned has no texels,
+// and its bounds are left to the caller.
+RELOAD_MAP_T* reload_stream(const MAP_T* source, const char* filename, SHADER_MAP_T format,
+	float mesh_error, int source_width, int source_height, RELOAD_BAND_FN fn, void* arg,
+	bool verbose);
+
+// The next prepared map, or NULL; never blocks. The caller owns the map
+// and frees it with reload_map_free.
+RELOAD_MAP_T* reload_take(RELOAD_T* reload);
+void reload_map_free(RELOAD_MAP_T* map);
+
+#endif
@@ -0,0 +1,395 @@
+// CPU implementation of the UV mapping fragment shader
+//
+// Reproduces the fragment shader in init_shaders:
+//   uv = texture2D(mapMsb,tcoord) + texture2D(mapLsb,tcoord)/256.
+//   uv.g = 1.0 - uv.g
+//   rgb = texture2D(source, uv.xy).rgb, a = uv.a
+// with GL_NEAREST sampling and GL_CLAMP_TO_EDGE on the source. The
+// coordinates are worked out in single precision floats the way the shader
+// does, so that texels on the boundary between two source texels land on
+// the same one as on the GPU and the result matches the GL path exactly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "remap.h"
+#include "cpu.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define REMAP_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define REMAP_NEON
+#endif
+
+// pixels are RGBA bytes read as little endian words, so the rgb channels
+// are the low 24 bits and alpha the top 8
+#define RGB_MASK 0x00ffffff
+
+typedef void (*REMAP_SPAN_FN)(const uint32_t* src, const uint32_t* index,
+	const uint8_t* alpha, uint32_t* dst, int n);
+
+static void span_scalar(const uint32_t* src, const uint32_t* index,
+	const uint8_t* alpha, uint32_t* dst, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		dst[i] = (src[index[i]] & RGB_MASK) | ((uint32_t)alpha[i] << 24);
+}
+
+#ifdef REMAP_X86
+__attribute__((target("sse4.1")))
+static void span_sse41(const uint32_t* src, const uint32_t* index,
+	const uint8_t* alpha, uint32_t* dst, int n)
+{
+	const __m128i rgb = _mm_set1_epi32(RGB_MASK);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		int32_t a4;
+		__m128i px = _mm_cvtsi32_si128(src[index[i]]);
+		px = _mm_insert_epi32(px, src[index[i+1]], 1);
+		px = _mm_insert_epi32(px, src[index[i+2]], 2);
+		px = _mm_insert_epi32(px, src[index[i+3]], 3);
+
+		memcpy(&a4, alpha + i, 4);
+		__m128i a = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(a4));
+
+		px = _mm_or_si128(_mm_and_si128(px, rgb), _mm_slli_epi32(a, 24));
+		_mm_storeu_si128((__m128i*)(dst + i), px);
+	}
+	span_scalar(src, index + i, alpha + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void span_avx2(const uint32_t* src, const uint32_t* index,
+	const uint8_t* alpha, uint32_t* dst, int n)
+{
+	const __m256i rgb = _mm256_set1_epi32(RGB_MASK);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i idx = _mm256_loadu_si256((const __m256i*)(index + i));
+		__m256i px = _mm256_i32gather_epi32((const int*)src, idx, 4);
+		__m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(alpha + i)));
+
+		px = _mm256_or_si256(_mm256_and_si256(px, rgb), _mm256_slli_epi32(a, 24));
+		_mm256_storeu_si256((__m256i*)(dst + i), px);
+	}
+	span_scalar(src, index + i, alpha + i, dst + i, n - i);
+}
+#endif
+
+#ifdef REMAP_NEON
+static void span_neon(const uint32_t* src, const uint32_t* index,
+	const uint8_t* alpha, uint32_t* dst, int n)
+{
+	// NEON has no gather, so the loads are per lane but the alpha merge
+	// and stores are vectorised
+	const uint32x4_t rgb = vdupq_n_u32(RGB_MASK);
+	uint32x4_t lo = vdupq_n_u32(0), hi = vdupq_n_u32(0);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		lo = vld1q_lane_u32(src + index[i],   lo, 0);
+		lo = vld1q_lane_u32(src + index[i+1], lo, 1);
+		lo = vld1q_lane_u32(src + index[i+2], lo, 2);
+		lo = vld1q_lane_u32(src + index[i+3], lo, 3);
+		hi = vld1q_lane_u32(src + index[i+4], hi, 0);
+		hi = vld1q_lane_u32(src + index[i+5], hi, 1);
+		hi = vld1q_lane_u32(src + index[i+6], hi, 2);
+		hi = vld1q_lane_u32(src + index[i+7], hi, 3);
+
+		uint16x8_t a = vmovl_u8(vld1_u8(alpha + i));
+		uint32x4_t a_lo = vshlq_n_u32(vmovl_u16(vget_low_u16(a)), 24);
+		uint32x4_t a_hi = vshlq_n_u32(vmovl_u16(vget_high_u16(a)), 24);
+
+		vst1q_u32(dst + i,     vbslq_u32(rgb, lo, a_lo));
+		vst1q_u32(dst + i + 4, vbslq_u32(rgb, hi, a_hi));
+	}
+	span_scalar(src, index + i, alpha + i, dst + i, n - i);
+}
+#endif
+
+typedef struct
+{
+	const char* name;
+	int features;
+	REMAP_SPAN_FN span;
+} REMAP_KERNEL_T;
+
+// in order of preference
+static const REMAP_KERNEL_T kernels[] =
+{
+#ifdef REMAP_X86
+	{ "avx2",   CPU_AVX2,  span_avx2 },
+	{ "sse41",  CPU_SSE41, span_sse41 },
+#endif
+#ifdef REMAP_NEON
+	{ "neon",   CPU_NEON,  span_neon },
+#endif
+	{ "scalar", 0,         span_scalar },
+};
+
+#define KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+// scalar until one is selected
+static const REMAP_KERNEL_T* kernel = &kernels[KERNELS - 1];
+
+int remap_select_kernel(const char* name)
+{
+	int i;
+	for (i = 0; i < KERNELS; i++)
+	{
+		if ((cpu_features() & kernels[i].features) != kernels[i].features)
+			continue;
+		if (name == NULL || strcmp(name, kernels[i].name) == 0)
+		{
+			kernel = &kernels[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char* remap_kernel_name(void)
+{
+	return kernel->name;
+}
+
+// A map channel as the shader reads it: msb/255 + (lsb/255)/256, with the
+// bytes converted to floats like Mesa's texture2D does, times 1/255 rather
+// than divided by 255, which lands on the other side of a texel boundary
+// now and then
+static inline float map_channel(uint8_t msb, uint8_t lsb)
+{
+	const float unorm = 1.0f / 255.0f;
+	return (float)msb * unorm + (float)lsb * unorm / 256.0f;
+}
+
+// The texel GL_NEAREST picks for texture coordinate s, with GL_CLAMP_TO_EDGE
+static inline int nearest_texel(float s, int size)
+{
+	float t = floorf(s * (float)size);
+	if (t < 0)
+		return 0;
+	if (t >= size)
+		return size - 1;
+	return (int)t;
+}
+
+int remap_init(REMAP_T* remap,
+	const uint8_t* map_msb, const uint8_t* map_lsb,
+	int map_width, int map_height, int map_stride,
+	int src_width, int src_height, int width, int height)
+{
+	int x, y;
+
+	memset(remap, 0, sizeof(*remap));
+	remap->width = width;
+	remap->height = height;
+	remap->src_width = src_width;
+	remap->src_height = src_height;
+
+	remap->index = malloc((size_t)width * height * sizeof(uint32_t));
+	remap->alpha = malloc((size_t)width * height);
+	int* map_x = malloc(width * sizeof(int));
+	if (remap->index == NULL || remap->alpha == NULL || map_x == NULL)
+	{
+		printf("error: could not allocate memory for remap tables\n");
+		free(map_x);
+		remap_free(remap);
+		return -1;
+	}
+
+	// nearest map texel for the centre of every output pixel,
+	// tcoord = (x+0.5)/width
+	for (x = 0; x < width; x++)
+		map_x[x] = (int)(((int64_t)2*x + 1) * map_width / (2 * (int64_t)width));
+
+	for (y = 0; y < height; y++)
+	{
+		int my = (int)(((int64_t)2*y + 1) * map_height / (2 * (int64_t)height));
+		const uint8_t* msb_row = map_msb + (size_t)my * map_stride;
+		const uint8_t* lsb_row = map_lsb + (size_t)my * map_stride;
+		uint32_t* index = remap->index + (size_t)y * width;
+		uint8_t* alpha = remap->alpha + (size_t)y * width;
+
+		for (x = 0; x < width; x++)
+		{
+			const uint8_t* msb = msb_row + map_x[x] * 4;
+			const uint8_t* lsb = lsb_row + map_x[x] * 4;
+			float a = map_channel(msb[3], lsb[3]);
+			int sx = nearest_texel(map_channel(msb[0], lsb[0]), src_width);
+			int sy = nearest_texel(1.0f - map_channel(msb[1], lsb[1]), src_height);
+
+			index[x] = (uint32_t)sy * src_width + sx;
+			// written to an 8 bit framebuffer, rounded to nearest
+			alpha[x] = (uint8_t)lrintf((a < 1.0f ? a : 1.0f) * 255.0f);
+		}
+	}
+
+	free(map_x);
+
+	if (remap_plan_tiles(remap, REMAP_TILE_WIDTH, REMAP_TILE_HEIGHT) < 0)
+	{
+		remap_free(remap);
+		return -1;
+	}
+
+	return 0;
+}
+
+void remap_free(REMAP_T* remap)
+{
+	free(remap->index);
+	free(remap->alpha);
+	free(remap->tiles);
+	remap->index = NULL;
+	remap->alpha = NULL;
+	remap->tiles = NULL;
+	remap->tile_count = 0;
+}
+
+typedef struct
+{
+	REMAP_TILE_T tile;
+	uint32_t key;
+	int order;
+} TILE_KEY_T;
+
+// interleave the bits of two 16 bit values (Z-order curve)
+static uint32_t morton(uint32_t x, uint32_t y)
+{
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	y = (y | (y << 8)) & 0x00ff00ff;
+	y = (y | (y << 4)) & 0x0f0f0f0f;
+	y = (y | (y << 2)) & 0x33333333;
+	y = (y | (y << 1)) & 0x55555555;
+	return x | (y << 1);
+}
+
+static int compare_tile_keys(const void* a, const void* b)
+{
+	const TILE_KEY_T* ta = a;
+	const TILE_KEY_T* tb = b;
+	if (ta->key != tb->key)
+		return ta->key < tb->key ? -1 : 1;
+	// keep raster order between tiles reading the same region
+	return ta->order - tb->order;
+}
+
+int remap_plan_tiles(REMAP_T* remap, int tile_width, int tile_height)
+{
+	int tiles_x = (remap->width + tile_width - 1) / tile_width;
+	int tiles_y = (remap->height + tile_height - 1) / tile_height;
+	int count = tiles_x * tiles_y;
+	int i, x, y;
+
+	TILE_KEY_T* keys = malloc(count * sizeof(TILE_KEY_T));
+	REMAP_TILE_T* tiles = malloc(count * sizeof(REMAP_TILE_T));
+	if (keys == NULL || tiles == NULL)
+	{
+		printf("error: could not allocate memory for remap tiles\n");
+		free(keys);
+		free(tiles);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		REMAP_TILE_T* tile = &keys[i].tile;
+		keys[i].order = i;
+		tile->x0 = (i % tiles_x) * tile_width;
+		tile->y0 = (i / tiles_x) * tile_height;
+		tile->x1 = tile->x0 + tile_width < remap->width ? tile->x0 + tile_width : remap->width;
+		tile->y1 = tile->y0 + tile_height < remap->height ? tile->y0 + tile_height : remap->height;
+
+		// centre of the source region read by this tile
+		uint32_t min_x = UINT32_MAX, min_y = UINT32_MAX, max_x = 0, max_y = 0;
+		for (y = tile->y0; y < tile->y1; y++)
+		{
+			const uint32_t* index = remap->index + (size_t)y * remap->width;
+			for (x = tile->x0; x < tile->x1; x++)
+			{
+				uint32_t sx = index[x] % remap->src_width;
+				uint32_t sy = index[x] / remap->src_width;
+				if (sx < min_x) min_x = sx;
+				if (sx > max_x) max_x = sx;
+				if (sy < min_y) min_y = sy;
+				if (sy > max_y) max_y = sy;
+			}
+		}
+		keys[i].key = morton(((min_x + max_x) / 2) / tile_width,
+			((min_y + max_y) / 2) / tile_height);
+	}
+
+	qsort(keys, count, sizeof(TILE_KEY_T), compare_tile_keys);
+	for (i = 0; i < count; i++)
+		tiles[i] = keys[i].tile;
+	free(keys);
+
+	free(remap->tiles);
+	remap->tiles = tiles;
+	remap->tile_count = count;
+	return 0;
+}
+
+void remap_rows(const REMAP_T* remap, const uint32_t* src, uint32_t* dst,
+	int y0, int y1)
+{
+	size_t offset = (size_t)y0 * remap->width;
+	kernel->span(src, remap->index + offset, remap->alpha + offset,
+		dst + offset, (y1 - y0) * remap->width);
+}
+
+void remap_rect(const REMAP_T* remap, const uint32_t* src, uint32_t* dst,
+	int x0, int y0, int x1, int y1)
+{
+	int y;
+
+	for (y = y0; y < y1; y++)
+	{
+		size_t offset = (size_t)y * remap->width + x0;
+		kernel->span(src, remap->index + offset, remap->alpha + offset,
+			dst + offset, x1 - x0);
+	}
+}
+
+void remap_frame(const REMAP_T* remap, const uint32_t* src, uint32_t* dst)
+{
+	remap_rows(remap, src, dst, 0, remap->height);
+}
+
+typedef struct
+{
+	const REMAP_T* remap;
+	const uint32_t* src;
+	uint32_t* dst;
+} REMAP_JOB_T;
+
+static void remap_tile(void* arg, int item, int worker)
+{
+	const REMAP_JOB_T* job = arg;
+	const REMAP_TILE_T* tile = &job->remap->tiles[item];
+	remap_rect(job->remap, job->src, job->dst, tile->x0, tile->y0, tile->x1, tile->y1);
+}
+
+void remap_frame_parallel(const REMAP_T* remap, WORKERS_T* pool,
+	const uint32_t* src, uint32_t* dst)
+{
+	REMAP_JOB_T job = { remap, src, dst };
+
+	workers_run(pool, remap->tile_count, remap_tile, &job);
+}
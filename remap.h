@@ -0,0 +1,72 @@
+// CPU implementation of the UV mapping fragment shader
+
+#ifndef REMAP_H
+#define REMAP_H
+
+#include <stdint.h>
+
+#include "workers.h"
+
+// Default tile size for the parallel path: 64x32 output pixels keeps the
+// tile's index, alpha and output (18 KB) within a 32 KB L1 cache
+#define REMAP_TILE_WIDTH  64
+#define REMAP_TILE_HEIGHT 32
+
+typedef struct
+{
+	uint16_t x0, y0, x1, y1;     // output rectangle [x0,x1) x [y0,y1)
+} REMAP_TILE_T;
+
+// A map compiled against a particular source and output size. Every output
+// pixel is reduced to the index of the source texel it samples plus its
+// alpha, so remapping a frame is a plain gather.
+//
+// All images use OpenGL row order (the first row is the bottom of the image)
+// and tightly packed RGBA pixels, exactly like the planes of a MAP_T (see
+// map.h) and what glReadPixels returns.
+typedef struct
+{
+	int width, height;           // output size
+	int src_width, src_height;   // source frame size
+
+	uint32_t* index;             // source texel per output pixel
+	uint8_t* alpha;              // output alpha per output pixel
+
+	// output tiles, sorted so that tiles sampling nearby source regions
+	// are next to each other in the list
+	REMAP_TILE_T* tiles;
+	int tile_count;
+} REMAP_T;
+
+// Compile the split 16 bit map (the msb and lsb RGBA planes of a MAP_T,
+// stride in bytes) for a source and output size.
+int remap_init(REMAP_T* remap,
+	const uint8_t* map_msb, const uint8_t* map_lsb,
+	int map_width, int map_height, int map_stride,
+	int src_width, int src_height, int width, int height);
+void remap_free(REMAP_T* remap);
+
+// Split the output into tiles of the given size, ordered by the location of
+// the source region they read. remap_init plans REMAP_TILE_WIDTH x
+// REMAP_TILE_HEIGHT tiles.
+int remap_plan_tiles(REMAP_T* remap, int tile_width, int tile_height);
+
+// Remap output rows [y0, y1) of a source frame into dst
+void remap_rows(const REMAP_T* remap, const uint32_t* src, uint32_t* dst,
+	int y0, int y1);
+void remap_rect(const REMAP_T* remap, const uint32_t* src, uint32_t* dst,
+	int x0, int y0, int x1, int y1);
+void remap_frame(const REMAP_T* remap, const uint32_t* src, uint32_t* dst);
+
+// Remap a frame on all workers of the pool, one tile at a time
+void remap_frame_parallel(const REMAP_T* remap, WORKERS_T* pool,
+	const uint32_t* src, uint32_t* dst);
+
+// Kernel selection: NULL picks the fastest kernel the CPU supports. Until a
+// kernel is selected the scalar one is used. Select before any thread
+// remaps, since the choice isn't synchronised. Valid names are "scalar",
+// "sse41", "avx2" and "neon".
+int remap_select_kernel(const char* name);
+const char* remap_kernel_name(void);
+
+#endif
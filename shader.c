@@ -0,0 +1,172 @@
+// The UV mapping shader program, shared by the player and the benchmarks
+
+#include <stdio.h>
+
+#include "shader.h"
+
+static const GLchar *vshader_source =
+	"attribute vec4 vertex;"
+	"varying vec2 tcoord;"
+	"void main(void) {"
+	"  gl_Position = vertex;"
+	"  tcoord = vertex.xy*0.5+0.5;"
+	"}";
+
+// UV Mapping fragment shaders, flip source vertically. The source texture
+// holds the part of the frame in sourceRect, see shader_source_rect.
+// Samplers default to lowp, and so does arithmetic on what they return, so
+// without highp samplers a driver may add up the map planes in half floats.
+#define FSHADER_PRECISION \
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n" \
+	"precision highp float;\n" \
+	"precision highp sampler2D;\n" \
+	"#else\n" \
+	"precision mediump float;\n" \
+	"#endif\n"
+
+#define FSHADER_HEADER \
+	FSHADER_PRECISION \
+	"varying vec2 tcoord;" \
+	"uniform sampler2D source;" \
+	"uniform vec4 sourceRect;"
+
+static const GLchar *fshader_sources[] =
+{
+	// SHADER_MAP_SPLIT
+	FSHADER_HEADER
+	"uniform sampler2D mapMsb;"
+	"uniform sampler2D mapLsb;"
+	"void main(void) {"
+	"  vec4 uv = texture2D(mapMsb,tcoord) + texture2D(mapLsb,tcoord)/256.;"
+	"  uv.g = 1.0 - uv.g;"
+	"  gl_FragColor.rgb = texture2D(source, (uv.xy - sourceRect.xy) * sourceRect.zw).rgb;"
+	"  gl_FragColor.a = uv.a;"
+	"}",
+
+	// SHADER_MAP_PACKED
+	FSHADER_HEADER
+	"uniform sampler2D map;"
+	"uniform sampler2D mapAlpha;"
+	"void main(void) {"
+	"  vec4 m = texture2D(map,tcoord);"
+	"  vec2 uv = m.rb + m.ga/256.;"
+	"  uv.y = 1.0 - uv.y;"
+	"  gl_FragColor.rgb = texture2D(source, (uv - sourceRect.xy) * sourceRect.zw).rgb;"
+	"  gl_FragColor.a = texture2D(mapAlpha,tcoord).a;"
+	"}",
+
+	// SHADER_MAP_PACKED_BINARY: transparent pixels have u = 1 + 1/256
+	FSHADER_HEADER
+	"uniform sampler2D map;"
+	"void main(void) {"
+	"  vec4 m = texture2D(map,tcoord);"
+	"  vec2 uv = m.rb + m.ga/256.;"
+	"  uv.y = 1.0 - uv.y;"
+	"  gl_FragColor = vec4(texture2D(source, (uv - sourceRect.xy) * sourceRect.zw).rgb, 1.0) *"
+	"    step(uv.x, 1.002);"
+	"}",
+};
+
+// Interpolated mesh: the vertex carries the source coordinates in zw
+static const GLchar *mesh_vshader_source =
+	"attribute vec4 vertex;"
+	"varying vec2 uv;"
+	"uniform vec4 sourceRect;"
+	"void main(void) {"
+	"  gl_Position = vec4(vertex.xy, 0.0, 1.0);"
+	"  uv = (vertex.zw - sourceRect.xy) * sourceRect.zw;"
+	"}";
+
+static const GLchar *mesh_fshader_source =
+	FSHADER_PRECISION
+	"varying vec2 uv;"
+	"uniform sampler2D source;"
+	"void main(void) {"
+	"  gl_FragColor = vec4(texture2D(source, uv).rgb, 1.0);"
+	"}";
+
+// Upscale pass: "source" over the whole viewport, with the texture's filter
+static const GLchar *upscale_fshader_source =
+	FSHADER_PRECISION
+	"varying vec2 tcoord;"
+	"uniform sampler2D source;"
+	"void main(void) {"
+	"  gl_FragColor = texture2D(source, tcoord);"
+	"}";
+
+static void show_shaderlog(GLint shader)
+{
+	// Prints the compile log for a shader
+	char log[1024];
+	glGetShaderInfoLog(shader,sizeof log,NULL,log);
+	if (log[0]!=0)
+		printf("Shader (%d): %s\n", shader, log);
+}
+
+static void show_programlog(GLint shader)
+{
+	// Prints the information log for a program object
+	char log[1024];
+	glGetProgramInfoLog(shader,sizeof log,NULL,log);
+	if (log[0]!=0)
+		printf("Program (%d): %s\n", shader, log);
+}
+
+bool shader_packed_supported(void)
+{
+	GLint range[2], precision = 0;
+
+	// u + 1/65280 has to be distinguishable from u near 1.0
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+	return precision >= 16;
+}
+
+static GLuint link_program(const GLchar *vshader_source, const GLchar *fshader_source,
+	bool verbose)
+{
+	GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vshader, 1, &vshader_source, 0);
+	glCompileShader(vshader);
+
+	if (verbose)
+		 show_shaderlog(vshader);
+
+	GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fshader, 1, &fshader_source, 0);
+	glCompileShader(fshader);
+
+	if (verbose)
+		 show_shaderlog(fshader);
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vshader);
+	glAttachShader(program, fshader);
+	glLinkProgram(program);
+
+	if (verbose)
+		 show_programlog(program);
+
+	shader_source_rect(program, 0, 0, 1, 1);
+	return program;
+}
+
+GLuint shader_uvmap_program(SHADER_MAP_T format, bool verbose)
+{
+	return link_program(vshader_source, fshader_sources[format], verbose);
+}
+
+GLuint shader_mesh_program(bool verbose)
+{
+	return link_program(mesh_vshader_source, mesh_fshader_source, verbose);
+}
+
+GLuint shader_upscale_program(bool verbose)
+{
+	return link_program(vshader_source, upscale_fshader_source, verbose);
+}
+
+void shader_source_rect(GLuint program, float left, float top, float width, float height)
+{
+	glUseProgram(program);
+	glUniform4f(glGetUniformLocation(program, "sourceRect"), left, top, 1 / width, 1 / height);
+}
@@ -0,0 +1,42 @@
+// The UV mapping shader program, shared by the player and the benchmarks
+
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <stdbool.h>
+
+#include "GLES2/gl2.h"
+
+// How the map reaches the shader; see map.h for the packed layout
+typedef enum
+{
+	SHADER_MAP_SPLIT,          // msb and lsb planes: "mapMsb" and "mapLsb"
+	SHADER_MAP_PACKED,         // packed uv in "map", alpha in "mapAlpha"
+	SHADER_MAP_PACKED_BINARY,  // packed uv in "map", alpha 0 or 1 from the uv
+} SHADER_MAP_T;
+
+// True if fragment shaders have the float precision to unpack 16 bit
+// coordinates, which the packed formats need
+bool shader_packed_supported(void);
+
+// Compile and link the UV mapping program for a map format. It draws the
+// "vertex" attribute as a full screen quad and samples the map textures
+// and "source". Logs are printed if verbose.
+GLuint shader_uvmap_program(SHADER_MAP_T format, bool verbose);
+
+// Compile and link the program for the interpolated map mesh (see mesh.h):
+// the "vertex" attribute holds the position in xy and the source texture
+// coordinates in zw, and "source" is sampled without any map fetch
+GLuint shader_mesh_program(bool verbose);
+
+// Compile and link the program that scales a frame drawn at a reduced size
+// up to the screen: "vertex" is a full screen quad as for the map, and
+// "source" the frame
+GLuint shader_upscale_program(bool verbose);
+
+// The part of the frame the source texture holds, in texture coordinates of
+// the whole frame, for a decoder that crops it; both programs start out
+// with the whole frame. Leaves program in use.
+void shader_source_rect(GLuint program, float left, float top, float width, float height);
+
+#endif
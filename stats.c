@@ -0,0 +1,345 @@
+// Per-frame latency histograms and throughput counters
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+// number of frames that can be in flight between decode and swap
+#define STATS_RING 64
+
+// Log-linear (HDR style) histogram of microsecond values: values below
+// 2*HIST_SUB are exact, above that every power of two is split into
+// HIST_SUB buckets, so every bucket is within 1/HIST_SUB of its value.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct
+{
+	const char* name;
+	STATS_MARK_T from, to;
+	uint32_t count[HIST_BUCKETS];
+	uint32_t n;
+	uint64_t max;
+} STATS_HISTOGRAM_T;
+
+typedef struct
+{
+	// guards time[STATS_DECODED], which is written on another thread;
+	// odd while it is being written
+	uint32_t version;
+	uint32_t seq;
+	uint64_t time[STATS_MARKS];
+	uint32_t drawn_seq;       // render thread: the frame the other marks are of
+} STATS_FRAME_T;
+
+static struct
+{
+	STATS_FRAME_T frames[STATS_RING];
+	uint32_t decoded;
+
+	// decoder thread only: the next frame starts a pass of the movie
+	bool loop_next;
+	// last frame that started a pass, and how many did
+	uint32_t loop_seq, loops;
+
+	// decoder feed, written on the decoder thread
+	uint64_t feed_bytes, feed_wait_ns;
+	uint32_t feed_waits;
+
+	// render thread only
+	uint32_t current;
+	// coalesced: skipped, as a newer frame had arrived by the time the
+	// render thread got to it; late: drawn, but more than a frame period
+	// after it was decoded. Dropped frames, decoded but never drawn, are
+	// the coalesced ones and those decoded after the last one drawn.
+	uint32_t drawn, coalesced, late;
+	uint32_t last_seq;
+	uint64_t last_decoded;
+	double period;
+	uint64_t last_swap;
+	uint32_t last_swap_seq;
+	double swap_period;       // average swap->swap interval, ns
+
+	uint64_t report_time;
+	uint32_t report_drawn;
+} stats;
+
+static STATS_HISTOGRAM_T histograms[] =
+{
+	{ "decode->draw",  STATS_DECODED,    STATS_DRAW_START },
+	{ "draw->finish",  STATS_DRAW_START, STATS_FINISH },
+	{ "finish->swap",  STATS_FINISH,     STATS_SWAP_DONE },
+	{ "decode->swap",  STATS_DECODED,    STATS_SWAP_DONE },
+	{ "draw->gpu done", STATS_DRAW_START, STATS_GPU_DONE },
+};
+#define HISTOGRAMS (sizeof(histograms)/sizeof(histograms[0]))
+
+// time between the swaps of consecutive frames drawn, and how much longer
+// or shorter than the average of those the swaps either side of a loop
+// point were apart: the loop's jitter
+static STATS_HISTOGRAM_T interval = { "swap->swap" };
+static STATS_HISTOGRAM_T loop_jitter = { "loop jitter" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value)
+{
+	if (value < 2 * HIST_SUB)
+		return (int)value;
+	int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+// middle of the range of values in a bucket
+static double hist_value(int index)
+{
+	if (index < 2 * HIST_SUB)
+		return index;
+	int shift = index / HIST_SUB - 1;
+	uint64_t low = (uint64_t)(index % HIST_SUB + HIST_SUB) << shift;
+	return low + ((1ULL << shift) - 1) / 2.0;
+}
+
+static void hist_record(STATS_HISTOGRAM_T* hist, uint64_t value)
+{
+	hist->count[hist_index(value)]++;
+	hist->n++;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+static double hist_percentile(const STATS_HISTOGRAM_T* hist, double percentile)
+{
+	uint64_t target = (uint64_t)(percentile / 100.0 * hist->n + 0.5);
+	uint64_t seen = 0;
+	int i;
+
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += hist->count[i];
+		if (seen >= target)
+			return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+	}
+	return hist->max;
+}
+
+void stats_frame_decoded(uint32_t seq)
+{
+	STATS_FRAME_T* frame = &stats.frames[seq % STATS_RING];
+	uint64_t now = now_ns();
+
+	// seqlock write: readers retry or skip while the version is odd
+	__atomic_fetch_add(&frame->version, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	frame->seq = seq;
+	frame->time[STATS_DECODED] = now;
+	__atomic_fetch_add(&frame->version, 1, __ATOMIC_RELEASE);
+
+	if (stats.loop_next)
+	{
+		__atomic_store_n(&stats.loop_seq, seq, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.loops, 1, __ATOMIC_RELEASE);
+		stats.loop_next = false;
+	}
+	__atomic_store_n(&stats.decoded, seq, __ATOMIC_RELEASE);
+}
+
+void stats_loop_point(void)
+{
+	stats.loop_next = true;
+}
+
+// read the decode time of a frame, false if it was overwritten already
+static bool decoded_time(uint32_t seq, uint64_t* time)
+{
+	STATS_FRAME_T* frame = &stats.frames[seq % STATS_RING];
+	uint32_t version = __atomic_load_n(&frame->version, __ATOMIC_ACQUIRE);
+	if (version & 1)
+		return false;
+
+	uint32_t frame_seq = frame->seq;
+	*time = frame->time[STATS_DECODED];
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return frame_seq == seq &&
+		__atomic_load_n(&frame->version, __ATOMIC_RELAXED) == version;
+}
+
+// Record mark for frame seq, and the histograms that end or start on it
+// whose other end is known already; the GPU may finish a frame after it
+// was swapped
+static void mark_frame(uint32_t seq, STATS_MARK_T mark)
+{
+	STATS_FRAME_T* frame = &stats.frames[seq % STATS_RING];
+	uint64_t decoded;
+	bool have_decoded;
+	int i;
+
+	if (frame->drawn_seq != seq)
+		return;
+	frame->time[mark] = now_ns();
+
+	have_decoded = decoded_time(seq, &decoded);
+	for (i = 0; i < HISTOGRAMS; i++)
+	{
+		if (histograms[i].from != mark && histograms[i].to != mark)
+			continue;
+		uint64_t from = histograms[i].from == STATS_DECODED ?
+			(have_decoded ? decoded : 0) : frame->time[histograms[i].from];
+		uint64_t to = frame->time[histograms[i].to];
+		if (from != 0 && to >= from)
+			hist_record(&histograms[i], (to - from) / 1000);
+	}
+}
+
+void stats_draw_start(uint32_t seq, uint32_t coalesced)
+{
+	STATS_FRAME_T* frame = &stats.frames[seq % STATS_RING];
+
+	stats.current = seq;
+	stats.coalesced += coalesced;
+	frame->drawn_seq = seq;
+	frame->time[STATS_FINISH] = 0;
+	frame->time[STATS_SWAP_DONE] = 0;
+	frame->time[STATS_GPU_DONE] = 0;
+	mark_frame(seq, STATS_DRAW_START);
+}
+
+void stats_gpu_done(uint32_t seq)
+{
+	STATS_FRAME_T* frame = &stats.frames[seq % STATS_RING];
+
+	if (frame->drawn_seq == seq && frame->time[STATS_GPU_DONE] == 0)
+		mark_frame(seq, STATS_GPU_DONE);
+}
+
+void stats_mark(STATS_MARK_T mark)
+{
+	STATS_FRAME_T* frame = &stats.frames[stats.current % STATS_RING];
+
+	mark_frame(stats.current, mark);
+	if (mark == STATS_FINISH)
+		mark_frame(stats.current, STATS_GPU_DONE);
+	if (mark != STATS_SWAP_DONE)
+		return;
+
+	// throughput is measured from the first frame on screen
+	if (++stats.drawn == 1)
+	{
+		stats.report_time = frame->time[STATS_SWAP_DONE];
+		stats.report_drawn = stats.drawn;
+	}
+
+	// a loop point lies between the last frame drawn and this one, even if
+	// the first frame of the pass was coalesced away
+	if (stats.last_swap != 0)
+	{
+		uint32_t loop_seq = __atomic_load_n(&stats.loop_seq, __ATOMIC_RELAXED);
+		bool loop = __atomic_load_n(&stats.loops, __ATOMIC_ACQUIRE) > 0 &&
+			(int32_t)(loop_seq - stats.last_swap_seq) > 0 && (int32_t)(stats.current - loop_seq) >= 0;
+		uint64_t gap = frame->time[STATS_SWAP_DONE] - stats.last_swap;
+
+		if (!loop)
+		{
+			hist_record(&interval, gap / 1000);
+			stats.swap_period = stats.swap_period > 0 ? 0.9 * stats.swap_period + 0.1 * gap : gap;
+		}
+		else if (stats.swap_period > 0)
+		{
+			double jitter = gap - stats.swap_period;
+			hist_record(&loop_jitter, (uint64_t)(jitter < 0 ? -jitter : jitter) / 1000);
+		}
+	}
+	stats.last_swap = frame->time[STATS_SWAP_DONE];
+	stats.last_swap_seq = stats.current;
+
+	uint64_t decoded;
+	if (!decoded_time(stats.current, &decoded))
+		return;
+
+	// estimate the frame period from the decode times, and count frames
+	// that reached the screen more than one period after they were decoded
+	if (stats.last_decoded != 0 && stats.current > stats.last_seq)
+	{
+		double period = (double)(decoded - stats.last_decoded) / (stats.current - stats.last_seq);
+		stats.period = stats.period > 0 ? 0.9 * stats.period + 0.1 * period : period;
+	}
+	stats.last_seq = stats.current;
+	stats.last_decoded = decoded;
+
+	if (stats.period > 0 && frame->time[STATS_SWAP_DONE] - decoded > stats.period)
+		stats.late++;
+}
+
+void stats_feed_read(uint64_t bytes)
+{
+	__atomic_fetch_add(&stats.feed_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void stats_feed_wait(uint64_t ns)
+{
+	__atomic_fetch_add(&stats.feed_waits, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats.feed_wait_ns, ns, __ATOMIC_RELAXED);
+}
+
+static void print_histogram(const STATS_HISTOGRAM_T* hist)
+{
+	if (hist->n == 0)
+		return;
+	printf("  %-14s %8.3f %8.3f %8.3f %8.3f %8.3f\n", hist->name,
+		hist_percentile(hist, 50) / 1000, hist_percentile(hist, 90) / 1000,
+		hist_percentile(hist, 99) / 1000, hist_percentile(hist, 99.9) / 1000,
+		hist->max / 1000.0);
+}
+
+void stats_print(void)
+{
+	uint64_t now = now_ns();
+	int i;
+
+	double elapsed = (now - stats.report_time) * 1e-9;
+	double fps = stats.report_time != 0 && elapsed > 0 ?
+		(stats.drawn - stats.report_drawn) / elapsed : 0;
+	uint32_t decoded = __atomic_load_n(&stats.decoded, __ATOMIC_ACQUIRE);
+	uint32_t dropped = stats.coalesced + (decoded - stats.current);
+
+	printf("frames: decoded %u, drawn %u (%.1f fps), coalesced %u, dropped %u, late %u\n",
+		decoded, stats.drawn, fps, stats.coalesced, dropped, stats.late);
+	printf("  latency (ms)       p50      p90      p99    p99.9      max\n");
+	for (i = 0; i < HISTOGRAMS; i++)
+		print_histogram(&histograms[i]);
+	print_histogram(&interval);
+	print_histogram(&loop_jitter);
+	uint32_t loops = __atomic_load_n(&stats.loops, __ATOMIC_ACQUIRE);
+	if (loops > 0)
+		printf("  loop points: %u\n", loops);
+
+	uint64_t feed_bytes = __atomic_load_n(&stats.feed_bytes, __ATOMIC_RELAXED);
+	if (feed_bytes != 0)
+	{
+		printf("  decoder feed: %.1f MB read, %u waits for the file, %.3f ms waiting\n",
+			feed_bytes / 1e6, __atomic_load_n(&stats.feed_waits, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats.feed_wait_ns, __ATOMIC_RELAXED) / 1e6);
+	}
+
+	stats.report_time = now;
+	stats.report_drawn = stats.drawn;
+}
+
+void stats_report(double interval)
+{
+	uint64_t now = now_ns();
+
+	if (stats.report_time != 0 && now - stats.report_time >= interval * 1e9)
+		stats_print();
+}
@@ -0,0 +1,47 @@
+// Per-frame latency histograms and throughput counters
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Points in a frame's life. DECODED is recorded on the OMX callback thread,
+// the others on the render thread.
+typedef enum
+{
+	STATS_DECODED,         // egl_render filled the texture
+	STATS_DRAW_START,      // the render thread picked the frame up
+	STATS_FINISH,          // the GPU finished drawing it, before the swap
+	STATS_SWAP_DONE,       // eglSwapBuffers returned
+	STATS_GPU_DONE,        // the GPU was seen to be done with it, at FINISH
+	                       // or, in pipelined mode, possibly after the swap
+	STATS_MARKS
+} STATS_MARK_T;
+
+// Record the decode of frame seq; lock-free, safe from any thread
+void stats_frame_decoded(uint32_t seq);
+
+// Decoder thread, before the frame is passed on: the next decoded frame is
+// the first of a new pass through a looping movie
+void stats_loop_point(void);
+
+// Render thread: start drawing frame seq, after skipping coalesced frames
+void stats_draw_start(uint32_t seq, uint32_t coalesced);
+// Render thread: record a mark for the frame being drawn
+void stats_mark(STATS_MARK_T mark);
+// Render thread: the GPU finished frame seq, which may have been swapped
+// already; does nothing if the frame marked STATS_FINISH
+void stats_gpu_done(uint32_t seq);
+
+// Decoder feed: bytes handed to the decoder, and time it waited for the
+// file to be read; lock-free, safe from any thread
+void stats_feed_read(uint64_t bytes);
+void stats_feed_wait(uint64_t ns);
+
+// Print counters and latency percentiles; stats_report only does so every
+// interval seconds and is meant to be called once per frame
+void stats_print(void);
+void stats_report(double interval);
+
+#endif
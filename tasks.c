@@ -0,0 +1,150 @@
+// Small dependency graph for the startup work: every task runs as soon as
+// the tasks it depends on are done, GL tasks on the thread that owns the
+// context and the others on a thread of their own
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "tasks.h"
+
+typedef struct
+{
+	TASK_T* tasks;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint32_t done, failed;
+} TASKS_GRAPH_T;
+
+typedef struct
+{
+	TASKS_GRAPH_T* graph;
+	int index;
+} TASKS_THREAD_T;
+
+double tasks_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// With the lock held: wait until task index can run; false if it is skipped
+static bool wait_for_dependencies(TASKS_GRAPH_T* graph, int index)
+{
+	TASK_T* task = &graph->tasks[index];
+
+	while ((graph->done & task->after) != task->after && !(graph->failed & task->after))
+		pthread_cond_wait(&graph->changed, &graph->lock);
+	return !(graph->failed & task->after);
+}
+
+// With the lock held: run task index without it and record the result
+static void run_task(TASKS_GRAPH_T* graph, int index, bool run)
+{
+	TASK_T* task = &graph->tasks[index];
+
+	task->start = task->end = tasks_now();
+	task->status = TASK_SKIPPED;
+	if (run || task->skipped != NULL)
+	{
+		pthread_mutex_unlock(&graph->lock);
+		if (run)
+			task->status = task->fn(task->arg);
+		else
+			task->skipped(task->arg);
+		task->end = tasks_now();
+		pthread_mutex_lock(&graph->lock);
+	}
+
+	graph->done |= TASK_AFTER(index);
+	if (task->status < 0)
+		graph->failed |= TASK_AFTER(index);
+	pthread_cond_broadcast(&graph->changed);
+}
+
+static void* task_thread(void* arg)
+{
+	TASKS_THREAD_T* thread = arg;
+	TASKS_GRAPH_T* graph = thread->graph;
+
+	pthread_mutex_lock(&graph->lock);
+	run_task(graph, thread->index, wait_for_dependencies(graph, thread->index));
+	pthread_mutex_unlock(&graph->lock);
+	return NULL;
+}
+
+int tasks_run(TASK_T* tasks, int count)
+{
+	TASKS_GRAPH_T graph = { tasks, count, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+	TASKS_THREAD_T threads[TASKS_MAX];
+	pthread_t ids[TASKS_MAX];
+	bool started[TASKS_MAX] = { false };
+	uint32_t gl_pending = 0;
+	int i;
+
+	if (count > TASKS_MAX)
+		return -1;
+
+	for (i = 0; i < count; i++)
+	{
+		threads[i].graph = &graph;
+		threads[i].index = i;
+		if (tasks[i].gl)
+			gl_pending |= TASK_AFTER(i);
+		else if (pthread_create(&ids[i], NULL, task_thread, &threads[i]) == 0)
+			started[i] = true;
+		else
+		{
+			// run it here then, in its turn with the GL tasks
+			gl_pending |= TASK_AFTER(i);
+		}
+	}
+
+	// run the GL tasks, each as soon as it can, in the order given
+	pthread_mutex_lock(&graph.lock);
+	while (gl_pending != 0)
+	{
+		for (i = 0; i < count; i++)
+		{
+			TASK_T* task = &tasks[i];
+			if (!(gl_pending & TASK_AFTER(i)))
+				continue;
+			if ((graph.done & task->after) == task->after || (graph.failed & task->after))
+				break;
+		}
+
+		if (i == count)
+		{
+			pthread_cond_wait(&graph.changed, &graph.lock);
+			continue;
+		}
+		gl_pending &= ~TASK_AFTER(i);
+		run_task(&graph, i, !(graph.failed & tasks[i].after));
+	}
+	pthread_mutex_unlock(&graph.lock);
+
+	for (i = 0; i < count; i++)
+	{
+		if (started[i])
+			pthread_join(ids[i], NULL);
+	}
+
+	return graph.failed != 0 ? -1 : 0;
+}
+
+void tasks_print(const TASK_T* tasks, int count, double origin)
+{
+	int i;
+
+	printf("Startup timeline    start (ms)    end (ms)\n");
+	for (i = 0; i < count; i++)
+	{
+		const TASK_T* task = &tasks[i];
+		printf("  %-16s %10.1f %11.1f  %s%s\n", task->name,
+			(task->start - origin) * 1e3, (task->end - origin) * 1e3,
+			task->gl ? "gl" : "worker",
+			task->status == TASK_SKIPPED ? ", skipped" : task->status < 0 ? ", failed" : "");
+	}
+}
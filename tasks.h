@@ -0,0 +1,43 @@
+// Small dependency graph for the startup work: every task runs as soon as
+// the tasks it depends on are done, GL tasks on the thread that owns the
+// context and the others on a thread of their own
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TASKS_MAX 32
+#define TASK_AFTER(index) (1u << (index))
+
+// status of a task that didn't run because a dependency failed
+#define TASK_SKIPPED -1000
+
+typedef struct
+{
+	const char* name;
+	int (*fn)(void* arg);     // returns < 0 on failure
+	void* arg;
+	bool gl;                  // makes GL calls
+	uint32_t after;           // TASK_AFTER() of every task this needs
+	// called instead of fn if a dependency failed, to let go of tasks that
+	// wait for this one; may be NULL
+	void (*skipped)(void* arg);
+
+	// filled in by tasks_run
+	int status;
+	double start, end;        // CLOCK_MONOTONIC seconds
+} TASK_T;
+
+// Run count tasks, with the GL ones on the calling thread. Returns 0 if
+// every task succeeded.
+int tasks_run(TASK_T* tasks, int count);
+
+// Print when every task ran, relative to origin (CLOCK_MONOTONIC seconds)
+void tasks_print(const TASK_T* tasks, int count, double origin);
+
+// CLOCK_MONOTONIC in seconds
+double tasks_now(void);
+
+#endif
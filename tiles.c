@@ -0,0 +1,152 @@
+// Tile occupancy of a map, so that only the parts of the screen with
+// visible pixels are drawn
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiles.h"
+
+typedef struct
+{
+	int x0, x1, y0, y1;       // in tiles, [x0,x1) x [y0,y1)
+} TILES_RECT_T;
+
+int tiles_init(TILES_T* tiles, int map_width, int map_height)
+{
+	tiles->width = map_width;
+	tiles->height = map_height;
+	tiles->columns = (map_width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles->rows = (map_height + TILE_SIZE - 1) / TILE_SIZE;
+	tiles->occupied = calloc((size_t)tiles->columns * tiles->rows, 1);
+	return tiles->occupied != NULL ? 0 : -1;
+}
+
+void tiles_free(TILES_T* tiles)
+{
+	free(tiles->occupied);
+	tiles->occupied = NULL;
+}
+
+void tiles_add_band(TILES_T* tiles, const MAP_BAND_T* band)
+{
+	int x, y;
+
+	for (y = 0; y < band->rows; y++)
+	{
+		const uint8_t* msb = band->msb + (size_t)y * band->stride;
+		const uint8_t* lsb = band->lsb + (size_t)y * band->stride;
+		uint8_t* row = tiles->occupied + (size_t)((band->y + y) / TILE_SIZE) * tiles->columns;
+
+		for (x = 0; x < band->width; x++)
+		{
+			// alpha rounds to 0 below msb 0, lsb 128
+			if (msb[x * 4 + 3] != 0 || lsb[x * 4 + 3] >= 128)
+			{
+				row[x / TILE_SIZE] = 1;
+				// nothing more to learn from this tile on this row
+				x = (x / TILE_SIZE + 1) * TILE_SIZE - 1;
+			}
+		}
+	}
+}
+
+int tiles_count_occupied(const TILES_T* tiles)
+{
+	int i, n = 0;
+	for (i = 0; i < tiles->columns * tiles->rows; i++)
+		n += tiles->occupied[i];
+	return n;
+}
+
+static float clip_x(const TILES_T* tiles, int column)
+{
+	int x = column * TILE_SIZE < tiles->width ? column * TILE_SIZE : tiles->width;
+	return 2.0f * x / tiles->width - 1.0f;
+}
+
+static float clip_y(const TILES_T* tiles, int row)
+{
+	int y = row * TILE_SIZE < tiles->height ? row * TILE_SIZE : tiles->height;
+	return 2.0f * y / tiles->height - 1.0f;
+}
+
+int tiles_vertices(const TILES_T* tiles, float** vertices)
+{
+	// at most one rectangle per tile
+	TILES_RECT_T* rects = malloc((size_t)tiles->columns * tiles->rows * sizeof(TILES_RECT_T));
+	int count = 0, open = 0;
+	int x, y, i;
+
+	if (rects == NULL)
+		return -1;
+
+	// split every row into runs of occupied tiles, and extend the rectangle
+	// of the row below where a run spans exactly the same columns
+	for (y = 0; y < tiles->rows; y++)
+	{
+		const uint8_t* row = tiles->occupied + (size_t)y * tiles->columns;
+		int row_start = count;
+
+		for (x = 0; x < tiles->columns; x++)
+		{
+			if (!row[x])
+				continue;
+			int x0 = x;
+			while (x < tiles->columns && row[x])
+				x++;
+
+			// rectangles [open, row_start) end at the row below
+			for (i = open; i < row_start; i++)
+			{
+				if (rects[i].x0 == x0 && rects[i].x1 == x)
+					break;
+			}
+			if (i < row_start)
+				rects[i].y1 = y + 1;
+			else
+			{
+				TILES_RECT_T rect = { x0, x, y, y + 1 };
+				rects[count++] = rect;
+			}
+		}
+
+		// move the extended rectangles next to the new ones, so that all
+		// rectangles reaching this row are [open, count) for the next
+		int n = row_start;
+		for (i = open; i < n; )
+		{
+			if (rects[i].y1 == y + 1)
+			{
+				TILES_RECT_T rect = rects[i];
+				rects[i] = rects[--n];
+				rects[n] = rect;
+			}
+			else
+				i++;
+		}
+		open = n;
+	}
+
+	float* v = malloc((size_t)count * 6 * 4 * sizeof(float));
+	if (v == NULL)
+	{
+		free(rects);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		float x0 = clip_x(tiles, rects[i].x0), x1 = clip_x(tiles, rects[i].x1);
+		float y0 = clip_y(tiles, rects[i].y0), y1 = clip_y(tiles, rects[i].y1);
+		const float quad[6][4] =
+		{
+			{ x0, y0, 1, 1 }, { x1, y0, 1, 1 }, { x1, y1, 1, 1 },
+			{ x0, y0, 1, 1 }, { x1, y1, 1, 1 }, { x0, y1, 1, 1 },
+		};
+		memcpy(v + i * 24, quad, sizeof(quad));
+	}
+
+	free(rects);
+	*vertices = v;
+	return count * 6;
+}
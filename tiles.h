@@ -0,0 +1,35 @@
+// Tile occupancy of a map, so that only the parts of the screen with
+// visible pixels are drawn
+
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdint.h>
+
+#include "map.h"
+
+// map texels per tile side
+#define TILE_SIZE 32
+
+typedef struct
+{
+	int width, height;        // map size
+	int columns, rows;
+	uint8_t* occupied;        // per tile, row 0 at the bottom like the map
+} TILES_T;
+
+int tiles_init(TILES_T* tiles, int map_width, int map_height);
+void tiles_free(TILES_T* tiles);
+
+// Mark the tiles in which a band of the map has any pixel with alpha
+void tiles_add_band(TILES_T* tiles, const MAP_BAND_T* band);
+
+int tiles_count_occupied(const TILES_T* tiles);
+
+// Cover the occupied tiles with as few rectangles as possible, as a
+// GL_TRIANGLES list of vec4 clip space positions for the full screen
+// vertex shader (tcoord follows from the position). Returns the number of
+// vertices, or -1 if out of memory; *vertices is malloc'ed.
+int tiles_vertices(const TILES_T* tiles, float** vertices);
+
+#endif
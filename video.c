@@ -36,44 +36,306 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "bcm_host.h"
 #include "ilclient.h"
 
+#include "demux.h"
+#include "h264.h"
+#include "imagering.h"
+#include "keyframes.h"
+#include "readahead.h"
+#include "stats.h"
+#include "video.h"
+
+#include "EGL/eglext.h"
+
+static IMAGE_RING_T ring;
+static int texture_width, texture_height;
+static COMPONENT_T* video_render = NULL;
+static int status = 0;
+static bool batch = false;
+
+// Where the decoder input comes from: a raw H.264 stream, read ahead in
+// 16 KB packets without timestamps, or a container with one access unit
+// per buffer, or a few buffers for a large one, stamped with its time
 typedef struct
 {
-	char* filename;
+	READAHEAD_T* in;
+	DEMUX_T* demux;
 	bool loop;
-	void* egl_image;
-} VIDEO_INFO;
+	bool config_sent;
+	bool first;
+	int64_t offset;           // added to the timestamps of this pass
+} FEED_T;
 
-static OMX_BUFFERHEADERTYPE* eglBuffer = NULL;
-static COMPONENT_T* video_render = NULL;
-static int status = 0;
+static FEED_T feed;
+static uint64_t frames_decoded = 0;
+
+static void frame_decoded(void)
+{
+	// the first frame of every pass after the first is a loop point
+	uint64_t per_pass = feed.demux != NULL ? demux_frames(feed.demux) : readahead_pictures(feed.in);
+	if (feed.loop && per_pass > 0 && frames_decoded > 0 && frames_decoded % per_pass == 0)
+		stats_loop_point();
+	frames_decoded++;
 
-// forward declaration
-void set_frame_available();
-void set_status(int status);
+	set_frame_available();
+}
 
+static int fill_buffer(void* context, void* buffer)
+{
+	if (OMX_FillThisBuffer(ilclient_get_handle(video_render), buffer) != OMX_ErrorNone)
+	{
+		printf("OMX_FillThisBuffer failed\n");
+		return -1;
+	}
+	return 0;
+}
 
 void my_fill_buffer_done(void* data, COMPONENT_T* comp)
 {
+	OMX_BUFFERHEADERTYPE* buf;
+
 	//printf("FillBufferDoneCallback");
-	if (status == 0)
+	// ilclient queues the filled buffers; the ring decides which of them go
+	// back to egl_render now, and which once the renderer is done with them
+	while ((buf = ilclient_get_output_buffer(comp, 221, 0)) != NULL)
 	{
-		if (OMX_FillThisBuffer(ilclient_get_handle(video_render), eglBuffer) != OMX_ErrorNone)
-		{
-			printf("OMX_FillThisBuffer failed in callback\n");
+		if (image_ring_filled(&ring, buf) < 0)
 			exit(1);
+		if (status == 0)
+			frame_decoded();
+	}
+}
+
+
+
+int video_attach_texture(EGLDisplay display, EGLContext context, GLuint texture,
+	int width, int height, void** target)
+{
+	IMAGE_RING_OPS_T ops = { fill_buffer, NULL };
+	int i;
+
+	// egl_render draws into the textures through EGL images: the first one
+	// is the texture passed in, the others are made the same
+	image_ring_init(&ring, IMAGE_RING_SIZE, &ops, false);
+	texture_width = width;
+	texture_height = height;
+	for (i = 0; i < ring.count; i++)
+	{
+		IMAGE_SLOT_T* slot = &ring.slots[i];
+
+		if (i == 0)
+			slot->texture = texture;
+		else
+		{
+			glGenTextures(1, &slot->texture);
+			glBindTexture(GL_TEXTURE_2D, slot->texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+							 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		slot->image = eglCreateImageKHR(
+						 display,
+						 context,
+						 EGL_GL_TEXTURE_2D_KHR,
+						 (EGLClientBuffer)slot->texture,
+						 0);
+
+		if (slot->image == EGL_NO_IMAGE_KHR)
+		{
+			printf("error: eglCreateImageKHR failed.\n");
+			return -1;
 		}
+	}
+
+	*target = &ring;
+	return 0;
+}
+
+void video_detach_texture(EGLDisplay display, void* target)
+{
+	int i;
+
+	for (i = 0; i < ring.count; i++)
+	{
+		if (ring.slots[i].image != NULL && !eglDestroyImageKHR(display, (EGLImageKHR)ring.slots[i].image))
+			printf("eglDestroyImageKHR failed.");
+		if (i > 0)
+			glDeleteTextures(1, &ring.slots[i].texture);
+	}
+	image_ring_destroy(&ring);
+}
+
+GLuint video_update_texture(void)
+{
+	// egl_render has filled the textures already, only pick the latest
+	return image_ring_acquire(&ring);
+}
+
+void video_release_texture(void)
+{
+	if (image_ring_release(&ring) < 0)
+		exit(1);
+}
+
+
+static OMX_TICKS omx_ticks(int64_t us)
+{
+#ifdef OMX_SKIP64BIT
+	OMX_TICKS ticks;
+	ticks.nLowPart = (OMX_U32)us;
+	ticks.nHighPart = (OMX_U32)((uint64_t)us >> 32);
+	return ticks;
+#else
+	return us;
+#endif
+}
+
+// Fill a decoder input buffer; returns the bytes in it, 0 at the end
+static unsigned int feed_buffer(FEED_T* feed, OMX_BUFFERHEADERTYPE* buf, unsigned int packet_size)
+{
+	const DEMUX_SAMPLE_T* sample;
+	unsigned int data_len;
+	bool end;
+
+	buf->nOffset = 0;
+	if (feed->demux == NULL)
+	{
+		// the last buffer of a pass ends on its last access unit, and the next
+		// one starts with the first GOP again
+		data_len = readahead_read(feed->in, buf->pBuffer, packet_size, &end);
+		buf->nFlags = (feed->first ? OMX_BUFFERFLAG_STARTTIME : OMX_BUFFERFLAG_TIME_UNKNOWN) |
+			(end ? OMX_BUFFERFLAG_ENDOFFRAME : 0);
+		feed->first = false;
+		return data_len;
+	}
+
+	if (!feed->config_sent)
+	{
+		size_t size;
+		const uint8_t* config = demux_config(feed->demux, &size);
+		if (size > buf->nAllocLen)
+			size = buf->nAllocLen;
+		memcpy(buf->pBuffer, config, size);
+		buf->nFlags = OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME;
+		feed->config_sent = true;
+		return size;
+	}
+
+	data_len = demux_read(feed->demux, buf->pBuffer, buf->nAllocLen, &sample, &end);
+	if (data_len == 0 && feed->loop)
+	{
+		// carry the timestamps on, so the clock never sees them go back
+		feed->offset += demux_duration(feed->demux);
+		demux_rewind(feed->demux);
+		data_len = demux_read(feed->demux, buf->pBuffer, buf->nAllocLen, &sample, &end);
+	}
+	if (data_len == 0)
+		return 0;
+
+	buf->nTimeStamp = omx_ticks(feed->offset + sample->pts);
+	buf->nFlags = (feed->first ? OMX_BUFFERFLAG_STARTTIME : 0) | (end ? OMX_BUFFERFLAG_ENDOFFRAME : 0);
+	feed->first = false;
+	return data_len;
+}
+
+// MP4 and Matroska are demuxed from a mapping of the file; a raw stream
+// is read on a thread of its own, which carries on from the start of the
+// range when looping. A raw stream has no index to find the range in, so
+// one of its keyframes is made once and cached next to it.
+static int open_feed(const VIDEO_INFO* info, FEED_T* feed)
+{
+	uint64_t start = 0, end = 0;
+
+	if (demux_open(info->filename, (size_t)info->readahead * READAHEAD_CHUNK,
+		(int64_t)(info->start * 1000000), (int64_t)(info->end * 1000000), &feed->demux) != 0)
+		return -1;
+	if (feed->demux != NULL)
+		return 0;
 
-		set_frame_available();
+	if (info->start > 0 || info->end > 0)
+	{
+		KEYFRAMES_T index;
+		int first, last;
+
+		if (keyframes_load(info->filename, &index, info->verbose) < 0)
+			return -1;
+
+		// the range is widened to whole GOPs
+		first = keyframes_find(&index, info->start, false);
+		last = info->end > 0 ? keyframes_find(&index, info->end, true) : index.count;
+		if (last <= first)
+			last = first + 1;
+		start = index.keyframes[first].offset;
+		end = last < index.count ? index.keyframes[last].offset : 0;
+		if (info->verbose)
+			printf("Playing from %.3f s to %.3f s\n", keyframes_time(&index, first),
+				last < index.count ? keyframes_time(&index, last) : index.pictures / index.fps);
+		keyframes_free(&index);
 	}
+
+	feed->in = readahead_open(info->filename, info->readahead, info->loop, start, end);
+	return feed->in != NULL ? 0 : -1;
+}
+
+static void close_feed(FEED_T* feed)
+{
+	readahead_close(feed->in);
+	demux_close(feed->demux);
 }
 
+// The resize component crops the decoded frames to the part the map
+// samples and scales that to the size of the textures, so egl_render only
+// converts and writes what is drawn
+static int setup_resize(COMPONENT_T* resize, const VIDEO_CROP_T* crop)
+{
+	OMX_CONFIG_RECTTYPE rect;
+	OMX_PARAM_PORTDEFINITIONTYPE portdef;
+
+	memset(&rect, 0, sizeof(rect));
+	rect.nSize = sizeof(rect);
+	rect.nVersion.nVersion = OMX_VERSION;
+	rect.nPortIndex = 60;
+	rect.nLeft = crop->left;
+	rect.nTop = crop->top;
+	rect.nWidth = crop->width;
+	rect.nHeight = crop->height;
+	if (OMX_SetConfig(ILC_GET_HANDLE(resize), OMX_IndexConfigCommonInputCrop, &rect) != OMX_ErrorNone)
+	{
+		printf("error: resize doesn't take the crop %d x %d at %d, %d.\n",
+			crop->width, crop->height, crop->left, crop->top);
+		return -1;
+	}
 
+	memset(&portdef, 0, sizeof(portdef));
+	portdef.nSize = sizeof(portdef);
+	portdef.nVersion.nVersion = OMX_VERSION;
+	portdef.nPortIndex = 61;
+	if (OMX_GetParameter(ILC_GET_HANDLE(resize), OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone)
+	{
+		printf("OMX_GetParameter failed.\n");
+		return -1;
+	}
+	portdef.format.video.nFrameWidth = texture_width;
+	portdef.format.video.nFrameHeight = texture_height;
+	portdef.format.video.nStride = 0;
+	portdef.format.video.nSliceHeight = 0;
+	portdef.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+	if (OMX_SetParameter(ILC_GET_HANDLE(resize), OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone)
+	{
+		printf("error: resize doesn't scale to %d x %d.\n", texture_width, texture_height);
+		return -1;
+	}
+	return 0;
+}
 
-void* video_decode(VIDEO_INFO* arg)
+void* video_decode(void* arg)
 {
-	VIDEO_INFO videoInfo = *arg;
+	VIDEO_INFO videoInfo = *(VIDEO_INFO*)arg;
 
-	if (videoInfo.egl_image == 0)
+	if (videoInfo.target == 0)
 	{
 		printf("eglImage is null.\n");
 		exit(1);
@@ -81,30 +343,37 @@ void* video_decode(VIDEO_INFO* arg)
 
 	OMX_VIDEO_PARAM_PORTFORMATTYPE format;
 	OMX_TIME_CONFIG_CLOCKSTATETYPE cstate;
-	COMPONENT_T *video_decode = NULL, *video_scheduler = NULL, *clock = NULL;
-	COMPONENT_T *list[5];
-	TUNNEL_T tunnel[4];
+	COMPONENT_T *video_decode = NULL, *video_scheduler = NULL, *clock = NULL, *resize = NULL;
+	COMPONENT_T *list[6], *source;
+	TUNNEL_T tunnel[5], *to_render, *clock_tunnel = NULL, *t;
+	int source_port;
 	ILCLIENT_T *client;
-	FILE *in;
 	unsigned int data_len = 0;
 	int packet_size = 16<<10;
 
 	memset(list, 0, sizeof(list));
 	memset(tunnel, 0, sizeof(tunnel));
 
-	if((in = fopen(videoInfo.filename, "rb")) == NULL)
+	memset(&feed, 0, sizeof(feed));
+	frames_decoded = 0;
+	feed.loop = videoInfo.loop;
+	feed.first = true;
+	if(open_feed(&videoInfo, &feed) < 0)
+	{
+		close_feed(&feed);
 		return (void *)-2;
+	}
 
 	if((client = ilclient_init()) == NULL)
 	{
-		fclose(in);
+		close_feed(&feed);
 		return (void *)-3;
 	}
 
 	if(OMX_Init() != OMX_ErrorNone)
 	{
 		ilclient_destroy(client);
-		fclose(in);
+		close_feed(&feed);
 		return (void *)-4;
 	}
 
@@ -141,12 +410,41 @@ void* video_decode(VIDEO_INFO* arg)
 		status = -14;
 	list[3] = video_scheduler;
 
-	set_tunnel(tunnel, video_decode, 131, video_scheduler, 10);
-	set_tunnel(tunnel+1, video_scheduler, 11, video_render, 220);
-	set_tunnel(tunnel+2, clock, 80, video_scheduler, 12);
+	// create resize, only to crop
+	if(status == 0 && videoInfo.crop.width > 0 &&
+		ilclient_create_component(client, &resize, "resize", ILCLIENT_DISABLE_ALL_PORTS) != 0)
+		status = -14;
+	list[4] = resize;
+
+	// the chain from the decoder to egl_render, through the scheduler
+	// unless in batch mode, where egl_render takes frames as fast as they
+	// are decoded and holding its buffers back holds the decoder back
+	batch = videoInfo.batch;
+	source = video_decode;
+	source_port = 131;
+	t = tunnel;
+	if (!batch)
+	{
+		set_tunnel(t++, source, source_port, video_scheduler, 10);
+		source = video_scheduler;
+		source_port = 11;
+	}
+	if (resize != NULL)
+	{
+		set_tunnel(t++, source, source_port, resize, 60);
+		source = resize;
+		source_port = 61;
+	}
+	to_render = t;
+	set_tunnel(t++, source, source_port, video_render, 220);
+	if (!batch)
+	{
+		clock_tunnel = t;
+		set_tunnel(t++, clock, 80, video_scheduler, 12);
+	}
 
 	// setup clock tunnel first
-	if(status == 0 && ilclient_setup_tunnel(tunnel+2, 0, 0) != 0)
+	if(status == 0 && !batch && ilclient_setup_tunnel(clock_tunnel, 0, 0) != 0)
 		status = -15;
 	else
 		ilclient_change_component_state(clock, OMX_StateExecuting);
@@ -165,29 +463,14 @@ void* video_decode(VIDEO_INFO* arg)
 		ilclient_enable_port_buffers(video_decode, 130, NULL, NULL, NULL) == 0)
 	{
 		OMX_BUFFERHEADERTYPE *buf;
-		int port_settings_changed = 0;
-		int first_packet = 1;
+		int port_settings_changed = 0, i;
 
 		ilclient_change_component_state(video_decode, OMX_StateExecuting);
 
 		while((buf = ilclient_get_input_buffer(video_decode, 130, 1)) != NULL)
 		{
 			// feed data and wait until we get port settings changed
-			unsigned char *dest = buf->pBuffer;
-
-			// loop if at end
-			if (feof(in))
-			{
-				if(videoInfo.loop)
-					rewind(in);
-				else
-				{	
-					status = -1;
-					break;
-				}
-			}
-				
-			data_len += fread(dest, 1, packet_size-data_len, in);
+			data_len = feed_buffer(&feed, buf, packet_size);
 
 			if(port_settings_changed == 0 &&
 				((data_len > 0 && ilclient_remove_event(video_decode, OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) ||
@@ -202,21 +485,46 @@ void* video_decode(VIDEO_INFO* arg)
 					break;
 				}
 
-				ilclient_change_component_state(video_scheduler, OMX_StateExecuting);
-
-				// now setup tunnel to video_render
-				if(ilclient_setup_tunnel(tunnel+1, 0, 1000) != 0)
+				// now start the scheduler and resize and setup the tunnels
+				// on to video_render
+				for (t = tunnel + 1; t <= to_render && status == 0; t++)
 				{
-					status = -12;
-					break;
+					if (t->source == resize && setup_resize(resize, &videoInfo.crop) < 0)
+						status = -16;
+					else
+					{
+						ilclient_change_component_state(t->source, OMX_StateExecuting);
+						if(ilclient_setup_tunnel(t, 0, 1000) != 0)
+							status = -12;
+					}
 				}
+				if (status != 0)
+					break;
 
 
 				// Set egl_render to idle
 				ilclient_change_component_state(video_render, OMX_StateIdle);
 
 
-				// Enable the output port and tell egl_render to use the texture as a buffer
+				// One output buffer per texture of the ring
+				OMX_PARAM_PORTDEFINITIONTYPE portdef;
+				memset(&portdef, 0, sizeof(portdef));
+				portdef.nSize = sizeof(portdef);
+				portdef.nVersion.nVersion = OMX_VERSION;
+				portdef.nPortIndex = 221;
+				if (OMX_GetParameter(ILC_GET_HANDLE(video_render), OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone)
+				{
+					printf("OMX_GetParameter failed.\n");
+					exit(1);
+				}
+				portdef.nBufferCountActual = ring.count;
+				if (OMX_SetParameter(ILC_GET_HANDLE(video_render), OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone)
+				{
+					printf("error: egl_render doesn't take %d buffers.\n", ring.count);
+					exit(1);
+				}
+
+				// Enable the output port and tell egl_render to use the textures as buffers
 				//ilclient_enable_port(video_render, 221); THIS BLOCKS SO CANT BE USED
 				if (OMX_SendCommand(ILC_GET_HANDLE(video_render), OMX_CommandPortEnable, 221, NULL) != OMX_ErrorNone)
 				{
@@ -224,10 +532,15 @@ void* video_decode(VIDEO_INFO* arg)
 					exit(1);
 				}
 
-				if (OMX_UseEGLImage(ILC_GET_HANDLE(video_render), &eglBuffer, 221, NULL, videoInfo.egl_image) != OMX_ErrorNone)
+				for (i = 0; i < ring.count; i++)
 				{
-					printf("OMX_UseEGLImage failed.\n");
-					exit(1);
+					OMX_BUFFERHEADERTYPE* eglBuffer;
+					if (OMX_UseEGLImage(ILC_GET_HANDLE(video_render), &eglBuffer, 221, NULL, ring.slots[i].image) != OMX_ErrorNone)
+					{
+						printf("OMX_UseEGLImage failed.\n");
+						exit(1);
+					}
+					ring.slots[i].buffer = eglBuffer;
 				}
 
 
@@ -235,12 +548,12 @@ void* video_decode(VIDEO_INFO* arg)
 				ilclient_change_component_state(video_render, OMX_StateExecuting);
 
 
-				// Request egl_render to write data to the texture buffer
-				if(OMX_FillThisBuffer(ILC_GET_HANDLE(video_render), eglBuffer) != OMX_ErrorNone)
-				{
-					printf("OMX_FillThisBuffer failed.\n");
+				// Request egl_render to write data to the texture buffers; in
+				// batch mode it waits for the renderer rather than overwrite a
+				// frame that wasn't drawn
+				ring.keep_all = batch;
+				if (image_ring_start(&ring) < 0)
 					exit(1);
-				}
 			}
 			
 			if(!data_len)
@@ -249,15 +562,6 @@ void* video_decode(VIDEO_INFO* arg)
 			buf->nFilledLen = data_len;
 			data_len = 0;
 
-			buf->nOffset = 0;
-			if(first_packet)
-			{
-				buf->nFlags = OMX_BUFFERFLAG_STARTTIME;
-				first_packet = 0;
-			}
-			else
-				buf->nFlags = OMX_BUFFERFLAG_TIME_UNKNOWN;
-
 			if(OMX_EmptyThisBuffer(ILC_GET_HANDLE(video_decode), buf) != OMX_ErrorNone)
 			{
 				status = -6;
@@ -275,20 +579,30 @@ void* video_decode(VIDEO_INFO* arg)
 		// wait for EOS from render
 		//ilclient_wait_for_event(video_render, OMX_EventBufferFlag, 90, 0, OMX_BUFFERFLAG_EOS, 0,
 		//								ILCLIENT_BUFFER_FLAG_EOS, 10000);
+
+		// in batch mode every frame counts, so let the last ones through
+		// before the flush below
+		if (batch)
+			ilclient_wait_for_event(video_render, OMX_EventBufferFlag, 220, 0, OMX_BUFFERFLAG_EOS, 0,
+											ILCLIENT_BUFFER_FLAG_EOS, 10000);
 		
+		// stop handing the buffers back to egl_render
+		if (status == 0)
+			status = VIDEO_EOF;
+		image_ring_stop(&ring);
+
 		// need to flush the renderer to allow video_decode to disable its input port
 		ilclient_flush_tunnels(tunnel, 0);
 		
 		ilclient_disable_port_buffers(video_decode, 130, NULL, NULL, NULL);
 	}
 	
-	set_status(status);
+	set_status(status == 0 ? VIDEO_EOF : status);
 
-	fclose(in);
+	close_feed(&feed);
 
-	ilclient_disable_tunnel(tunnel);
-	ilclient_disable_tunnel(tunnel+1);
-	ilclient_disable_tunnel(tunnel+2);
+	for (t = tunnel; t->source != NULL; t++)
+		ilclient_disable_tunnel(t);
 	ilclient_teardown_tunnels(tunnel);
 
 	ilclient_state_transition(list, OMX_StateIdle);
@@ -304,7 +618,9 @@ void* video_decode(VIDEO_INFO* arg)
 
 
 
-int video_decode_dimensions(char *filename, int *frame_width, int *frame_height)
+// Learn the frame size from the decoder itself, for streams the SPS parser
+// doesn't understand
+static int omx_decode_dimensions(char *filename, int *frame_width, int *frame_height)
 {
 	OMX_PARAM_PORTDEFINITIONTYPE port_definition;
 	OMX_VIDEO_PARAM_PORTFORMATTYPE format;
@@ -402,3 +718,44 @@ int video_decode_dimensions(char *filename, int *frame_width, int *frame_height)
 
 	return status;
 }
+
+int video_decode_dimensions(char *filename, int *frame_width, int *frame_height, double *fps)
+{
+	H264_INFO_T info;
+	DEMUX_T* demux;
+
+	// a container has the SPS in its decoder configuration
+	if (demux_probe(filename, &demux) != 0)
+		return -1;
+	if (demux != NULL)
+	{
+		size_t size;
+		const uint8_t* config = demux_config(demux, &size);
+		int result = h264_parse_sps(config, size, &info);
+		double container_fps = demux_frame_rate(demux);
+		demux_close(demux);
+		if (result < 0)
+		{
+			printf("error: could not parse the H.264 SPS of %s.\n", filename);
+			return -1;
+		}
+		// Matroska rounds the default duration to the timestamp scale, so
+		// the VUI timing is preferred where the encoder wrote it
+		*fps = info.fps > 0 ? info.fps : container_fps;
+		*frame_width = info.width;
+		*frame_height = info.height;
+		return 0;
+	}
+
+	// parsing the SPS saves a whole OMX init/deinit cycle at startup
+	if (h264_probe_file(filename, &info) == 0)
+	{
+		*frame_width = info.width;
+		*frame_height = info.height;
+		*fps = info.fps;
+		return 0;
+	}
+
+	*fps = 0;
+	return omx_decode_dimensions(filename, frame_width, frame_height);
+}
@@ -0,0 +1,62 @@
+// Video decoder backends, chosen at build time: video.c decodes with OpenMAX
+// on the Pi and renders straight into the source texture through an EGL
+// image, video_av.c decodes with libavcodec and uploads frames into it on
+// the render thread
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdbool.h>
+
+#include "GLES2/gl2.h"
+#include "EGL/egl.h"
+
+// Part of the frame the decoder scales into the source texture, in frame
+// pixels; a width of 0 for the whole frame
+typedef struct
+{
+	int left, top;
+	int width, height;
+} VIDEO_CROP_T;
+
+typedef struct
+{
+	char* filename;
+	bool loop;
+	bool batch;     // decode every frame as fast as the renderer takes them
+	void* target;   // from video_attach_texture
+	int readahead;  // chunks of the movie file read ahead of the decoder
+	double start;   // seconds into the movie to play from, rounded down to a keyframe
+	double end;     // and to stop (or loop) at, rounded up to one; 0 for the end
+	VIDEO_CROP_T crop;
+	bool verbose;
+} VIDEO_INFO;
+
+// set_status() value for a decoder that reached the end of the movie
+#define VIDEO_EOF 1
+
+// Connect the decoder to the source texture, which is allocated at the
+// video size already, or the size the crop is scaled to. *target is handed to video_decode in VIDEO_INFO.
+int video_attach_texture(EGLDisplay display, EGLContext context, GLuint texture,
+	int width, int height, void** target);
+void video_detach_texture(EGLDisplay display, void* target);
+
+// Render thread: bring the source texture up to date before drawing and
+// return the texture to draw from, which on the Pi is one of a ring the
+// decoder fills in turn; hand it back once the GPU has finished with it.
+// In batch mode the decoder doesn't overwrite a frame before it has been
+// released.
+GLuint video_update_texture(void);
+void video_release_texture(void);
+
+// Decoder thread, started with a VIDEO_INFO
+void* video_decode(void* arg);
+// Frame size and rate of a movie, without starting a decoder; *fps is 0
+// if the movie doesn't say
+int video_decode_dimensions(char* filename, int* frame_width, int* frame_height, double* fps);
+
+// Implemented by the application; called from the decoder thread
+void set_frame_available();
+void set_status(int status);
+
+#endif
@@ -0,0 +1,386 @@
+// Video decode with libavformat/libavcodec, for the headless desktop build.
+// Frames are converted to RGBA and paced by their timestamps on the decoder
+// thread, then uploaded into the source texture on the render thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#include "stats.h"
+#include "video.h"
+
+// Three RGBA buffers rotate between the threads: the decoder fills back and
+// publishes it as ready, the renderer takes ready as front and uploads it.
+// Neither side waits for the other; frames that are not picked up in time
+// are overwritten. In batch mode the decoder waits for the renderer instead.
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t taken;
+	bool batch;
+	uint8_t* buffer[3];
+	int back, ready, front;
+	bool fresh;
+	int width, height;
+	GLuint texture;
+} AV_FRAMES_T;
+
+static AV_FRAMES_T frames = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, { NULL }, 0, 1, 2 };
+
+// maps frame timestamps to presentation times since the start of playback,
+// carrying on across loops
+typedef struct
+{
+	struct timespec start;
+	double time_base;
+	double fps;
+	double offset;      // presentation time of the first frame of this pass
+	double first_pts;   // timestamp of the first frame of this pass
+	double last;        // presentation time of the last frame
+	int64_t count;      // frames in this pass
+} AV_CLOCK_T;
+
+int video_attach_texture(EGLDisplay display, EGLContext context, GLuint texture,
+	int width, int height, void** target)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		frames.buffer[i] = calloc((size_t)width * height, 4);
+		if (frames.buffer[i] == NULL)
+		{
+			printf("error: could not allocate memory for video frames.\n");
+			return -1;
+		}
+	}
+	frames.width = width;
+	frames.height = height;
+	frames.texture = texture;
+
+	*target = &frames;
+	return 0;
+}
+
+void video_detach_texture(EGLDisplay display, void* target)
+{
+	// the decoder thread may still be unwinding from its cancellation, so
+	// the buffers are left to go with the process
+}
+
+GLuint video_update_texture(void)
+{
+	bool fresh;
+
+	pthread_mutex_lock(&frames.lock);
+	fresh = frames.fresh;
+	if (fresh)
+	{
+		int ready = frames.ready;
+		frames.ready = frames.front;
+		frames.front = ready;
+		frames.fresh = false;
+		pthread_cond_signal(&frames.taken);
+	}
+	pthread_mutex_unlock(&frames.lock);
+
+	if (!fresh)
+		return frames.texture;
+
+	// rows are top down, the same as egl_render leaves them on the Pi
+	glBindTexture(GL_TEXTURE_2D, frames.texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frames.width, frames.height,
+					 GL_RGBA, GL_UNSIGNED_BYTE, frames.buffer[frames.front]);
+	return frames.texture;
+}
+
+void video_release_texture(void)
+{
+	// nothing to do, the frame was copied into the texture
+}
+
+static void publish_frame(void)
+{
+	pthread_mutex_lock(&frames.lock);
+	while (frames.batch && frames.fresh)
+		pthread_cond_wait(&frames.taken, &frames.lock);
+	int back = frames.back;
+	frames.back = frames.ready;
+	frames.ready = back;
+	frames.fresh = true;
+	pthread_mutex_unlock(&frames.lock);
+
+	set_frame_available();
+}
+
+static double frame_time(AV_CLOCK_T* clock, const AVFrame* frame)
+{
+	// raw elementary streams have no timestamps, play those at the frame rate
+	double pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ?
+		frame->best_effort_timestamp * clock->time_base : clock->count / clock->fps;
+
+	if (clock->count++ == 0)
+		clock->first_pts = pts;
+	clock->last = clock->offset + pts - clock->first_pts;
+	return clock->last;
+}
+
+// sleep until time seconds after the start of playback
+static void wait_until(const AV_CLOCK_T* clock, double time)
+{
+	struct timespec ts = clock->start;
+
+	if (time > 0)
+	{
+		ts.tv_sec += (time_t)time;
+		ts.tv_nsec += (long)((time - (time_t)time) * 1e9);
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// Point data at the top left of the crop in every plane of frame, so the
+// scaler only reads the part of the frame the map samples. The crop starts
+// on even pixels, so it starts on a whole chroma sample as well.
+static void crop_frame(const AVFrame* frame, const VIDEO_CROP_T* crop,
+	const uint8_t* data[4], int* width, int* height)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(frame->format);
+	int i;
+
+	for (i = 0; i < 4; i++)
+		data[i] = frame->data[i];
+	*width = frame->width;
+	*height = frame->height;
+	if (crop->width == 0 || desc == NULL ||
+		(desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)) ||
+		crop->left + crop->width > frame->width || crop->top + crop->height > frame->height)
+		return;
+
+	for (i = 0; i < desc->nb_components; i++)
+	{
+		const AVComponentDescriptor* comp = &desc->comp[i];
+		bool chroma = i == 1 || i == 2;
+		int x = chroma ? crop->left >> desc->log2_chroma_w : crop->left;
+		int y = chroma ? crop->top >> desc->log2_chroma_h : crop->top;
+
+		data[comp->plane] = frame->data[comp->plane] +
+			(ptrdiff_t)y * frame->linesize[comp->plane] + x * comp->step;
+	}
+	*width = crop->width;
+	*height = crop->height;
+}
+
+// Convert, pace and publish every frame the decoder has ready
+static int receive_frames(AVCodecContext* codec, AVFrame* frame, const VIDEO_CROP_T* crop,
+	struct SwsContext** scaler, AV_CLOCK_T* clock)
+{
+	int ret;
+
+	while ((ret = avcodec_receive_frame(codec, frame)) == 0)
+	{
+		const uint8_t* data[4];
+		int width, height;
+
+		crop_frame(frame, crop, data, &width, &height);
+		*scaler = sws_getCachedContext(*scaler, width, height, frame->format,
+			frames.width, frames.height, AV_PIX_FMT_RGBA, SWS_BILINEAR, NULL, NULL, NULL);
+		if (*scaler == NULL)
+		{
+			printf("error: no conversion from pixel format %d to RGBA.\n", frame->format);
+			av_frame_unref(frame);
+			return -1;
+		}
+
+		uint8_t* dst[4] = { frames.buffer[frames.back], NULL, NULL, NULL };
+		int dst_stride[4] = { frames.width * 4, 0, 0, 0 };
+		sws_scale(*scaler, data, frame->linesize, 0, height, dst, dst_stride);
+
+		// the first frame after seeking back to the start
+		bool loop_point = clock->count == 0 && clock->offset > 0;
+		double time = frame_time(clock, frame);
+		av_frame_unref(frame);
+
+		if (!frames.batch)
+			wait_until(clock, time);
+		if (loop_point)
+			stats_loop_point();
+		publish_frame();
+	}
+
+	return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : -1;
+}
+
+// Open the movie and a decoder for its video stream; returns the stream index
+static int open_video(const char* filename, AVFormatContext** format, AVCodecContext** codec)
+{
+	const AVCodec* decoder = NULL;
+	int stream;
+
+	if (avformat_open_input(format, filename, NULL, NULL) < 0)
+	{
+		printf("error: could not open %s.\n", filename);
+		return -1;
+	}
+	if (avformat_find_stream_info(*format, NULL) < 0)
+	{
+		printf("error: could not read stream info from %s.\n", filename);
+		return -1;
+	}
+
+	stream = av_find_best_stream(*format, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+	if (stream < 0)
+	{
+		printf("error: no video stream in %s.\n", filename);
+		return -1;
+	}
+
+	*codec = avcodec_alloc_context3(decoder);
+	if (*codec == NULL ||
+		avcodec_parameters_to_context(*codec, (*format)->streams[stream]->codecpar) < 0)
+	{
+		printf("error: could not set up the %s decoder.\n", decoder->name);
+		return -1;
+	}
+
+	// one thread per core; frame threading adds a few frames of latency
+	(*codec)->thread_count = 0;
+	if (avcodec_open2(*codec, decoder, NULL) < 0)
+	{
+		printf("error: could not open the %s decoder.\n", decoder->name);
+		return -1;
+	}
+
+	return stream;
+}
+
+void* video_decode(void* arg)
+{
+	VIDEO_INFO videoInfo = *(VIDEO_INFO*)arg;
+	AVFormatContext* format = NULL;
+	AVCodecContext* codec = NULL;
+	struct SwsContext* scaler = NULL;
+	AVPacket* packet = av_packet_alloc();
+	AVFrame* frame = av_frame_alloc();
+	AV_CLOCK_T clock;
+	int64_t start_ts = 0, end_ts = INT64_MAX;
+	int status = 0;
+
+	memset(&clock, 0, sizeof(clock));
+	frames.batch = videoInfo.batch;
+
+	int stream = open_video(videoInfo.filename, &format, &codec);
+	if (stream < 0 || packet == NULL || frame == NULL)
+		status = -2;
+
+	if (status == 0)
+	{
+		AVStream* video = format->streams[stream];
+		clock.time_base = av_q2d(video->time_base);
+		clock.fps = av_q2d(av_guess_frame_rate(format, video, NULL));
+		if (!(clock.fps > 0))
+			clock.fps = 25;
+
+		// the range in stream timestamps: the seek lands on the keyframe
+		// before the start, and the movie ends at the first one after the end
+		int64_t first_ts = video->start_time != AV_NOPTS_VALUE ? video->start_time : 0;
+		if (videoInfo.start > 0)
+			start_ts = first_ts + (int64_t)(videoInfo.start / clock.time_base);
+		if (videoInfo.end > 0)
+			end_ts = first_ts + (int64_t)(videoInfo.end / clock.time_base);
+		if (start_ts > 0 && av_seek_frame(format, stream, start_ts, AVSEEK_FLAG_BACKWARD) < 0)
+		{
+			printf("error: could not seek to %.3f s.\n", videoInfo.start);
+			status = -7;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &clock.start);
+	}
+
+	while (status == 0)
+	{
+		bool end = av_read_frame(format, packet) < 0;
+		if (!end && packet->stream_index == stream && (packet->flags & AV_PKT_FLAG_KEY) &&
+			packet->pts != AV_NOPTS_VALUE && packet->pts >= end_ts)
+		{
+			av_packet_unref(packet);
+			end = true;
+		}
+
+		if (end)
+		{
+			// end of the movie or the range: drain the decoder
+			avcodec_send_packet(codec, NULL);
+			if (receive_frames(codec, frame, &videoInfo.crop, &scaler, &clock) < 0)
+				status = -6;
+			if (!videoInfo.loop || status != 0)
+				break;
+
+			// and start over one frame period after the last frame
+			if (av_seek_frame(format, stream, start_ts, AVSEEK_FLAG_BACKWARD) < 0)
+			{
+				printf("error: could not seek back to the start.\n");
+				status = -7;
+				break;
+			}
+			avcodec_flush_buffers(codec);
+			clock.offset = clock.last + 1.0 / clock.fps;
+			clock.count = 0;
+			continue;
+		}
+
+		if (packet->stream_index == stream)
+		{
+			if (avcodec_send_packet(codec, packet) < 0 ||
+				receive_frames(codec, frame, &videoInfo.crop, &scaler, &clock) < 0)
+				status = -6;
+		}
+		av_packet_unref(packet);
+	}
+
+	set_status(status == 0 ? VIDEO_EOF : status);
+
+	sws_freeContext(scaler);
+	av_frame_free(&frame);
+	av_packet_free(&packet);
+	avcodec_free_context(&codec);
+	avformat_close_input(&format);
+
+	return (void *)(intptr_t)status;
+}
+
+int video_decode_dimensions(char *filename, int *frame_width, int *frame_height, double *fps)
+{
+	AVFormatContext* format = NULL;
+	AVCodecContext* codec = NULL;
+	int status = -1;
+	int stream = open_video(filename, &format, &codec);
+
+	if (stream >= 0)
+	{
+		*frame_width = codec->width;
+		*frame_height = codec->height;
+		*fps = av_q2d(av_guess_frame_rate(format, format->streams[stream], NULL));
+		if (!(*fps > 0))
+			*fps = 0;
+		status = 0;
+	}
+
+	avcodec_free_context(&codec);
+	avformat_close_input(&format);
+	return status;
+}
@@ -0,0 +1,260 @@
+// Persistent worker pool with per-worker work stealing queues
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+// queues hold 16 bit item indices, larger jobs are run in chunks
+#define QUEUE_MAX 0xffff
+
+typedef struct
+{
+	// head in the low 16 bits, tail in the high 16 bits, so both ends can
+	// be updated with a single 32 bit compare-and-swap
+	uint32_t range;
+	// keep every queue on its own cache line
+	char pad[60];
+} WORKER_QUEUE_T;
+
+typedef struct
+{
+	WORKERS_T* pool;
+	int index;
+} WORKER_ARG_T;
+
+struct WORKERS_T
+{
+	int count;
+	pthread_t* threads;
+	WORKER_ARG_T* args;
+	WORKER_QUEUE_T* queues;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned generation;
+	int busy;
+	bool quit;
+
+	// current job
+	WORKERS_FN fn;
+	void* arg;
+	int base;
+};
+
+static int queue_pop(WORKER_QUEUE_T* queue)
+{
+	uint32_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+	for (;;)
+	{
+		uint32_t head = range & 0xffff, tail = range >> 16;
+		if (head >= tail)
+			return -1;
+		if (__atomic_compare_exchange_n(&queue->range, &range, (head + 1) | (tail << 16),
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return head;
+	}
+}
+
+static int queue_steal(WORKER_QUEUE_T* queue)
+{
+	uint32_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+	for (;;)
+	{
+		uint32_t head = range & 0xffff, tail = range >> 16;
+		if (head >= tail)
+			return -1;
+		if (__atomic_compare_exchange_n(&queue->range, &range, head | ((tail - 1) << 16),
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return tail - 1;
+	}
+}
+
+static int steal(WORKERS_T* pool, int self)
+{
+	for (;;)
+	{
+		// take from the queue with the most work left, from the far end so
+		// the owner keeps its neighbouring items
+		int i, victim = -1, most = 0;
+		for (i = 0; i < pool->count; i++)
+		{
+			uint32_t range = __atomic_load_n(&pool->queues[i].range, __ATOMIC_RELAXED);
+			int left = (int)(range >> 16) - (int)(range & 0xffff);
+			if (i != self && left > most)
+			{
+				most = left;
+				victim = i;
+			}
+		}
+		if (victim < 0)
+			return -1;
+
+		int item = queue_steal(&pool->queues[victim]);
+		if (item >= 0)
+			return item;
+	}
+}
+
+static void work(WORKERS_T* pool, int self)
+{
+	for (;;)
+	{
+		int item = queue_pop(&pool->queues[self]);
+		if (item < 0)
+			item = steal(pool, self);
+		if (item < 0)
+			break;
+		pool->fn(pool->arg, pool->base + item, self);
+	}
+}
+
+static void* worker_thread(void* data)
+{
+	WORKER_ARG_T* worker = data;
+	WORKERS_T* pool = worker->pool;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (pool->generation == seen && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		work(pool, worker->index);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+WORKERS_T* workers_create(int count)
+{
+	int i;
+	int cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1)
+		cores = 1;
+	if (count <= 0)
+		count = cores;
+
+	WORKERS_T* pool = calloc(1, sizeof(WORKERS_T));
+	if (pool == NULL)
+		return NULL;
+
+	pool->count = count;
+	pool->threads = calloc(count, sizeof(pthread_t));
+	pool->args = calloc(count, sizeof(WORKER_ARG_T));
+	if (posix_memalign((void**)&pool->queues, 64, count * sizeof(WORKER_QUEUE_T)) != 0)
+		pool->queues = NULL;
+	if (pool->threads == NULL || pool->args == NULL || pool->queues == NULL)
+	{
+		printf("error: could not allocate memory for worker pool\n");
+		free(pool->threads);
+		free(pool->args);
+		free(pool->queues);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// the calling thread is worker 0
+	for (i = 0; i < count; i++)
+	{
+		pool->args[i].pool = pool;
+		pool->args[i].index = i;
+		pool->queues[i].range = 0;
+		if (i == 0)
+			continue;
+
+		pthread_create(&pool->threads[i], NULL, worker_thread, &pool->args[i]);
+
+		// pin workers so their queue's source region stays in one core's
+		// cache; the calling thread is left alone
+		if (count <= cores)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(i, &set);
+			pthread_setaffinity_np(pool->threads[i], sizeof(set), &set);
+		}
+	}
+
+	return pool;
+}
+
+void workers_destroy(WORKERS_T* pool)
+{
+	int i;
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool->args);
+	free(pool->queues);
+	free(pool);
+}
+
+int workers_count(const WORKERS_T* pool)
+{
+	return pool->count;
+}
+
+void workers_run(WORKERS_T* pool, int n, WORKERS_FN fn, void* arg)
+{
+	int base, i;
+
+	for (base = 0; base < n; base += QUEUE_MAX)
+	{
+		int chunk = n - base < QUEUE_MAX ? n - base : QUEUE_MAX;
+
+		pthread_mutex_lock(&pool->lock);
+		pool->fn = fn;
+		pool->arg = arg;
+		pool->base = base;
+		for (i = 0; i < pool->count; i++)
+		{
+			uint32_t head = (uint32_t)((int64_t)i * chunk / pool->count);
+			uint32_t tail = (uint32_t)((int64_t)(i + 1) * chunk / pool->count);
+			__atomic_store_n(&pool->queues[i].range, head | (tail << 16), __ATOMIC_RELEASE);
+		}
+		pool->busy = pool->count - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->start);
+		pthread_mutex_unlock(&pool->lock);
+
+		work(pool, 0);
+
+		pthread_mutex_lock(&pool->lock);
+		while (pool->busy > 0)
+			pthread_cond_wait(&pool->done, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
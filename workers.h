@@ -0,0 +1,23 @@
+// Persistent worker pool with per-worker work stealing queues
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+// Called once for every item; worker is the index of the calling thread
+typedef void (*WORKERS_FN)(void* arg, int item, int worker);
+
+typedef struct WORKERS_T WORKERS_T;
+
+// Create a pool of count threads (including the caller), or one per online
+// core if count <= 0. The threads are kept until workers_destroy.
+WORKERS_T* workers_create(int count);
+void workers_destroy(WORKERS_T* pool);
+int workers_count(const WORKERS_T* pool);
+
+// Run fn for items 0..n-1 and wait until all of them are done. Worker w
+// starts on the contiguous range [w*n/count, (w+1)*n/count) so items that
+// are close together in the list stay on one core; idle workers steal from
+// the tail of the busiest queue.
+void workers_run(WORKERS_T* pool, int n, WORKERS_FN fn, void* arg);
+
+#endif